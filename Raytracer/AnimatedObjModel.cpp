@@ -1,6 +1,12 @@
 #include "AnimatedObjModel.h"
-#include <fstream>
-using std::ifstream;
+
+#include "Bvh.h"
+#include "IndexedMesh.h"
+#include "ObjParser.h"
+#include "SkinnedBvh.h"
+
+#include <sstream>
+#include <stdexcept>
 
 AnimatedObjModel::AnimatedObjModel(cl::Context _context)
 	: context(_context)
@@ -9,208 +15,78 @@ AnimatedObjModel::AnimatedObjModel(cl::Context _context)
 
 ModelData::ptr AnimatedObjModel::loadFromFile(const std::string& _path)
 {
-	std::ifstream dataStream(_path);
-	if (dataStream.fail())
+	loadFile(_path);
+	calculateModelVectors();
+
+	// Built over the bind pose, the hierarchy is refitted to the skinned vertices every frame
+	std::vector<glm::vec3> positions(mModel.size());
+	for (size_t i = 0; i < mModel.size(); ++i)
 	{
-		throw std::exception(("Could not open model file: " + _path).c_str());
+		positions[i] = glm::vec3(mModel[i].position);
 	}
 
-	loadFile(dataStream);
-	calculateModelVectors();
-	cl::Buffer vertexBuffer = initializeVertexBuffer();
+	Bvh bvh;
+	bvh.build(positions);
+	bvh.reorderTriangles(mModel);
+
+	// Corners shared between triangles are skinned once
+	IndexedMesh::indexTriangles(mModel, &VertexType::texCoord, &VertexType::bitangent, &VertexType::bone, vertices, indices);
+
+	// Without a context only the host copies are kept, for renderers that do not use OpenCL
+	cl::Buffer vertexBuffer;
+	cl::Buffer indexBuffer;
+	cl::Buffer bvhBuffer;
+	if (context() != nullptr)
+	{
+		vertexBuffer = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(VertexType) * vertices.size(), vertices.data());
+		indexBuffer = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(uint32_t) * indices.size(), indices.data());
+		bvhBuffer = bvh.createBuffer(context);
+	}
 
-	ModelData::ptr result(new ModelData(vertexBuffer, mModel.size()));
+	ModelData::ptr result(new ModelData(vertexBuffer, vertices.size(), indexBuffer, indices.size() / 3));
 	result->setBindPose(bones);
+	result->setBvh(bvh, bvhBuffer);
+	result->setSkinnedBvh(SkinnedBvh::ptr(new SkinnedBvh(context, bvh, vertices, indices, bones.size())));
 
 	mModel.clear();
+	vertices.clear();
+	indices.clear();
 	bones.clear();
 
 	return result;
 }
 
-cl::Buffer AnimatedObjModel::initializeVertexBuffer()
+void AnimatedObjModel::loadFile(const std::string& _path)
 {
-	return cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(VertexType) * mModel.size(), mModel.data());
-}
-
-void AnimatedObjModel::loadFile(std::ifstream& _dataStream)
-{
-	DataCounts counts = readFileCounts(_dataStream);
-	_dataStream.clear(std::ios::goodbit);
-	_dataStream.seekg(0, std::ios::beg);
-	loadDataStructures(_dataStream, counts);
-}
-
-AnimatedObjModel::DataCounts AnimatedObjModel::readFileCounts(std::ifstream& _dataStream)
-{	
-	DataCounts counts;
-
-	char tInput;
-	counts.positions = 0;
-	counts.texCoords = 0;
-	counts.normals = 0;
-	counts.faces = 0;
-	counts.groups = 0;
-	counts.bones = 0;
-
-	_dataStream.get(tInput);
-	while(!_dataStream.eof())
+	ObjParser::Data data;
+	std::string error;
+	if (!ObjParser::parseFile(_path, data, error))
 	{
-		if(tInput == 'v')
-		{
-			_dataStream.get(tInput);
-			if(tInput == ' ') 
-			{
-				counts.positions++;
-			}
-
-			if(tInput == 't')
-			{
-				counts.texCoords++;
-			}
-
-			if(tInput == 'n')
-			{
-				counts.normals++;
-			}
-		}
-
-		if(tInput == 'g')
-		{
-			counts.groups++;
-		}
-
-		if(tInput == 'f')
-		{
-			counts.faces++;
-		}
-
-		if (tInput == 'b')
-		{
-			counts.bones++;
-		}
-
-		while(tInput != '\n')
-		{
-			_dataStream.get(tInput);
-		}
-
-		_dataStream.get(tInput);
+		throw std::runtime_error(error);
 	}
 
-	return counts;
-}
-
-void AnimatedObjModel::loadDataStructures(std::ifstream& _dataStream, const DataCounts& counts)
-{
-	std::vector<glm::vec3> tVertices;
-	std::vector<glm::vec2> tTexCoords;
-	std::vector<glm::vec3> tNormals;
-	std::vector<FaceType> tFaces;
-
-	char tInput1;
-	
-	int tVertexIndex = 0;
-	int tTexcoordIndex = 0;
-	int tNormalIndex = 0;
-	int tFaceIndex = 0;
-	int tBoneIndex = 0;
-
-	mModel.resize(counts.faces * 3);
-
-	//Initialize the four data structures.
-	tVertices.resize(counts.positions);
-	tTexCoords.resize(counts.texCoords);
-	tNormals.resize(counts.normals);
-	tFaces.resize(counts.faces);
-	bones.resize(counts.bones);
-
-	while(_dataStream)
+	bones.resize(data.bones.size());
+	for (size_t i = 0; i < data.bones.size(); ++i)
 	{
-		_dataStream.get(tInput1);
-
-		if (tInput1 == '#')
-		{
-#undef max
-			_dataStream.ignore(std::numeric_limits<int>::max(), '\n');
-			continue;
-		}
-
-		if(tInput1 == 'v')
-		{
-			_dataStream.get(tInput1);
-
-			//Read in the vertices.
-			if(tInput1 == ' ') 
-			{ 
-				_dataStream >> tVertices[tVertexIndex].x;
-				_dataStream >> tVertices[tVertexIndex].y;
-				_dataStream >> tVertices[tVertexIndex].z;
-				tVertexIndex++; 
-			}
-
-			//Read in the texture uv coordinates.
-			if(tInput1 == 't') 
-			{ 
-				_dataStream >> tTexCoords[tTexcoordIndex].x;
-				_dataStream >> tTexCoords[tTexcoordIndex].y;
-				tTexcoordIndex++; 
-			}
-
-			//Read in the normals.
-			if(tInput1 == 'n') 
-			{ 
-				_dataStream >> tNormals[tNormalIndex].x;
-				_dataStream >> tNormals[tNormalIndex].y;
-				_dataStream >> tNormals[tNormalIndex].z;
-				tNormalIndex++; 
-			}
-		}
-
-		//Read in the faces.
-		if(tInput1 == 'f') 
-		{
-			_dataStream.get(tInput1);
-			if(tInput1 == ' ')
-			{
-				FaceType& triangle = tFaces[tFaceIndex];
-				_dataStream >> triangle.v[0] >>
-					triangle.v[1] >>
-					triangle.v[2];
-				tFaceIndex++;
-			}
-		}
-
-		if (tInput1 == 'b')
-		{
-			_dataStream >> bones[tBoneIndex];
-			tBoneIndex++;
-		}
+		std::istringstream boneStream(data.bones[i]);
+		boneStream >> bones[i];
 	}
 
 	Bone::setupSkeleton(bones);
 
-	int i = 0;
-	int j = 0;
-	bool done = false;
-	while(!done)
+	mModel.resize(data.corners.size());
+	for (size_t i = 0; i < data.corners.size(); ++i)
 	{
-		for (int face = 0; face < 3; ++face)
+		const ObjParser::Corner& corner = data.corners[i];
+		if (corner.texCoord == -1 || corner.normal == -1 || corner.bone == -1)
 		{
-			const IVertex& v = tFaces[i].v[face];
-
-			mModel[j].position = glm::vec4(tVertices[v.posIndex - 1], 1.f);
-			mModel[j].texCoord = glm::vec4(tTexCoords[v.texIndex - 1], 0.f, 0.f);
-			mModel[j].normal = glm::vec4(tNormals[v.normalIndex - 1], 0.f);
-			mModel[j].bone = v.bone - 1;
-			j++;
+			throw std::runtime_error("Animated models need texture coordinates, normals and bones on every face: " + _path);
 		}
 
-		i++;
-		if((i == tFaceIndex) || (j == mModel.size()))
-		{
-			done = true;
-		}
+		mModel[i].position = glm::vec4(data.positions[corner.position], 1.f);
+		mModel[i].texCoord = glm::vec4(data.texCoords[corner.texCoord], 0.f, 0.f);
+		mModel[i].normal = glm::vec4(data.normals[corner.normal], 0.f);
+		mModel[i].bone = corner.bone;
 	}
 }
 
@@ -266,16 +142,16 @@ void AnimatedObjModel::calculateTangentBinormal(TempVertexType vertex1,
 	tangent = (tvVector[1] * tVector1 - tuVector[1] * tVector2) * den;
 	binormal = (tuVector[0] * tVector2 - tvVector[0] * tVector1) * den;
 
+	// Texture coordinates without area give no tangent, normalize would turn the inf or zero into NaN
+	float tangentLength = glm::length(tangent);
+	float binormalLength = glm::length(binormal);
+	if (!(tangentLength > 0.f && tangentLength <= 1e30f && binormalLength > 0.f && binormalLength <= 1e30f))
+	{
+		glm::vec3 normal = IndexedMesh::getFrameNormal(vertex1.normal + vertex2.normal + vertex3.normal, glm::cross(tVector1, tVector2));
+		IndexedMesh::buildTangentFrame(normal, tangent, binormal);
+		return;
+	}
+
 	tangent = glm::normalize(tangent);
 	binormal = glm::normalize(binormal);
 }
-
-std::istream& operator>>(std::istream& _stream, AnimatedObjModel::IVertex& _vert)
-{
-	char sep;
-
-	return _stream >> _vert.posIndex >> sep >>
-		_vert.texIndex >> sep >>
-		_vert.normalIndex >> sep >>
-		_vert.bone;
-}
@@ -24,35 +24,17 @@ public:
 		uint32_t padding[3];
 	};
 private:
-	struct IVertex
-	{
-		int posIndex;
-		int texIndex;
-		int normalIndex;
-		int bone;
-	};
-	struct FaceType
-	{
-		IVertex v[3];
-	};
 	struct TempVertexType
 	{
 		glm::vec3 pos;
 		glm::vec2 texCoord;
 		glm::vec3 normal;
 	};
-	struct DataCounts
-	{
-		unsigned int positions;
-		unsigned int texCoords;
-		unsigned int normals;
-		unsigned int bones;
-		unsigned int faces;
-		unsigned int groups;
-	};
 
 	cl::Context context;
 	std::vector<VertexType> mModel;
+	std::vector<VertexType> vertices;
+	std::vector<uint32_t> indices;
 	std::vector<Bone> bones;
 
 public:
@@ -61,16 +43,11 @@ public:
 	ModelData::ptr loadFromFile(const std::string& _path);
 
 private:
-	cl::Buffer initializeVertexBuffer();
 
-	void loadFile(std::ifstream& _dataStream);
-	DataCounts readFileCounts(std::ifstream& _dataStream);
-	void loadDataStructures(std::ifstream& _dataStream, const DataCounts& counts);
+	void loadFile(const std::string& _path);
 
 	void calculateModelVectors();
 	void calculateTangentBinormal(TempVertexType vertex1,
 		TempVertexType vertex2, TempVertexType vertex3, glm::vec3& tangent,
 		glm::vec3& binormal);
-
-	friend std::istream& operator>>(std::istream& _stream, IVertex& _vert);
 };
\ No newline at end of file
@@ -0,0 +1,351 @@
+#include "Bvh.h"
+
+#include <algorithm>
+
+static const unsigned int NUM_BINS = 16;
+static const unsigned int MAX_LEAF_SIZE = 8;
+static const float LARGE_EXTENT = 1e30f;
+
+static float surfaceArea(const glm::vec3& _min, const glm::vec3& _max)
+{
+	glm::vec3 extent = _max - _min;
+	return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+}
+
+Bvh::Bvh()
+	: buildTime(0)
+{
+}
+
+void Bvh::build(const std::vector<glm::vec3>& _trianglePositions)
+{
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	unsigned int triangleCount = _trianglePositions.size() / 3;
+
+	std::vector<PrimitiveBounds> triangles(triangleCount);
+	for (unsigned int i = 0; i < triangleCount; ++i)
+	{
+		const glm::vec3& v0 = _trianglePositions[i * 3 + 0];
+		const glm::vec3& v1 = _trianglePositions[i * 3 + 1];
+		const glm::vec3& v2 = _trianglePositions[i * 3 + 2];
+
+		triangles[i].min = glm::min(v0, glm::min(v1, v2));
+		triangles[i].max = glm::max(v0, glm::max(v1, v2));
+		triangles[i].centroid = (v0 + v1 + v2) * (1.f / 3.f);
+	}
+
+	buildFromPrimitives(triangles);
+
+	buildTime = std::chrono::high_resolution_clock::now() - startTime;
+}
+
+void Bvh::buildFromBounds(const std::vector<glm::vec3>& _mins, const std::vector<glm::vec3>& _maxs)
+{
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	boundsPrimitives.resize(_mins.size());
+	for (size_t i = 0; i < _mins.size(); ++i)
+	{
+		boundsPrimitives[i].min = _mins[i];
+		boundsPrimitives[i].max = _maxs[i];
+		boundsPrimitives[i].centroid = (_mins[i] + _maxs[i]) * 0.5f;
+	}
+
+	buildFromPrimitives(boundsPrimitives);
+
+	buildTime = std::chrono::high_resolution_clock::now() - startTime;
+}
+
+void Bvh::setNodes(const Node* _nodes, size_t _count)
+{
+	nodes.assign(_nodes, _nodes + _count);
+
+	unsigned int primitiveCount = 0;
+	for (const Node& node : nodes)
+	{
+		primitiveCount += node.count;
+	}
+
+	primitiveOrder.resize(primitiveCount);
+	for (unsigned int i = 0; i < primitiveCount; ++i)
+	{
+		primitiveOrder[i] = i;
+	}
+
+	buildTime = std::chrono::high_resolution_clock::duration(0);
+}
+
+const std::vector<Bvh::Node>& Bvh::getNodes() const
+{
+	return nodes;
+}
+
+const std::vector<unsigned int>& Bvh::getPrimitiveOrder() const
+{
+	return primitiveOrder;
+}
+
+std::chrono::high_resolution_clock::duration Bvh::getBuildTime() const
+{
+	return buildTime;
+}
+
+void Bvh::getRefitOrder(std::vector<int32_t>& _order, std::vector<unsigned int>& _levelOffsets) const
+{
+	std::vector<std::vector<int32_t>> levels;
+	levels.push_back(std::vector<int32_t>(1, 0));
+
+	while (true)
+	{
+		std::vector<int32_t> nextLevel;
+		for (int32_t nodeIndex : levels.back())
+		{
+			if (nodes[nodeIndex].count == 0)
+			{
+				nextLevel.push_back(nodes[nodeIndex].leftFirst);
+				nextLevel.push_back(nodes[nodeIndex].leftFirst + 1);
+			}
+		}
+
+		if (nextLevel.empty())
+		{
+			break;
+		}
+
+		levels.push_back(nextLevel);
+	}
+
+	_order.clear();
+	_levelOffsets.clear();
+	for (auto level = levels.rbegin(); level != levels.rend(); ++level)
+	{
+		_levelOffsets.push_back(_order.size());
+		_order.insert(_order.end(), level->begin(), level->end());
+	}
+	_levelOffsets.push_back(_order.size());
+}
+
+float Bvh::calculateCost(const std::vector<Node>& _nodes)
+{
+	if (_nodes.empty())
+	{
+		return 0.f;
+	}
+
+	float cost = 0.f;
+	for (const Node& node : _nodes)
+	{
+		float area = surfaceArea(glm::vec3(node.min), glm::vec3(node.max));
+		cost += node.count > 0 ? area * node.count : area;
+	}
+
+	float rootArea = surfaceArea(glm::vec3(_nodes[0].min), glm::vec3(_nodes[0].max));
+	return rootArea > 0.f ? cost / rootArea : 0.f;
+}
+
+void Bvh::transformBounds(const glm::mat4& _transform, const glm::vec4& _min, const glm::vec4& _max, glm::vec3& _outMin, glm::vec3& _outMax)
+{
+	_outMin = glm::vec3(LARGE_EXTENT);
+	_outMax = glm::vec3(-LARGE_EXTENT);
+
+	for (int i = 0; i < 8; ++i)
+	{
+		glm::vec4 corner(
+			(i & 1) ? _max.x : _min.x,
+			(i & 2) ? _max.y : _min.y,
+			(i & 4) ? _max.z : _min.z,
+			1.f);
+		glm::vec3 transformed(_transform * corner);
+
+		_outMin = glm::min(_outMin, transformed);
+		_outMax = glm::max(_outMax, transformed);
+	}
+}
+
+cl::Buffer Bvh::createBuffer(cl::Context& _context) const
+{
+	return cl::Buffer(_context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(Node) * nodes.size(), (void*)nodes.data());
+}
+
+void Bvh::buildFromPrimitives(const std::vector<PrimitiveBounds>& _primitives)
+{
+	unsigned int primitiveCount = _primitives.size();
+
+	primitiveOrder.resize(primitiveCount);
+	for (unsigned int i = 0; i < primitiveCount; ++i)
+	{
+		primitiveOrder[i] = i;
+	}
+
+	nodes.clear();
+	nodes.reserve(primitiveCount * 2 + 1);
+
+	Node root;
+	root.leftFirst = 0;
+	root.count = primitiveCount;
+	nodes.push_back(root);
+
+	updateNodeBounds(0, _primitives);
+	subdivide(0, 1, _primitives);
+}
+
+void Bvh::updateNodeBounds(unsigned int _nodeIndex, const std::vector<PrimitiveBounds>& _primitives)
+{
+	Node& node = nodes[_nodeIndex];
+
+	glm::vec3 nodeMin(LARGE_EXTENT);
+	glm::vec3 nodeMax(-LARGE_EXTENT);
+	for (int i = node.leftFirst; i < node.leftFirst + node.count; ++i)
+	{
+		const PrimitiveBounds& primitive = _primitives[primitiveOrder[i]];
+		nodeMin = glm::min(nodeMin, primitive.min);
+		nodeMax = glm::max(nodeMax, primitive.max);
+	}
+
+	node.min = glm::vec4(nodeMin, 1.f);
+	node.max = glm::vec4(nodeMax, 1.f);
+}
+
+// Binned surface area heuristic, see "On fast Construction of SAH-based Bounding Volume Hierarchies", Wald 2007
+void Bvh::subdivide(unsigned int _nodeIndex, unsigned int _depth, const std::vector<PrimitiveBounds>& _primitives)
+{
+	const int first = nodes[_nodeIndex].leftFirst;
+	const int count = nodes[_nodeIndex].count;
+
+	if (count <= 2 || _depth >= MAX_DEPTH)
+	{
+		return;
+	}
+
+	glm::vec3 centroidMin(LARGE_EXTENT);
+	glm::vec3 centroidMax(-LARGE_EXTENT);
+	for (int i = first; i < first + count; ++i)
+	{
+		const glm::vec3& centroid = _primitives[primitiveOrder[i]].centroid;
+		centroidMin = glm::min(centroidMin, centroid);
+		centroidMax = glm::max(centroidMax, centroid);
+	}
+
+	struct Bin
+	{
+		glm::vec3 min;
+		glm::vec3 max;
+		int count;
+	};
+
+	float bestCost = LARGE_EXTENT;
+	int bestAxis = -1;
+	unsigned int bestSplit = 0;
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		float extent = centroidMax[axis] - centroidMin[axis];
+		if (extent <= 0.f)
+		{
+			continue;
+		}
+
+		Bin bins[NUM_BINS];
+		for (unsigned int b = 0; b < NUM_BINS; ++b)
+		{
+			bins[b].min = glm::vec3(LARGE_EXTENT);
+			bins[b].max = glm::vec3(-LARGE_EXTENT);
+			bins[b].count = 0;
+		}
+
+		float scale = NUM_BINS / extent;
+		for (int i = first; i < first + count; ++i)
+		{
+			const PrimitiveBounds& primitive = _primitives[primitiveOrder[i]];
+			unsigned int b = std::min(NUM_BINS - 1, (unsigned int)((primitive.centroid[axis] - centroidMin[axis]) * scale));
+			bins[b].min = glm::min(bins[b].min, primitive.min);
+			bins[b].max = glm::max(bins[b].max, primitive.max);
+			bins[b].count++;
+		}
+
+		// Sweep from both sides to get the cost of every split plane between two bins
+		float leftArea[NUM_BINS - 1];
+		int leftCount[NUM_BINS - 1];
+		glm::vec3 sweepMin(LARGE_EXTENT);
+		glm::vec3 sweepMax(-LARGE_EXTENT);
+		int sweepCount = 0;
+		for (unsigned int b = 0; b < NUM_BINS - 1; ++b)
+		{
+			sweepMin = glm::min(sweepMin, bins[b].min);
+			sweepMax = glm::max(sweepMax, bins[b].max);
+			sweepCount += bins[b].count;
+			leftArea[b] = sweepCount > 0 ? surfaceArea(sweepMin, sweepMax) : 0.f;
+			leftCount[b] = sweepCount;
+		}
+
+		sweepMin = glm::vec3(LARGE_EXTENT);
+		sweepMax = glm::vec3(-LARGE_EXTENT);
+		sweepCount = 0;
+		for (unsigned int b = NUM_BINS - 1; b > 0; --b)
+		{
+			sweepMin = glm::min(sweepMin, bins[b].min);
+			sweepMax = glm::max(sweepMax, bins[b].max);
+			sweepCount += bins[b].count;
+
+			if (sweepCount == 0 || leftCount[b - 1] == 0)
+			{
+				continue;
+			}
+
+			float cost = leftCount[b - 1] * leftArea[b - 1] + sweepCount * surfaceArea(sweepMin, sweepMax);
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = b;
+			}
+		}
+	}
+
+	if (bestAxis == -1)
+	{
+		return;
+	}
+
+	const Node& node = nodes[_nodeIndex];
+	float leafCost = count * surfaceArea(glm::vec3(node.min), glm::vec3(node.max));
+	if (bestCost >= leafCost && count <= (int)MAX_LEAF_SIZE)
+	{
+		return;
+	}
+
+	float scale = NUM_BINS / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+	unsigned int* splitPoint = std::partition(primitiveOrder.data() + first, primitiveOrder.data() + first + count,
+		[&](unsigned int _primitive)
+		{
+			float offset = _primitives[_primitive].centroid[bestAxis] - centroidMin[bestAxis];
+			return std::min(NUM_BINS - 1, (unsigned int)(offset * scale)) < bestSplit;
+		});
+
+	int leftCount = splitPoint - (primitiveOrder.data() + first);
+	if (leftCount == 0 || leftCount == count)
+	{
+		return;
+	}
+
+	unsigned int leftIndex = nodes.size();
+
+	Node child;
+	child.leftFirst = first;
+	child.count = leftCount;
+	nodes.push_back(child);
+
+	child.leftFirst = first + leftCount;
+	child.count = count - leftCount;
+	nodes.push_back(child);
+
+	nodes[_nodeIndex].leftFirst = leftIndex;
+	nodes[_nodeIndex].count = 0;
+
+	updateNodeBounds(leftIndex, _primitives);
+	updateNodeBounds(leftIndex + 1, _primitives);
+
+	subdivide(leftIndex, _depth + 1, _primitives);
+	subdivide(leftIndex + 1, _depth + 1, _primitives);
+}
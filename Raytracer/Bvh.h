@@ -0,0 +1,89 @@
+#pragma once
+
+#define __CL_ENABLE_EXCEPTIONS
+#define CL_GL_INTEROP
+#include "CL/cl.hpp"
+
+#include <glm/glm.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+class Bvh
+{
+public:
+	//this struct must match the layout of BvhNode in Types.hcl
+	struct Node
+	{
+		glm::vec4 min;
+		glm::vec4 max;
+		int32_t leftFirst;	// Index of the left child for inner nodes, the first triangle for leaves
+		int32_t count;		// Number of triangles in a leaf, 0 for inner nodes
+		int32_t padding[2];
+	};
+
+	// Must not be larger than BVH_STACK_SIZE in rayTracing.cl
+	static const unsigned int MAX_DEPTH = 32;
+
+private:
+	struct PrimitiveBounds
+	{
+		glm::vec3 min;
+		glm::vec3 max;
+		glm::vec3 centroid;
+	};
+
+	std::vector<Node> nodes;
+	std::vector<unsigned int> primitiveOrder;
+	std::vector<PrimitiveBounds> boundsPrimitives;	// Kept so rebuilding the top level every frame does not allocate
+	std::chrono::high_resolution_clock::duration buildTime;
+
+public:
+	Bvh();
+
+	// Builds the hierarchy over a triangle list, three positions per triangle
+	void build(const std::vector<glm::vec3>& _trianglePositions);
+	// Builds the hierarchy over arbitrary primitives, the leaves then index into the bounds through getPrimitiveOrder
+	void buildFromBounds(const std::vector<glm::vec3>& _mins, const std::vector<glm::vec3>& _maxs);
+	// Restores a hierarchy built earlier whose triangles are already sorted into leaf order
+	void setNodes(const Node* _nodes, size_t _count);
+
+	// Sorts a triangle list, three vertices per triangle, so that every leaf references a contiguous range
+	template <typename VertexT>
+	void reorderTriangles(std::vector<VertexT>& _vertices) const;
+
+	const std::vector<Node>& getNodes() const;
+	const std::vector<unsigned int>& getPrimitiveOrder() const;
+	std::chrono::high_resolution_clock::duration getBuildTime() const;
+
+	// Node indices grouped by depth with the deepest level first, so that a refit can process one level at a time.
+	// Level i covers [_levelOffsets[i], _levelOffsets[i + 1]) of _order.
+	void getRefitOrder(std::vector<int32_t>& _order, std::vector<unsigned int>& _levelOffsets) const;
+
+	// Surface area heuristic cost of a hierarchy relative to the area of its root
+	static float calculateCost(const std::vector<Node>& _nodes);
+	static void transformBounds(const glm::mat4& _transform, const glm::vec4& _min, const glm::vec4& _max, glm::vec3& _outMin, glm::vec3& _outMax);
+
+	cl::Buffer createBuffer(cl::Context& _context) const;
+
+private:
+	void buildFromPrimitives(const std::vector<PrimitiveBounds>& _primitives);
+	void subdivide(unsigned int _nodeIndex, unsigned int _depth, const std::vector<PrimitiveBounds>& _primitives);
+	void updateNodeBounds(unsigned int _nodeIndex, const std::vector<PrimitiveBounds>& _primitives);
+};
+
+template <typename VertexT>
+void Bvh::reorderTriangles(std::vector<VertexT>& _vertices) const
+{
+	std::vector<VertexT> reordered(_vertices.size());
+	for (size_t i = 0; i < primitiveOrder.size(); ++i)
+	{
+		for (size_t j = 0; j < 3; ++j)
+		{
+			reordered[i * 3 + j] = _vertices[primitiveOrder[i] * 3 + j];
+		}
+	}
+
+	_vertices.swap(reordered);
+}
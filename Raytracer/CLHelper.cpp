@@ -1,17 +1,24 @@
 #include "CLHelper.h"
 
+#include "Time.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
 #include <fstream>
 #include <iostream>
+#include <stdexcept>
 
 void initCL(cl::Context& _context, std::vector<cl::Device>& _devices, cl::CommandQueue& _queue)
 {
+#ifdef _WIN32
 	cl_int err = CL_SUCCESS;
 
 	std::vector<cl::Platform> platforms;
 	cl::Platform::get(&platforms);
 	if (platforms.size() == 0)
 	{
-		throw std::exception("No OpenCL platform found.");
+		throw std::runtime_error("No OpenCL platform found.");
 	}
 
 	HGLRC glCtx = wglGetCurrentContext();
@@ -29,7 +36,7 @@ void initCL(cl::Context& _context, std::vector<cl::Device>& _devices, cl::Comman
 		clGetGLContextInfoKHR = (clGetGLContextInfoKHR_fn) clGetExtensionFunctionAddress("clGetGLContextInfoKHR");
 		if (!clGetGLContextInfoKHR)
 		{
-			throw std::exception("Failed to query proc address for clGetGLContextInfoKHR.");
+			throw std::runtime_error("Failed to query proc address for clGetGLContextInfoKHR.");
 		}
 	}
 
@@ -42,26 +49,336 @@ void initCL(cl::Context& _context, std::vector<cl::Device>& _devices, cl::Comman
 	_context = cl::Context(_devices, properties);
 
 	_queue = cl::CommandQueue(_context, dev, CL_QUEUE_PROFILING_ENABLE, &err);
+#else
+	throw std::runtime_error("Sharing the OpenGL context with OpenCL is only implemented with WGL.");
+#endif
 }
 
-cl::Program createProgramFromFile(cl::Context& _context, std::vector<cl::Device>& _devices, const std::string& _filename)
+void initHeadlessCL(cl::Context& _context, std::vector<cl::Device>& _devices, cl::CommandQueue& _queue)
+{
+	cl_int err = CL_SUCCESS;
+
+	std::vector<cl::Platform> platforms;
+	cl::Platform::get(&platforms);
+	if (platforms.size() == 0)
+	{
+		throw std::runtime_error("No OpenCL platform found.");
+	}
+
+	cl::Platform platform;
+	cl::Device device;
+	bool foundGPU = false;
+	for (cl::Platform& p : platforms)
+	{
+		std::vector<cl::Device> platformDevices;
+		try
+		{
+			p.getDevices(CL_DEVICE_TYPE_ALL, &platformDevices);
+		}
+		catch (const cl::Error&)
+		{
+			continue;
+		}
+
+		for (cl::Device& d : platformDevices)
+		{
+			bool isGPU = (d.getInfo<CL_DEVICE_TYPE>() & CL_DEVICE_TYPE_GPU) != 0;
+			if (device() == nullptr || (isGPU && !foundGPU))
+			{
+				platform = p;
+				device = d;
+				foundGPU = isGPU;
+			}
+		}
+	}
+
+	if (device() == nullptr)
+	{
+		throw std::runtime_error("No OpenCL device found.");
+	}
+
+	cl_context_properties properties[] = {
+		CL_CONTEXT_PLATFORM, (cl_context_properties) platform(),
+		0
+	};
+
+	_devices.push_back(device);
+
+	_context = cl::Context(_devices, properties);
+
+	_queue = cl::CommandQueue(_context, device, CL_QUEUE_PROFILING_ENABLE, &err);
+}
+
+static bool readFile(const std::string& _filename, std::string& _contents)
 {
-	std::string kernelString;
 	std::ifstream in(_filename, std::ios::in | std::ios::binary);
-	if (in)
+	if (!in)
 	{
-		in.seekg(0, std::ios::end);
-		kernelString.resize((unsigned int) in.tellg());
-		in.seekg(0, std::ios::beg);
-		in.read(&kernelString[0], kernelString.size());
-		in.close();
+		return false;
 	}
-	else
+
+	in.seekg(0, std::ios::end);
+	_contents.resize((unsigned int) in.tellg());
+	in.seekg(0, std::ios::beg);
+	in.read(&_contents[0], _contents.size());
+	return true;
+}
+
+// FNV-1a
+static uint64_t hashBytes(const void* _data, size_t _size, uint64_t _hash = 14695981039346656037ull)
+{
+	const unsigned char* bytes = (const unsigned char*)_data;
+	for (size_t i = 0; i < _size; ++i)
+	{
+		_hash = (_hash ^ bytes[i]) * 1099511628211ull;
+	}
+	return _hash;
+}
+
+static uint64_t hashString(const std::string& _string, uint64_t _hash)
+{
+	// The size keeps the boundaries between strings in the hash
+	uint64_t size = _string.size();
+	_hash = hashBytes(&size, sizeof(size), _hash);
+	return hashBytes(_string.data(), _string.size(), _hash);
+}
+
+// Hashes the files included with #include "file" by _source, and the files they include, found relative to the
+// working directory like -I ./ does for the compiler
+static uint64_t hashIncludes(const std::string& _source, uint64_t _hash, std::vector<std::string>& _visited)
+{
+	size_t pos = 0;
+	while ((pos = _source.find("#include", pos)) != std::string::npos)
+	{
+		size_t begin = _source.find('"', pos);
+		size_t lineEnd = _source.find('\n', pos);
+		pos += 8;
+		if (begin == std::string::npos || begin > lineEnd)
+		{
+			continue;
+		}
+
+		size_t end = _source.find('"', begin + 1);
+		if (end == std::string::npos || end > lineEnd)
+		{
+			continue;
+		}
+
+		std::string include = _source.substr(begin + 1, end - begin - 1);
+		if (std::find(_visited.begin(), _visited.end(), include) != _visited.end())
+		{
+			continue;
+		}
+		_visited.push_back(include);
+
+		std::string contents;
+		if (!readFile(include, contents))
+		{
+			// Left to the compiler to report
+			contents.clear();
+		}
+		_hash = hashString(contents, hashString(include, _hash));
+		_hash = hashIncludes(contents, _hash, _visited);
+	}
+	return _hash;
+}
+
+static uint64_t hashDevices(const std::vector<cl::Device>& _devices, uint64_t _hash)
+{
+	for (const cl::Device& device : _devices)
+	{
+		_hash = hashString(device.getInfo<CL_DEVICE_NAME>(), _hash);
+		_hash = hashString(device.getInfo<CL_DEVICE_VENDOR>(), _hash);
+		_hash = hashString(device.getInfo<CL_DEVICE_VERSION>(), _hash);
+		_hash = hashString(device.getInfo<CL_DRIVER_VERSION>(), _hash);
+	}
+	return _hash;
+}
+
+static std::string toHex(uint64_t _value)
+{
+	static const char digits[] = "0123456789abcdef";
+	std::string hex(16, '0');
+	for (int i = 15; i >= 0; --i, _value >>= 4)
+	{
+		hex[i] = digits[_value & 0xF];
+	}
+	return hex;
+}
+
+struct ProgramCacheHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint64_t key;
+	uint32_t numBinaries;
+	uint32_t padding;
+};
+
+static const char PROGRAM_CACHE_MAGIC[4] = { 'R', 'T', 'P', 'B' };
+static const uint32_t PROGRAM_CACHE_VERSION = 1;
+
+// Returns the binaries of the cache file in the order of the devices, or nothing if the file is missing or was made for other sources
+static bool readProgramCache(const std::string& _path, uint64_t _key, size_t _numDevices, std::vector<std::string>& _binaries)
+{
+	std::string contents;
+	if (!readFile(_path, contents) || contents.size() < sizeof(ProgramCacheHeader))
+	{
+		return false;
+	}
+
+	ProgramCacheHeader header;
+	memcpy(&header, contents.data(), sizeof(header));
+	if (memcmp(header.magic, PROGRAM_CACHE_MAGIC, sizeof(header.magic)) != 0 || header.version != PROGRAM_CACHE_VERSION
+		|| header.key != _key || header.numBinaries != _numDevices)
+	{
+		return false;
+	}
+
+	size_t offset = sizeof(header) + sizeof(uint64_t) * header.numBinaries;
+	if (contents.size() < offset)
+	{
+		return false;
+	}
+
+	_binaries.resize(header.numBinaries);
+	for (uint32_t i = 0; i < header.numBinaries; ++i)
+	{
+		uint64_t size;
+		memcpy(&size, contents.data() + sizeof(header) + sizeof(uint64_t) * i, sizeof(size));
+		if (size == 0 || contents.size() - offset < size)
+		{
+			return false;
+		}
+
+		_binaries[i] = contents.substr(offset, (size_t)size);
+		offset += (size_t)size;
+	}
+
+	return offset == contents.size();
+}
+
+static void writeProgramCache(const std::string& _path, uint64_t _key, const cl::Program& _program, const std::vector<cl::Device>& _devices)
+{
+	std::vector<cl::Device> programDevices = _program.getInfo<CL_PROGRAM_DEVICES>();
+	std::vector< ::size_t> sizes = _program.getInfo<CL_PROGRAM_BINARY_SIZES>();
+
+	std::vector<std::vector<unsigned char>> binaries(sizes.size());
+	std::vector<unsigned char*> pointers(sizes.size());
+	for (size_t i = 0; i < sizes.size(); ++i)
+	{
+		binaries[i].resize(sizes[i]);
+		pointers[i] = binaries[i].data();
+	}
+	if (clGetProgramInfo(_program(), CL_PROGRAM_BINARIES, sizeof(unsigned char*) * pointers.size(), pointers.data(), nullptr) != CL_SUCCESS)
+	{
+		return;
+	}
+
+	// Stored in the order of _devices, which is the order they are loaded in
+	std::vector<const std::vector<unsigned char>*> ordered;
+	for (const cl::Device& device : _devices)
+	{
+		for (size_t i = 0; i < programDevices.size(); ++i)
+		{
+			if (programDevices[i]() == device() && !binaries[i].empty())
+			{
+				ordered.push_back(&binaries[i]);
+				break;
+			}
+		}
+	}
+	if (ordered.size() != _devices.size())
+	{
+		return;
+	}
+
+	ProgramCacheHeader header;
+	memcpy(header.magic, PROGRAM_CACHE_MAGIC, sizeof(header.magic));
+	header.version = PROGRAM_CACHE_VERSION;
+	header.key = _key;
+	header.numBinaries = ordered.size();
+	header.padding = 0;
+
+	std::ofstream out(_path, std::ios::out | std::ios::binary | std::ios::trunc);
+	out.write((const char*)&header, sizeof(header));
+	for (const std::vector<unsigned char>* binary : ordered)
+	{
+		uint64_t size = binary->size();
+		out.write((const char*)&size, sizeof(size));
+	}
+	for (const std::vector<unsigned char>* binary : ordered)
+	{
+		out.write((const char*)binary->data(), binary->size());
+	}
+}
+
+static void printBuildLogs(const cl::Program& _program, const std::vector<cl::Device>& _devices)
+{
+	for (size_t i = 0; i < _devices.size(); i++)
+	{
+		std::string log;
+		_program.getBuildInfo(_devices[i], CL_PROGRAM_BUILD_LOG, &log);
+		std::cout << "Build log[" << i << "]:" << std::endl << log << std::endl;
+	}
+}
+
+cl::Program createProgramFromFile(cl::Context& _context, std::vector<cl::Device>& _devices, const std::string& _filename,
+	const std::string& _options)
+{
+	std::chrono::high_resolution_clock::duration buildTime;
+	cl::Program program = buildProgramFromFile(_context, _devices, _filename, _options, buildTime);
+
+	Time::incTime("Program build " + _filename, buildTime);
+	return program;
+}
+
+cl::Program buildProgramFromFile(cl::Context& _context, std::vector<cl::Device>& _devices, const std::string& _filename,
+	const std::string& _options, std::chrono::high_resolution_clock::duration& _buildTime)
+{
+	auto buildStart = std::chrono::high_resolution_clock::now();
+
+	std::string kernelString;
+	if (!readFile(_filename, kernelString))
 	{
 		std::string errMsg("Error opening kernel file: ");
 		errMsg += strerror(errno);
 
-		throw std::exception(errMsg.c_str());
+		throw std::runtime_error(errMsg);
+	}
+
+	const std::string options = "-Werror -cl-fast-relaxed-math -cl-denorms-are-zero -I ./ " + _options;
+
+	// The name of the cache only depends on the options and devices, so every variant of a program has one file that
+	// is overwritten when the sources change
+	uint64_t variant = hashDevices(_devices, hashString(options, hashBytes(nullptr, 0)));
+	std::vector<std::string> visited;
+	uint64_t key = hashIncludes(kernelString, hashString(kernelString, variant), visited);
+	std::string cachePath = _filename + "." + toHex(variant) + ".bin";
+
+	std::vector<std::string> cachedBinaries;
+	if (readProgramCache(cachePath, key, _devices.size(), cachedBinaries))
+	{
+		cl::Program::Binaries binaries;
+		for (const std::string& binary : cachedBinaries)
+		{
+			binaries.push_back(std::make_pair(binary.data(), binary.size()));
+		}
+
+		// Drivers may still reject a binary, then the program is compiled from source as if there was no cache
+		try
+		{
+			std::vector<cl_int> binaryStatus(_devices.size());
+			cl::Program program(_context, _devices, binaries, &binaryStatus);
+			program.build(_devices, options.c_str());
+
+			_buildTime = std::chrono::high_resolution_clock::now() - buildStart;
+			return program;
+		}
+		catch (const cl::Error& e)
+		{
+			std::cout << "Rebuilding " << _filename << ", the cached binary was rejected: " << e.what() << " (" << e.err() << ")" << std::endl;
+		}
 	}
 
 	cl::Program::Sources source(1,
@@ -70,20 +387,17 @@ cl::Program createProgramFromFile(cl::Context& _context, std::vector<cl::Device>
 
 	try
 	{
-		program.build(_devices, "-Werror -cl-fast-relaxed-math -cl-denorms-are-zero -I ./");
+		program.build(_devices, options.c_str());
 	}
 	catch (const cl::Error&)
 	{
-		for (size_t i = 0; i < _devices.size(); i++)
-		{
-			std::string log;
-			program.getBuildInfo(_devices[i], CL_PROGRAM_BUILD_LOG, &log);
-			std::cout << "Build log[" << i << "]:" << std::endl << log << std::endl;
-		}
-
+		printBuildLogs(program, _devices);
 		throw;
 	}
 
+	writeProgramCache(cachePath, key, program, _devices);
+
+	_buildTime = std::chrono::high_resolution_clock::now() - buildStart;
 	return program;
 }
 
@@ -99,10 +413,14 @@ double toSeconds(cl_ulong _nanoSeconds)
 	return _nanoSeconds / 1000000000.0; // Nanoseconds to seconds
 }
 
-cl::Event runKernel(const cl::CommandQueue& queue, const cl::Kernel& kernel, const cl::NDRange& globalSize, const cl::NDRange& groupSize, std::vector<cl::Event>& events)
+cl::Event runKernel(const cl::CommandQueue& queue, const cl::Kernel& kernel, const cl::NDRange& globalSize, const cl::NDRange& groupSize)
 {
 	cl::Event event;
-	queue.enqueueNDRangeKernel(kernel, cl::NullRange, globalSize, groupSize, &events, &event);
-	events.push_back(event);
+	queue.enqueueNDRangeKernel(kernel, cl::NullRange, globalSize, groupSize, nullptr, &event);
 	return event;
 }
+
+unsigned int leastMultiple(unsigned int _val, unsigned int _mul)
+{
+	return ((_val + _mul - 1) / _mul) * _mul;
+}
@@ -4,8 +4,22 @@
 #define CL_GL_INTEROP
 #include "CL/cl.hpp"
 
+#include <chrono>
+
+// Creates a context that shares the current OpenGL context, only on Windows
 void initCL(cl::Context& _context, std::vector<cl::Device>& _devices, cl::CommandQueue& _queue);
-cl::Program createProgramFromFile(cl::Context& _context, std::vector<cl::Device>& _devices, const std::string& _filename);
+// Creates a context that does not share anything with OpenGL, so no window is needed. Uses the first GPU found, or the first device of any type.
+void initHeadlessCL(cl::Context& _context, std::vector<cl::Device>& _devices, cl::CommandQueue& _queue);
+// _options are added to the build options, such as -D defines
+cl::Program createProgramFromFile(cl::Context& _context, std::vector<cl::Device>& _devices, const std::string& _filename,
+	const std::string& _options = "");
+// Same as createProgramFromFile, but returns how long the build took instead of adding it to the timers, so it can run
+// on another thread
+cl::Program buildProgramFromFile(cl::Context& _context, std::vector<cl::Device>& _devices, const std::string& _filename,
+	const std::string& _options, std::chrono::high_resolution_clock::duration& _buildTime);
 cl_ulong getExecutionTime(const cl::Event& _event);
 double toSeconds(cl_ulong _nanoSeconds);
-cl::Event runKernel(const cl::CommandQueue& queue, const cl::Kernel& kernel, const cl::NDRange& globalSize, const cl::NDRange& groupSize, std::vector<cl::Event>& events);
+// The queues are in order, so the kernel runs after everything enqueued before it without a wait list
+cl::Event runKernel(const cl::CommandQueue& queue, const cl::Kernel& kernel, const cl::NDRange& globalSize, const cl::NDRange& groupSize);
+// Rounds _val up to a multiple of _mul, for global sizes that must be a multiple of the work group size
+unsigned int leastMultiple(unsigned int _val, unsigned int _mul);
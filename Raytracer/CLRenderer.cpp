@@ -0,0 +1,483 @@
+#include "CLRenderer.h"
+
+#include "CLHelper.h"
+#include "Settings.h"
+#include "SkinnedBvh.h"
+#include "Time.h"
+#include "Vertex.h"
+
+#include <chrono>
+#include <iostream>
+
+static std::string getVertexOptions()
+{
+	return Settings::packedVertices ? "-D PACKED_VERTICES" : "";
+}
+
+// The bounces are enqueued one by one from the host and the spheres are reached through the top level hierarchy,
+// so neither gains anything from being a constant. The reflectivity is a plain multiplier with nothing to fold, and as
+// a float that changes in steps it would only pile up variants.
+static std::string getRayDefines()
+{
+	if (!Settings::specializeKernels)
+		return "";
+
+	return "-D NUM_LIGHTS=" + std::to_string(Settings::numLights);
+}
+
+static std::string getImageDefines()
+{
+	if (!Settings::specializeKernels)
+		return "";
+
+	return "-D SUPER_SAMPLING=" + std::to_string(Settings::superSampling);
+}
+
+CLRenderer::CLRenderer(cl::Context _context, const std::vector<cl::Device>& _devices, cl::CommandQueue _queue, GLWindow* _window,
+		Model* _models, unsigned int _numModels, cl::Image2D _textureAtlas, cl::Buffer _atlasRects,
+		const std::vector<Sphere>& _spheres, unsigned int _maxLights)
+	: context(_context),
+	devices(_devices),
+	queue(_queue),
+	window(_window),
+	imageVariants(context, devices, "writeImage.cl", ""),
+	rayVariants(context, devices, "rayTracing.cl", getVertexOptions()),
+	imageProgram(imageVariants.getGenericProgram()),
+	rayProgram(rayVariants.getGenericProgram()),
+	kernelsPending(false),
+	transformProgram(createProgramFromFile(context, devices, "Transform.cl", getVertexOptions())),
+	compactionProgram(createProgramFromFile(context, devices, "Compaction.cl")),
+	transformSkeletalVerticesKernel(transformProgram, "transformSkeletalVertices"),
+	buildIntersectTrianglesKernel(transformProgram, "buildIntersectTriangles"),
+	refitBvhKernel(transformProgram, "refitBvh"),
+	rayQueue(compactionProgram),
+	scene(context, queue, transformProgram, _models, _numModels, _spheres.size(), Settings::packedVertices),
+	models(_models),
+	numModels(_numModels),
+	numSpheres(_spheres.size()),
+	numRays(0),
+	textureAtlas(_textureAtlas),
+	atlasRects(_atlasRects),
+	currentFrame(0),
+	presentedFrame(FRAMES_IN_FLIGHT - 1)
+{
+	for (Frame& frame : frames)
+	{
+		frame.inFlight = false;
+	}
+
+	// Every shaded triangle hit reads three vertices
+	size_t vertexSize = Settings::packedVertices ? sizeof(PackedVertex) : sizeof(Vertex);
+	std::cout << "Scene vertices: " << scene.getVertexBufferSize() / 1024.0 << " KiB, " << vertexSize * 3 << " bytes read per shaded hit"
+		<< (Settings::packedVertices ? " (packed)" : "") << std::endl;
+
+	spheresBuffer = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(Sphere) * numSpheres, const_cast<Sphere*>(_spheres.data()));
+	lightBuffer = cl::Buffer(context, CL_MEM_READ_ONLY, sizeof(Light) * _maxLights);
+
+	createImageKernel();
+	createRayKernels();
+	setSceneArgs();
+
+	Settings::updateSetting("Kernels", "Generic");
+
+	transformSkeletalVerticesKernel.setArg(1, scene.getVertexBuffer());
+	buildIntersectTrianglesKernel.setArg(0, scene.getVertexBuffer());
+	buildIntersectTrianglesKernel.setArg(1, scene.getIndexBuffer());
+	buildIntersectTrianglesKernel.setArg(2, scene.getIntersectBuffer());
+}
+
+CLRenderer::~CLRenderer()
+{
+	finishFrames();
+}
+
+void CLRenderer::resize(int _width, int _height)
+{
+	finishFrames();
+
+	for (unsigned int i = 0; i < FRAMES_IN_FLIGHT; ++i)
+	{
+		Frame& frame = frames[i];
+#ifndef HEADLESS_ONLY
+		if (window)
+		{
+			frame.renderbuffer = cl::BufferRenderGL(context, CL_MEM_READ_WRITE, window->getRenderbuffer(i));
+
+			frame.glObjects.clear();
+			frame.glObjects.push_back(frame.renderbuffer);
+		}
+		else
+#endif
+		{
+			frame.image = cl::Image2D(context, CL_MEM_WRITE_ONLY, cl::ImageFormat(CL_RGBA, CL_UNORM_INT8), _width, _height);
+			frame.pixels.assign(_width * _height * 4, 0);
+		}
+	}
+
+	numRays = _width * _height * Settings::superSampling * Settings::superSampling;
+	primaryRaysBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, numRays * RAY_STATE_SIZE);
+	accumulationBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, numRays * sizeof(cl_float4));
+
+	rayQueue.resize(context, numRays);
+
+	setFrameBufferArgs();
+}
+
+bool CLRenderer::isWarmingUp() const
+{
+	return kernelsPending;
+}
+
+void CLRenderer::updateKernelVariants()
+{
+	bool imageReady;
+	bool rayReady;
+	cl::Program image = imageVariants.getProgram(getImageDefines(), imageReady);
+	cl::Program ray = rayVariants.getProgram(getRayDefines(), rayReady);
+	kernelsPending = !imageReady || !rayReady;
+
+	if (image() == imageProgram() && ray() == rayProgram())
+		return;
+
+	if (image() != imageProgram())
+	{
+		imageProgram = image;
+		createImageKernel();
+	}
+	if (ray() != rayProgram())
+	{
+		rayProgram = ray;
+		createRayKernels();
+	}
+
+	setSceneArgs();
+	if (numRays > 0)
+	{
+		setFrameBufferArgs();
+	}
+
+	bool specialized = imageProgram() != imageVariants.getGenericProgram()() || rayProgram() != rayVariants.getGenericProgram()();
+	static const Settings::Handle kernelsSetting = Settings::getSetting("Kernels");
+	Settings::updateSetting(kernelsSetting, specialized ? "Specialized" : "Generic");
+}
+
+void CLRenderer::createImageKernel()
+{
+	dumpImageKernel = cl::Kernel(imageProgram, "dumpImage");
+}
+
+void CLRenderer::createRayKernels()
+{
+	primaryRaysKernel = cl::Kernel(rayProgram, "primaryRays");
+	findClosestHitsKernel = cl::Kernel(rayProgram, "findClosestHits");
+	shadeHitsKernel = cl::Kernel(rayProgram, "shadeHits");
+	findOccludedLightsKernel = cl::Kernel(rayProgram, "findOccludedLights");
+	shadeLightsKernel = cl::Kernel(rayProgram, "shadeLights");
+	moveRaysToIntersectionKernel = cl::Kernel(rayProgram, "moveRaysToIntersection");
+}
+
+void CLRenderer::setSceneArgs()
+{
+	findOccludedLightsKernel.setArg(12, lightBuffer);
+	shadeLightsKernel.setArg(4, lightBuffer);
+
+	cl::Kernel* sceneKernels[] = { &findClosestHitsKernel, &findOccludedLightsKernel };
+	for (cl::Kernel* kernel : sceneKernels)
+	{
+		kernel->setArg(4, spheresBuffer);
+		kernel->setArg(5, numSpheres);
+		kernel->setArg(6, scene.getTlasBuffer());
+		kernel->setArg(7, scene.getTlasItemBuffer());
+		kernel->setArg(8, scene.getInstanceBuffer());
+		kernel->setArg(9, scene.getNumInstances());
+		kernel->setArg(10, scene.getBlasBuffer());
+		kernel->setArg(11, scene.getIntersectBuffer());
+	}
+
+	// The textures of every model are reached through the atlas, with the indices in the shading of the instances
+	shadeHitsKernel.setArg(4, spheresBuffer);
+	shadeHitsKernel.setArg(5, scene.getInstanceBuffer());
+	shadeHitsKernel.setArg(6, scene.getShadingBuffer());
+	shadeHitsKernel.setArg(7, scene.getVertexBuffer());
+	shadeHitsKernel.setArg(8, scene.getIndexBuffer());
+	shadeHitsKernel.setArg(10, textureAtlas);
+	shadeHitsKernel.setArg(11, atlasRects);
+}
+
+void CLRenderer::setFrameBufferArgs()
+{
+	primaryRaysKernel.setArg(0, primaryRaysBuffer);
+	primaryRaysKernel.setArg(1, numRays);
+	primaryRaysKernel.setArg(4, Settings::windowWidth * Settings::superSampling);
+	primaryRaysKernel.setArg(5, Settings::windowHeight * Settings::superSampling);
+	primaryRaysKernel.setArg(6, accumulationBuffer);
+
+	cl::Kernel* rayKernels[] = { &findClosestHitsKernel, &shadeHitsKernel, &findOccludedLightsKernel, &shadeLightsKernel, &moveRaysToIntersectionKernel };
+	for (cl::Kernel* kernel : rayKernels)
+	{
+		kernel->setArg(0, primaryRaysBuffer);
+		kernel->setArg(1, numRays);
+	}
+
+	dumpImageKernel.setArg(0, accumulationBuffer);
+
+	shadeLightsKernel.setArg(6, accumulationBuffer);
+}
+
+void CLRenderer::render(const FrameState& _frame)
+{
+	updateKernelVariants();
+
+	// The frame that used these resources last is normally done already, see the end of this function
+	Frame& frame = frames[currentFrame];
+	if (frame.inFlight)
+	{
+		finishFrame(currentFrame);
+	}
+
+	cl::NDRange global2D(leastMultiple(Settings::windowWidth, Settings::local2D[0]), leastMultiple(Settings::windowHeight, Settings::local2D[1]));
+
+	frame.lights = *_frame.lights;
+	frame.spheres.assign(_frame.spheres->begin(), _frame.spheres->begin() + Settings::numLights);
+	queue.enqueueWriteBuffer(lightBuffer, false, 0, sizeof(Light) * frame.lights.size(), frame.lights.data(), nullptr, &frame.writeLightsEvent);
+	queue.enqueueWriteBuffer(spheresBuffer, false, 0, sizeof(Sphere) * frame.spheres.size(), frame.spheres.data(), nullptr, &frame.writeSpheresEvent);
+
+#ifndef HEADLESS_ONLY
+	// OpenGL has to be done with the renderbuffer before it is acquired, it was last drawn a frame ago
+	if (window)
+	{
+		glFinish();
+	}
+#endif
+
+	frame.enqueueStart = std::chrono::high_resolution_clock::now();
+
+	primaryRaysKernel.setArg(2, glm::transpose(_frame.invViewProjection));
+	primaryRaysKernel.setArg(3, glm::vec4(_frame.cameraPosition, 1.f));
+
+	rayQueue.reset(queue);
+	primaryRaysKernel.setArg(7, rayQueue.getQueueBuffer());
+
+	frame.intersectEvents.clear();
+	frame.compactEvents.clear();
+	frame.shadeEvents.clear();
+	frame.shadowEvents.clear();
+	frame.lightEvents.clear();
+	frame.moveRaysEvents.clear();
+	frame.transformModelEvents.clear();
+	frame.refitEvents.clear();
+
+	cl::NDRange superSampledGlobal2D(global2D[0] * Settings::superSampling, global2D[1] * Settings::superSampling);
+	frame.primEvent = runKernel(queue, primaryRaysKernel, superSampledGlobal2D, Settings::local2D);
+
+	for (unsigned int k = 0; k < numModels; k++)
+	{
+		const ModelInstance& model = _frame.instances[k];
+
+		if (Settings::showModels[k] && model.model->data->isAnimated())
+		{
+			cl::Buffer boneTransforms = model.skeleton.getTransformBuffer(queue);
+
+			SkinnedBvh& skinnedBvh = *model.model->data->getSkinnedBvh();
+			if (skinnedBvh.rebuildIfDegraded(queue, model.skeleton, scene.getIndexBuffer(), model.model->triangleOffset * 3,
+				scene.getBlasBuffer(), model.model->nodeOffset))
+			{
+				static const Time::Handle bvhRebuildTimer = Time::getTimer("BVH rebuild");
+				Time::incTime(bvhRebuildTimer, skinnedBvh.getBvh().getBuildTime());
+			}
+
+			// Every shared vertex is skinned once, then the compact triangles are gathered from the skinned vertices
+			int vertexCount = model.model->data->getVertexCount();
+			transformSkeletalVerticesKernel.setArg(0, model.model->data->getVertexBuffer());
+			transformSkeletalVerticesKernel.setArg(2, boneTransforms);
+			transformSkeletalVerticesKernel.setArg(3, vertexCount);
+			transformSkeletalVerticesKernel.setArg(4, model.model->vertexOffset);
+			frame.transformModelEvents.push_back(runKernel(queue, transformSkeletalVerticesKernel, cl::NDRange(leastMultiple(vertexCount, Settings::linearLocalSize[0])), Settings::linearLocalSize));
+
+			int triangleCount = model.model->data->getTriangleCount();
+			buildIntersectTrianglesKernel.setArg(3, triangleCount);
+			buildIntersectTrianglesKernel.setArg(4, model.model->triangleOffset);
+			buildIntersectTrianglesKernel.setArg(5, model.model->vertexOffset);
+			frame.transformModelEvents.push_back(runKernel(queue, buildIntersectTrianglesKernel, cl::NDRange(leastMultiple(triangleCount, Settings::linearLocalSize[0])), Settings::linearLocalSize));
+
+			skinnedBvh.refit(queue, refitBvhKernel, scene.getBlasBuffer(), model.model->nodeOffset,
+				scene.getIntersectBuffer(), model.model->triangleOffset, Settings::linearLocalSize, frame.refitEvents);
+
+			glm::vec4 boundsMin;
+			glm::vec4 boundsMax;
+			skinnedBvh.calculateBounds(model.skeleton, boundsMin, boundsMax);
+			model.model->data->setBounds(boundsMin, boundsMax);
+		}
+	}
+
+	scene.updateTopLevel(queue, _frame.instances, Settings::showModels, _frame.spheres->data(), numSpheres);
+	static const Time::Handle tlasBuildTimer = Time::getTimer("TLAS build");
+	Time::incTime(tlasBuildTimer, scene.getTopLevel().getBuildTime());
+
+	// Everything so far can run behind the last frame. From the second bounce on the host waits for the length of the
+	// queue, by then the last frame is done.
+	queue.flush();
+
+	for (unsigned int j = 0; j < Settings::numBounces; j++)
+	{
+		// Waits for the length of the queue from the previous bounce, the GPU still has the rest of that bounce to work on
+		cl::NDRange rayGlobalSize = rayQueue.getGlobalSize(Settings::linearLocalSize);
+		if (rayQueue.getQueuedRays() == 0)
+		{
+			break;
+		}
+
+		rayQueue.setKernelArgs(findClosestHitsKernel, 2);
+		frame.intersectEvents.push_back(runKernel(queue, findClosestHitsKernel, rayGlobalSize, Settings::linearLocalSize));
+
+		// The rest of the bounce only runs over the rays that hit something, rayGlobalSize stays a valid upper bound
+		rayQueue.compact(queue, primaryRaysBuffer, Settings::linearLocalSize, frame.compactEvents);
+
+		cl::Kernel* queuedKernels[] = { &shadeHitsKernel, &moveRaysToIntersectionKernel, &findOccludedLightsKernel, &shadeLightsKernel };
+		for (cl::Kernel* kernel : queuedKernels)
+		{
+			rayQueue.setKernelArgs(*kernel, 2);
+		}
+
+		shadeHitsKernel.setArg(9, Settings::cubeReflect);
+		frame.shadeEvents.push_back(runKernel(queue, shadeHitsKernel, rayGlobalSize, Settings::linearLocalSize));
+		frame.moveRaysEvents.push_back(runKernel(queue, moveRaysToIntersectionKernel, rayGlobalSize, Settings::linearLocalSize));
+
+		findOccludedLightsKernel.setArg(13, Settings::numLights);
+		frame.shadowEvents.push_back(runKernel(queue, findOccludedLightsKernel, rayGlobalSize, Settings::linearLocalSize));
+		shadeLightsKernel.setArg(5, Settings::numLights);
+		frame.lightEvents.push_back(runKernel(queue, shadeLightsKernel, rayGlobalSize, Settings::linearLocalSize));
+	}
+
+	if (window)
+	{
+		queue.enqueueAcquireGLObjects(&frame.glObjects, nullptr, &frame.aqEvent);
+
+		dumpImageKernel.setArg(1, frame.renderbuffer);
+	}
+	else
+	{
+		dumpImageKernel.setArg(1, frame.image);
+	}
+
+	dumpImageKernel.setArg(2, Settings::superSampling);
+	frame.dumpEvent = runKernel(queue, dumpImageKernel, global2D, Settings::local2D);
+
+	if (window)
+	{
+		queue.enqueueReleaseGLObjects(&frame.glObjects, nullptr, &frame.relEvent);
+	}
+	else
+	{
+		cl::size_t<3> origin;
+		origin[0] = 0;
+		origin[1] = 0;
+		origin[2] = 0;
+		cl::size_t<3> region;
+		region[0] = Settings::windowWidth;
+		region[1] = Settings::windowHeight;
+		region[2] = 1;
+		queue.enqueueReadImage(frame.image, false, origin, region, 0, 0, frame.pixels.data(), nullptr, &frame.readFrameEvent);
+	}
+
+	queue.flush();
+	frame.inFlight = true;
+
+	static const Time::Handle enqueueTimer = Time::getTimer("OpenCL enqueue work");
+	Time::incTime(enqueueTimer, std::chrono::high_resolution_clock::now() - frame.enqueueStart);
+
+	// Keeps FRAMES_IN_FLIGHT - 1 frames on the GPU while the main loop prepares the next one
+	currentFrame = (currentFrame + 1) % FRAMES_IN_FLIGHT;
+	if (frames[currentFrame].inFlight)
+	{
+		finishFrame(currentFrame);
+	}
+}
+
+void CLRenderer::finishFrames()
+{
+	// Oldest first, so the newest frame ends up presented
+	for (unsigned int i = 0; i < FRAMES_IN_FLIGHT; ++i)
+	{
+		unsigned int index = (currentFrame + i) % FRAMES_IN_FLIGHT;
+		if (frames[index].inFlight)
+		{
+			finishFrame(index);
+		}
+	}
+}
+
+void CLRenderer::finishFrame(unsigned int _index)
+{
+	Frame& frame = frames[_index];
+
+	if (window)
+	{
+		frame.relEvent.wait();
+	}
+	else
+	{
+		frame.readFrameEvent.wait();
+	}
+	frame.inFlight = false;
+
+	auto finishCL = std::chrono::high_resolution_clock::now();
+
+	if (window)
+	{
+		static const Time::Handle aquireObjectsTimer = Time::getTimer("Aquire objects");
+		static const Time::Handle releaseObjectsTimer = Time::getTimer("Release objects");
+		Time::incTime(aquireObjectsTimer, frame.aqEvent);
+		Time::incTime(releaseObjectsTimer, frame.relEvent);
+	}
+	else
+	{
+		static const Time::Handle readBackFrameTimer = Time::getTimer("Read back frame");
+		Time::incTime(readBackFrameTimer, frame.readFrameEvent);
+	}
+
+	// Registered on the first frame in the order they are logged in
+	static const Time::Handle writeLightsTimer = Time::getTimer("Write lights");
+	static const Time::Handle writeSpheresTimer = Time::getTimer("Write spheres");
+	static const Time::Handle primaryRaysTimer = Time::getTimer("Primary rays");
+	static const Time::Handle skinningTimer = Time::getTimer("Skinning");
+	static const Time::Handle bvhRefitTimer = Time::getTimer("BVH refit");
+	static const Time::Handle intersectionTimer = Time::getTimer("Intersection");
+	static const Time::Handle compactionTimer = Time::getTimer("Compaction");
+	static const Time::Handle shadingTimer = Time::getTimer("Shading");
+	static const Time::Handle moveRaysTimer = Time::getTimer("Move rays");
+	static const Time::Handle shadowsTimer = Time::getTimer("Shadows");
+	static const Time::Handle lightingTimer = Time::getTimer("Lighting");
+	static const Time::Handle dumpImageTimer = Time::getTimer("Dump image");
+	static const Time::Handle totalTimer = Time::getTimer("Total OpenCL");
+
+	Time::incTime(writeLightsTimer, frame.writeLightsEvent);
+	Time::incTime(writeSpheresTimer, frame.writeSpheresEvent);
+	Time::incTime(primaryRaysTimer, frame.primEvent);
+	Time::incTime(skinningTimer, frame.transformModelEvents);
+	Time::incTime(bvhRefitTimer, frame.refitEvents);
+	Time::incTime(intersectionTimer, frame.intersectEvents);
+	Time::incTime(compactionTimer, frame.compactEvents);
+	Time::incTime(shadingTimer, frame.shadeEvents);
+	Time::incTime(moveRaysTimer, frame.moveRaysEvents);
+	Time::incTime(shadowsTimer, frame.shadowEvents);
+	Time::incTime(lightingTimer, frame.lightEvents);
+	Time::incTime(dumpImageTimer, frame.dumpEvent);
+
+	// From the start of the enqueueing until the frame was seen to be done, which includes the time spent behind the
+	// frame before it
+	Time::incTime(totalTimer, finishCL - frame.enqueueStart);
+
+	presentedFrame = _index;
+#ifndef HEADLESS_ONLY
+	if (window)
+	{
+		window->setCurrentFramebuffer(_index);
+	}
+#endif
+}
+
+const std::vector<unsigned char>& CLRenderer::getFramePixels() const
+{
+	return frames[presentedFrame].pixels;
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#define __CL_ENABLE_EXCEPTIONS
+#define CL_GL_INTEROP
+#include "CL/cl.hpp"
+
+#include "GLWindow.h"
+#include "KernelVariants.h"
+#include "Model.h"
+#include "RayQueue.h"
+#include "Renderer.h"
+#include "Scene.h"
+#include "Sphere.h"
+
+#include <chrono>
+#include <vector>
+
+// Traces the rays with the OpenCL kernels. With a window the frame is written straight into its framebuffer
+// through OpenGL interop, otherwise it is read back into host memory. render returns once the frame is enqueued and
+// the one before it is done, so the main loop prepares the next frame while the GPU works on this one. With
+// Settings::specializeKernels the ray and image kernels are swapped for builds with the number of lights and the
+// supersampling as constants once those are ready.
+class CLRenderer : public Renderer
+{
+public:
+	// The window needs a framebuffer for each
+	static const unsigned int FRAMES_IN_FLIGHT = 2;
+
+private:
+	// What a frame keeps until it is done. The ray and accumulation buffers are shared, the in-order queue already
+	// runs every kernel of a frame after those of the frame before.
+	struct Frame
+	{
+		bool inFlight;
+		std::chrono::high_resolution_clock::time_point enqueueStart;
+
+		// The uploads read from these after render has returned
+		std::vector<Light> lights;
+		std::vector<Sphere> spheres;
+
+		cl::BufferRenderGL renderbuffer;
+		std::vector<cl::Memory> glObjects;
+		cl::Image2D image;
+		std::vector<unsigned char> pixels;
+
+		cl::Event writeLightsEvent;
+		cl::Event writeSpheresEvent;
+		cl::Event primEvent;
+		cl::Event aqEvent;
+		cl::Event relEvent;
+		cl::Event readFrameEvent;
+		cl::Event dumpEvent;
+		std::vector<cl::Event> intersectEvents;
+		std::vector<cl::Event> compactEvents;
+		std::vector<cl::Event> shadeEvents;
+		std::vector<cl::Event> shadowEvents;
+		std::vector<cl::Event> lightEvents;
+		std::vector<cl::Event> moveRaysEvents;
+		std::vector<cl::Event> transformModelEvents;
+		std::vector<cl::Event> refitEvents;
+	};
+
+	cl::Context context;
+	std::vector<cl::Device> devices;
+	cl::CommandQueue queue;
+	GLWindow* window;
+
+	KernelVariants imageVariants;
+	KernelVariants rayVariants;
+	cl::Program imageProgram;	// The variants the kernels were created from
+	cl::Program rayProgram;
+	bool kernelsPending;
+	cl::Program transformProgram;
+	cl::Program compactionProgram;
+
+	cl::Kernel dumpImageKernel;
+	cl::Kernel primaryRaysKernel;
+	cl::Kernel findClosestHitsKernel;
+	cl::Kernel shadeHitsKernel;
+	cl::Kernel findOccludedLightsKernel;
+	cl::Kernel shadeLightsKernel;
+	cl::Kernel moveRaysToIntersectionKernel;
+	cl::Kernel transformSkeletalVerticesKernel;
+	cl::Kernel buildIntersectTrianglesKernel;
+	cl::Kernel refitBvhKernel;
+
+	RayQueue rayQueue;
+	Scene scene;
+
+	Model* models;
+	unsigned int numModels;
+	unsigned int numSpheres;
+
+	int numRays;
+	cl::Buffer primaryRaysBuffer;
+	cl::Buffer accumulationBuffer;
+	cl::Buffer spheresBuffer;
+	cl::Buffer lightBuffer;
+	cl::Image2D textureAtlas;
+	cl::Buffer atlasRects;
+
+	Frame frames[FRAMES_IN_FLIGHT];
+	unsigned int currentFrame;	// Where the next frame goes, the oldest one in flight
+	unsigned int presentedFrame;	// The newest frame that is done
+
+public:
+	// _window may be null, the context must then be one created by initHeadlessCL. The texture maps of the models
+	// index _textureAtlas, see TextureManager::buildAtlas.
+	CLRenderer(cl::Context _context, const std::vector<cl::Device>& _devices, cl::CommandQueue _queue, GLWindow* _window,
+		Model* _models, unsigned int _numModels, cl::Image2D _textureAtlas, cl::Buffer _atlasRects,
+		const std::vector<Sphere>& _spheres, unsigned int _maxLights);
+	~CLRenderer();
+
+	void resize(int _width, int _height) override;
+	void render(const FrameState& _frame) override;
+	const std::vector<unsigned char>& getFramePixels() const override;
+	bool isWarmingUp() const override;
+	void finishFrames() override;
+
+private:
+	// Switches to the variants of the current settings once they are built, and recreates the kernels from them
+	void updateKernelVariants();
+	void createImageKernel();
+	void createRayKernels();
+	// Binds the buffers that only change with the kernels
+	void setSceneArgs();
+	// Binds the buffers that change with the size of the frame
+	void setFrameBufferArgs();
+	// Waits for the frame, adds its timings to the timers and shows it
+	void finishFrame(unsigned int _index);
+};
@@ -0,0 +1,85 @@
+#include "Types.hcl"
+
+// Compacts the queue of live rays in three passes: an exclusive scan of the live flags within each work group,
+// a scan of the work group totals, and a scatter of the live ray indices into the next queue.
+
+// Inclusive Hillis-Steele scan over the work group, works for any work group size
+int scanWorkGroup(int _value, __local int* _temp)
+{
+	int lid = get_local_id(0);
+	int size = get_local_size(0);
+
+	_temp[lid] = _value;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int offset = 1; offset < size; offset *= 2)
+	{
+		int add = lid >= offset ? _temp[lid - offset] : 0;
+		barrier(CLK_LOCAL_MEM_FENCE);
+		_temp[lid] += add;
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	return _temp[lid];
+}
+
+__kernel void scanLiveRays(__global float4* _rayData, int _rayCapacity, __global const int* _rayQueue, __global const int* _queueCount,
+	__global int* _scanned, __global int* _groupSums, __local int* _temp)
+{
+	int qid = get_global_id(0);
+
+	int live = 0;
+	if (qid < *_queueCount)
+	{
+		live = getRays(_rayData, _rayCapacity).distance[_rayQueue[qid]] != INFINITY;
+	}
+
+	int sum = scanWorkGroup(live, _temp);
+	_scanned[qid] = sum - live;
+
+	if (get_local_id(0) == get_local_size(0) - 1)
+	{
+		_groupSums[get_group_id(0)] = sum;
+	}
+}
+
+// Runs as a single work group, turns the group totals into the offsets of each group in the next queue
+__kernel void scanGroupSums(__global int* _groupSums, int _numGroups, __global int* _nextCount, __local int* _temp)
+{
+	int lid = get_local_id(0);
+	int size = get_local_size(0);
+
+	int carry = 0;
+	for (int first = 0; first < _numGroups; first += size)
+	{
+		int value = first + lid < _numGroups ? _groupSums[first + lid] : 0;
+		int sum = scanWorkGroup(value, _temp);
+
+		if (first + lid < _numGroups)
+		{
+			_groupSums[first + lid] = carry + sum - value;
+		}
+
+		carry += _temp[size - 1];
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	if (lid == 0)
+	{
+		*_nextCount = carry;
+	}
+}
+
+__kernel void scatterLiveRays(__global float4* _rayData, int _rayCapacity, __global const int* _rayQueue, __global const int* _queueCount,
+	__global const int* _scanned, __global const int* _groupSums, __global int* _nextQueue)
+{
+	int qid = get_global_id(0);
+	if (qid >= *_queueCount)
+		return;
+
+	int id = _rayQueue[qid];
+	if (getRays(_rayData, _rayCapacity).distance[id] == INFINITY)
+		return;
+
+	_nextQueue[_groupSums[get_group_id(0)] + _scanned[qid]] = id;
+}
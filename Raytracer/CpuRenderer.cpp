@@ -0,0 +1,1524 @@
+#include "CpuRenderer.h"
+
+#include "Settings.h"
+#include "SkinnedBvh.h"
+#include "Time.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+// Group of the spheres, instances use their index + 1, the same as in rayTracing.cl
+static const int SPHERE_GROUP = 0;
+
+static const unsigned int VERTICES_PER_SKINNING_TASK = 1024;
+static const unsigned int TRIANGLES_PER_SKINNING_TASK = 1024;
+
+static bool findSphereIntersectDistance(const glm::vec3& _position, const glm::vec3& _direction, float _distance, const Sphere& _sphere, float& _t)
+{
+	glm::vec3 rDistance = glm::vec3(_sphere.position) - _position;
+	float rayDist = glm::dot(rDistance, _direction);
+
+	float rDist2 = glm::dot(rDistance, rDistance);
+	float radius2 = _sphere.radius * _sphere.radius;
+
+	if (rayDist < 0.f && rDist2 > radius2)
+	{
+		return false;
+	}
+
+	float centerDistance2 = rDist2 - rayDist * rayDist;
+	if (centerDistance2 > radius2)
+	{
+		return false;
+	}
+
+	float rayDistInSphere = std::sqrt(radius2 - centerDistance2);
+
+	_t = rayDist + ((rDist2 > radius2) ? -rayDistInSphere : rayDistInSphere);
+
+	return _t <= _distance;
+}
+
+static glm::vec3 safeInverse(const glm::vec3& _direction)
+{
+	glm::vec3 inverse;
+	for (int i = 0; i < 3; ++i)
+	{
+		float magnitude = std::max(std::abs(_direction[i]), 1e-8f);
+		inverse[i] = 1.f / (_direction[i] < 0.f ? -magnitude : magnitude);
+	}
+	return inverse;
+}
+
+static bool findBoxIntersectDistance(const glm::vec3& _position, const glm::vec3& _invDirection, float _distance, const Bvh::Node& _node, float& _t)
+{
+	glm::vec3 t0 = (glm::vec3(_node.min) - _position) * _invDirection;
+	glm::vec3 t1 = (glm::vec3(_node.max) - _position) * _invDirection;
+	glm::vec3 tNear = glm::min(t0, t1);
+	glm::vec3 tFar = glm::max(t0, t1);
+
+	float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.f));
+	float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, _distance));
+
+	_t = enter;
+	return enter <= exit;
+}
+
+// Where the first of the rays in _mask enters a box, used to pick which child a packet visits first
+static float findFirstEnter(Simd::Float4 _enter, int _mask)
+{
+	float enter[PACKET_SIZE];
+	Simd::store(enter, _enter);
+
+	float first = std::numeric_limits<float>::infinity();
+	for (int lane = 0; lane < PACKET_SIZE; ++lane)
+	{
+		if (_mask & (1 << lane))
+		{
+			first = std::min(first, enter[lane]);
+		}
+	}
+	return first;
+}
+
+static float logBase2(float _value)
+{
+	return std::log(_value) * 1.44269504f;
+}
+
+// Same as getTextureLodBase in rayTracing.cl
+static float getTextureLodBase(const glm::vec3& _e1, const glm::vec3& _e2, const glm::vec2& _t0, const glm::vec2& _t1, const glm::vec2& _t2,
+	const glm::vec3& _direction, float _coneWidth)
+{
+	glm::vec3 normal = glm::cross(_e1, _e2);
+	float worldArea = std::max(glm::length(normal), 1e-20f);
+	glm::vec2 uv1 = _t1 - _t0;
+	glm::vec2 uv2 = _t2 - _t0;
+	float texelArea = std::max(std::abs(uv1.x * uv2.y - uv2.x * uv1.y), 1e-20f);
+
+	float cosine = std::max(std::abs(glm::dot(normal, _direction)) / worldArea, 1e-4f);
+	return 0.5f * logBase2(texelArea / worldArea) + logBase2(std::max(_coneWidth, 1e-20f)) - logBase2(cosine);
+}
+
+static glm::vec3 calculateLight(const glm::vec3& _position, const glm::vec3& _normal, const glm::vec3& _reflectDir, const glm::vec3& _reflectivity,
+	float _shininess, const Light& _light)
+{
+	glm::vec3 relativePos = glm::vec3(_light.position) - _position;
+	glm::vec3 lightDir = glm::normalize(relativePos);
+	float distanceSq = glm::dot(relativePos, relativePos);
+	glm::vec3 lightIntensity(_light.intensity);
+
+	float NdotL = glm::dot(_normal, lightDir);
+	float intensity = glm::clamp(NdotL, 0.f, 1.f);
+
+	glm::vec3 diffuseLight = intensity * lightIntensity / distanceSq;
+
+	glm::vec3 halfway = glm::normalize(lightDir - (_reflectDir - 2.f * glm::dot(_reflectDir, _normal) * _normal));
+
+	float NdotH = glm::dot(_normal, halfway);
+	intensity = std::pow(glm::clamp(NdotH, 0.f, 1.f), _shininess);
+
+	glm::vec3 specularLight = intensity * lightIntensity / distanceSq;
+
+	return _reflectivity * (diffuseLight + specularLight);
+}
+
+CpuRenderer::CpuRenderer(GLWindow* _window, const Model* _models, unsigned int _numModels, unsigned int _numThreads)
+	: window(_window),
+	pool(_numThreads),
+	models(_models),
+	numModels(_numModels),
+	geometry(_numModels),
+	instances(_numModels),
+	spheres(nullptr),
+	lights(nullptr),
+	width(0),
+	height(0)
+{
+	for (unsigned int i = 0; i < numModels; ++i)
+	{
+		const ModelData& data = *models[i].data;
+		Geometry& model = geometry[i];
+
+		if (data.isAnimated())
+		{
+			const SkinnedBvh& skinnedBvh = *data.getSkinnedBvh();
+			model.skinnedVertices.resize(skinnedBvh.getVertices().size());
+			model.vertices = &model.skinnedVertices;
+			model.indices = &skinnedBvh.getIndices();
+			model.nodes = skinnedBvh.getBvh().getNodes();
+			createTrianglePacks(model, model.indices->size() / 3);
+			continue;
+		}
+
+		model.vertices = &data.getVertices();
+		model.indices = &data.getIndices();
+		model.nodes = data.getBvh().getNodes();
+
+		const std::vector<Vertex>& vertices = *model.vertices;
+		const std::vector<uint32_t>& indices = *model.indices;
+		unsigned int numTriangles = indices.size() / 3;
+		createTrianglePacks(model, numTriangles);
+		for (unsigned int t = 0; t < numTriangles; ++t)
+		{
+			setPackTriangle(model, t, vertices[indices[t * 3]].position, vertices[indices[t * 3 + 1]].position, vertices[indices[t * 3 + 2]].position);
+		}
+		std::vector<int32_t>().swap(model.trianglePacks);
+	}
+
+	std::cout << "CPU renderer using " << pool.getNumThreads() << " threads" << std::endl;
+}
+
+void CpuRenderer::resize(int _width, int _height)
+{
+	width = _width;
+	height = _height;
+	framePixels.resize(width * height * 4);
+}
+
+void CpuRenderer::render(const FrameState& _frame)
+{
+	spheres = _frame.spheres;
+	lights = _frame.lights;
+
+	auto skinStart = std::chrono::high_resolution_clock::now();
+	for (unsigned int k = 0; k < numModels; ++k)
+	{
+		const ModelInstance& instance = _frame.instances[k];
+		if (Settings::showModels[k] && instance.model->data->isAnimated())
+		{
+			skinModel(instance, geometry[instance.model - models]);
+		}
+	}
+	auto skinEnd = std::chrono::high_resolution_clock::now();
+
+	updateTopLevel(_frame.instances);
+
+	auto traceStart = std::chrono::high_resolution_clock::now();
+	unsigned int tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+	unsigned int tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+	pool.run(tilesX * tilesY, [&](unsigned int _tile)
+	{
+		renderTile(_tile, _frame.invViewProjection, _frame.cameraPosition);
+	});
+	auto traceEnd = std::chrono::high_resolution_clock::now();
+
+#ifndef HEADLESS_ONLY
+	if (window)
+	{
+		window->writeFramebuffer(framePixels.data());
+	}
+#endif
+	auto writeEnd = std::chrono::high_resolution_clock::now();
+
+	static const Time::Handle skinningTimer = Time::getTimer("Skinning and refit");
+	static const Time::Handle tlasBuildTimer = Time::getTimer("TLAS build");
+	static const Time::Handle tracingTimer = Time::getTimer("Tracing");
+	Time::incTime(skinningTimer, skinEnd - skinStart);
+	Time::incTime(tlasBuildTimer, tlas.getBuildTime());
+	Time::incTime(tracingTimer, traceEnd - traceStart);
+	if (window)
+	{
+		static const Time::Handle writeFramebufferTimer = Time::getTimer("Write framebuffer");
+		Time::incTime(writeFramebufferTimer, writeEnd - traceEnd);
+	}
+}
+
+const std::vector<unsigned char>& CpuRenderer::getFramePixels() const
+{
+	return framePixels;
+}
+
+void CpuRenderer::createTrianglePacks(Geometry& _geometry, unsigned int _numTriangles)
+{
+	const std::vector<Bvh::Node>& nodes = _geometry.nodes;
+	_geometry.nodePacks.assign(nodes.size(), -1);
+	_geometry.trianglePacks.resize(_numTriangles);
+
+	int32_t numPacks = 0;
+	for (size_t n = 0; n < nodes.size(); ++n)
+	{
+		if (nodes[n].count == 0)
+		{
+			continue;
+		}
+
+		_geometry.nodePacks[n] = numPacks;
+		for (int i = 0; i < nodes[n].count; ++i)
+		{
+			_geometry.trianglePacks[nodes[n].leftFirst + i] = numPacks * PACKET_SIZE + i;
+		}
+		numPacks += (nodes[n].count + PACKET_SIZE - 1) / PACKET_SIZE;
+	}
+
+	TrianglePack empty;
+	memset(&empty, 0, sizeof(empty));
+	_geometry.packs.assign(numPacks, empty);
+}
+
+void CpuRenderer::setPackTriangle(Geometry& _geometry, unsigned int _triangle, const glm::vec4& _v0, const glm::vec4& _v1, const glm::vec4& _v2)
+{
+	int32_t packLane = _geometry.trianglePacks[_triangle];
+	TrianglePack& pack = _geometry.packs[packLane / PACKET_SIZE];
+	int lane = packLane % PACKET_SIZE;
+
+	for (int i = 0; i < 3; ++i)
+	{
+		pack.v0[i][lane] = _v0[i];
+		pack.e1[i][lane] = _v1[i] - _v0[i];
+		pack.e2[i][lane] = _v2[i] - _v0[i];
+	}
+}
+
+// Skins the vertices into world space like transformSkeletalVertices in Transform.cl, then refits the hierarchy
+// of the bind pose. The hierarchy is never rebuilt on this path.
+void CpuRenderer::skinModel(const ModelInstance& _instance, Geometry& _geometry)
+{
+	const std::vector<AnimatedObjModel::VertexType>& vertices = _instance.model->data->getSkinnedBvh()->getVertices();
+
+	_instance.skeleton.updateTransforms();
+	const std::vector<glm::mat4>& transforms = _instance.skeleton.getTransforms();
+
+	unsigned int numVertices = vertices.size();
+	pool.run((numVertices + VERTICES_PER_SKINNING_TASK - 1) / VERTICES_PER_SKINNING_TASK, [&](unsigned int _task)
+	{
+		unsigned int end = std::min(numVertices, (_task + 1) * VERTICES_PER_SKINNING_TASK);
+		for (unsigned int i = _task * VERTICES_PER_SKINNING_TASK; i < end; ++i)
+		{
+			const AnimatedObjModel::VertexType& in = vertices[i];
+			Vertex& out = _geometry.skinnedVertices[i];
+
+			// The transforms are transposed for the kernels
+			glm::mat4 transform = glm::transpose(transforms[in.bone]);
+			out.position = transform * in.position;
+			out.texture = in.texCoord;
+			out.normal = transform * in.normal;
+			out.tangent = transform * in.tangent;
+			out.binormal = transform * in.bitangent;
+		}
+	});
+
+	const std::vector<Vertex>& skinned = _geometry.skinnedVertices;
+	const std::vector<uint32_t>& indices = *_geometry.indices;
+	unsigned int numTriangles = _geometry.trianglePacks.size();
+	pool.run((numTriangles + TRIANGLES_PER_SKINNING_TASK - 1) / TRIANGLES_PER_SKINNING_TASK, [&](unsigned int _task)
+	{
+		unsigned int end = std::min(numTriangles, (_task + 1) * TRIANGLES_PER_SKINNING_TASK);
+		for (unsigned int t = _task * TRIANGLES_PER_SKINNING_TASK; t < end; ++t)
+		{
+			setPackTriangle(_geometry, t, skinned[indices[t * 3]].position, skinned[indices[t * 3 + 1]].position, skinned[indices[t * 3 + 2]].position);
+		}
+	});
+
+	// Children are always stored after their parent, so walking the nodes backwards visits them bottom-up
+	std::vector<Bvh::Node>& nodes = _geometry.nodes;
+	for (size_t n = nodes.size(); n-- > 0;)
+	{
+		Bvh::Node& node = nodes[n];
+
+		glm::vec3 nodeMin(std::numeric_limits<float>::infinity());
+		glm::vec3 nodeMax(-std::numeric_limits<float>::infinity());
+		if (node.count > 0)
+		{
+			for (int i = 0; i < node.count; ++i)
+			{
+				const TrianglePack& pack = _geometry.packs[_geometry.nodePacks[n] + i / PACKET_SIZE];
+				int lane = i % PACKET_SIZE;
+
+				glm::vec3 v0(pack.v0[0][lane], pack.v0[1][lane], pack.v0[2][lane]);
+				glm::vec3 v1 = v0 + glm::vec3(pack.e1[0][lane], pack.e1[1][lane], pack.e1[2][lane]);
+				glm::vec3 v2 = v0 + glm::vec3(pack.e2[0][lane], pack.e2[1][lane], pack.e2[2][lane]);
+				nodeMin = glm::min(nodeMin, glm::min(v0, glm::min(v1, v2)));
+				nodeMax = glm::max(nodeMax, glm::max(v0, glm::max(v1, v2)));
+			}
+		}
+		else
+		{
+			const Bvh::Node& left = nodes[node.leftFirst];
+			const Bvh::Node& right = nodes[node.leftFirst + 1];
+			nodeMin = glm::min(glm::vec3(left.min), glm::vec3(right.min));
+			nodeMax = glm::max(glm::vec3(left.max), glm::vec3(right.max));
+		}
+
+		node.min = glm::vec4(nodeMin, 1.f);
+		node.max = glm::vec4(nodeMax, 1.f);
+	}
+}
+
+void CpuRenderer::updateTopLevel(const ModelInstance* _instances)
+{
+	items.clear();
+	itemMins.clear();
+	itemMaxs.clear();
+
+	for (unsigned int i = 0; i < numModels; ++i)
+	{
+		const Model& model = *_instances[i].model;
+		const Geometry& modelGeometry = geometry[&model - models];
+
+		// Skinned vertices are already in world space
+		glm::mat4 world;
+		glm::vec4 boundsMin = model.data->getBoundsMin();
+		glm::vec4 boundsMax = model.data->getBoundsMax();
+		if (model.data->isAnimated())
+		{
+			boundsMin = modelGeometry.nodes[0].min;
+			boundsMax = modelGeometry.nodes[0].max;
+		}
+		else
+		{
+			world = _instances[i].world.getTransform();
+		}
+
+		Instance& instance = instances[i];
+		instance.invWorld = glm::inverse(world);
+		instance.transform = world;
+		instance.normalTransform = glm::transpose(instance.invWorld);
+		instance.geometry = &modelGeometry;
+		instance.model = &model;
+
+		if (Settings::showModels[i])
+		{
+			glm::vec3 worldMin;
+			glm::vec3 worldMax;
+			Bvh::transformBounds(world, boundsMin, boundsMax, worldMin, worldMax);
+
+			items.push_back(i);
+			itemMins.push_back(worldMin);
+			itemMaxs.push_back(worldMax);
+		}
+	}
+
+	for (size_t i = 0; i < spheres->size(); ++i)
+	{
+		const Sphere& sphere = (*spheres)[i];
+		glm::vec3 center(sphere.position);
+
+		items.push_back(numModels + i);
+		itemMins.push_back(center - glm::vec3(sphere.radius));
+		itemMaxs.push_back(center + glm::vec3(sphere.radius));
+	}
+
+	tlas.buildFromBounds(itemMins, itemMaxs);
+
+	const std::vector<unsigned int>& order = tlas.getPrimitiveOrder();
+	tlasItems.resize(order.size());
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		tlasItems[i] = items[order[i]];
+	}
+}
+
+// Traces the samples of a tile in packets of 2x2 and averages them like dumpImage in writeImage.cl
+void CpuRenderer::renderTile(unsigned int _tile, const glm::mat4& _invViewProjection, const glm::vec3& _cameraPosition)
+{
+	int tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+	int tileX = (_tile % tilesX) * TILE_SIZE;
+	int tileY = (_tile / tilesX) * TILE_SIZE;
+	int tileWidth = std::min(TILE_SIZE, width - tileX);
+	int tileHeight = std::min(TILE_SIZE, height - tileY);
+
+	int superSampling = Settings::superSampling;
+	int sampledWidth = width * superSampling;
+	int sampledHeight = height * superSampling;
+
+	glm::vec3 colors[TILE_SIZE * TILE_SIZE];
+	for (int i = 0; i < TILE_SIZE * TILE_SIZE; ++i)
+	{
+		colors[i] = glm::vec3(0.f);
+	}
+
+	int endX = (tileX + tileWidth) * superSampling;
+	int endY = (tileY + tileHeight) * superSampling;
+	for (int y = tileY * superSampling; y < endY; y += 2)
+	{
+		for (int x = tileX * superSampling; x < endX; x += 2)
+		{
+			Path paths[PACKET_SIZE];
+			int active = 0;
+			for (int lane = 0; lane < PACKET_SIZE; ++lane)
+			{
+				int sampleX = x + (lane & 1);
+				int sampleY = y + (lane >> 1);
+				if (sampleX >= endX || sampleY >= endY)
+				{
+					continue;
+				}
+				active |= 1 << lane;
+
+				glm::vec4 fpos(((float)sampleX + 0.5f) * 2.f / (float)sampledWidth - 1.f, ((float)sampleY + 0.5f) * 2.f / (float)sampledHeight - 1.f, -1.f, 1.f);
+				glm::vec4 worldPos = _invViewProjection * fpos;
+				worldPos *= 1.f / worldPos.w;
+
+				glm::vec4 nextPos = fpos + glm::vec4(2.f / (float)sampledWidth, 0.f, 0.f, 0.f);
+				glm::vec4 nextWorldPos = _invViewProjection * nextPos;
+				nextWorldPos *= 1.f / nextWorldPos.w;
+
+				Path& path = paths[lane];
+				path.position = _cameraPosition;
+				path.direction = glm::normalize(glm::vec3(worldPos) - _cameraPosition);
+				path.coneWidth = 0.f;
+				path.coneSpread = glm::length(glm::normalize(glm::vec3(nextWorldPos) - _cameraPosition) - path.direction);
+				path.reflectDir = path.direction;
+				path.accumulated = glm::vec3(0.f);
+				path.totalStrength = 1.f;
+				path.collideGroup = -1;
+				path.collideObject = -1;
+			}
+
+			tracePacket(paths, active);
+
+			for (int lane = 0; lane < PACKET_SIZE; ++lane)
+			{
+				if (active & (1 << lane))
+				{
+					int pixelX = (x + (lane & 1)) / superSampling - tileX;
+					int pixelY = (y + (lane >> 1)) / superSampling - tileY;
+					colors[pixelY * TILE_SIZE + pixelX] += glm::clamp(paths[lane].accumulated, 0.f, 1.f);
+				}
+			}
+		}
+	}
+
+	for (int y = 0; y < tileHeight; ++y)
+	{
+		for (int x = 0; x < tileWidth; ++x)
+		{
+			glm::vec3 color = colors[y * TILE_SIZE + x] / (float)(superSampling * superSampling);
+
+			unsigned char* pixel = &framePixels[((tileY + y) * width + tileX + x) * 4];
+			pixel[0] = (unsigned char)(color.x * 255.f + 0.5f);
+			pixel[1] = (unsigned char)(color.y * 255.f + 0.5f);
+			pixel[2] = (unsigned char)(color.z * 255.f + 0.5f);
+			// The accumulated alpha is always 0, the same as in the frames of the kernels
+			pixel[3] = 0;
+		}
+	}
+}
+
+// Neighbouring samples are traced as a packet, closest hits and shadow rays alike, for as long as their paths stay
+// coherent. Reflections off curved or rough surfaces spread the rays apart, the paths left then go on one by one.
+void CpuRenderer::tracePacket(Path _paths[PACKET_SIZE], int _active) const
+{
+	int active = _active;
+	unsigned int bounce = 0;
+	for (; bounce < Settings::numBounces && active != 0; ++bounce)
+	{
+		if (bounce > 0 && !isCoherent(_paths, active))
+		{
+			break;
+		}
+
+		float position[3][PACKET_SIZE];
+		float direction[3][PACKET_SIZE];
+		float distance[PACKET_SIZE];
+		int prevGroup[PACKET_SIZE];
+		int prevObject[PACKET_SIZE];
+		for (int lane = 0; lane < PACKET_SIZE; ++lane)
+		{
+			bool isActive = (active & (1 << lane)) != 0;
+			for (int i = 0; i < 3; ++i)
+			{
+				position[i][lane] = isActive ? _paths[lane].position[i] : 0.f;
+				direction[i][lane] = isActive ? _paths[lane].direction[i] : (i == 2 ? 1.f : 0.f);
+			}
+			distance[lane] = isActive ? std::numeric_limits<float>::infinity() : -std::numeric_limits<float>::infinity();
+			prevGroup[lane] = isActive ? _paths[lane].collideGroup : -1;
+			prevObject[lane] = isActive ? _paths[lane].collideObject : -1;
+		}
+
+		RayPacket rays;
+		loadRayPacket(rays, position, direction, prevGroup, prevObject);
+
+		Hit hits[PACKET_SIZE];
+		findClosestHits(rays, Simd::load(distance), hits);
+
+		Surface surfaces[PACKET_SIZE];
+		float strengths[PACKET_SIZE];
+		int hitMask = 0;
+		for (int lane = 0; lane < PACKET_SIZE; ++lane)
+		{
+			if ((active & (1 << lane)) && hits[lane].group != -1)
+			{
+				surfaces[lane] = moveToHit(_paths[lane], hits[lane], strengths[lane]);
+				hitMask |= 1 << lane;
+			}
+		}
+
+		unsigned int occlusion[PACKET_SIZE] = { 0, 0, 0, 0 };
+		findOccludedLights(_paths, hitMask, occlusion);
+
+		for (int lane = 0; lane < PACKET_SIZE; ++lane)
+		{
+			if (hitMask & (1 << lane))
+			{
+				shadeLights(_paths[lane], surfaces[lane], strengths[lane], occlusion[lane]);
+			}
+		}
+
+		// Paths that missed are done
+		active = hitMask;
+	}
+
+	for (int lane = 0; lane < PACKET_SIZE; ++lane)
+	{
+		if (active & (1 << lane))
+		{
+			tracePath(_paths[lane], bounce);
+		}
+	}
+}
+
+// A packet pays off while its rays go through the same boxes. With a single ray left, or rays more than about 25
+// degrees from their mean direction, most of the boxes are only needed by one lane.
+bool CpuRenderer::isCoherent(const Path _paths[PACKET_SIZE], int _active)
+{
+	static const float MIN_COS_TO_MEAN = 0.9f;
+
+	glm::vec3 meanDirection(0.f);
+	int numActive = 0;
+	for (int lane = 0; lane < PACKET_SIZE; ++lane)
+	{
+		if (_active & (1 << lane))
+		{
+			meanDirection += _paths[lane].direction;
+			numActive++;
+		}
+	}
+
+	if (numActive < 2 || glm::dot(meanDirection, meanDirection) == 0.f)
+	{
+		return false;
+	}
+
+	meanDirection = glm::normalize(meanDirection);
+	for (int lane = 0; lane < PACKET_SIZE; ++lane)
+	{
+		if ((_active & (1 << lane)) && glm::dot(_paths[lane].direction, meanDirection) < MIN_COS_TO_MEAN)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// The passes of the kernels for the remaining bounces, back to back for a single path
+void CpuRenderer::tracePath(Path& _path, unsigned int _firstBounce) const
+{
+	for (unsigned int bounce = _firstBounce; bounce < Settings::numBounces; ++bounce)
+	{
+		Hit hit;
+		hit.distance = std::numeric_limits<float>::infinity();
+		hit.u = 0.f;
+		hit.v = 0.f;
+		hit.group = -1;
+		hit.object = -1;
+
+		findClosestHit(_path.position, _path.direction, _path.collideGroup, _path.collideObject, hit);
+		if (hit.group == -1)
+		{
+			break;
+		}
+
+		float strength;
+		Surface surface = moveToHit(_path, hit, strength);
+		shadeLights(_path, surface, strength, findOccludedLights(_path));
+	}
+}
+
+// Same as moveRaysToIntersection in rayTracing.cl, _strength is set to the weight of the light at the hit
+CpuRenderer::Surface CpuRenderer::moveToHit(Path& _path, const Hit& _hit, float& _strength) const
+{
+	_path.coneWidth += _path.coneSpread * _hit.distance;
+	Surface surface = shadeHit(_path.position, _path.direction, _hit, _path.coneWidth);
+
+	_path.position += _path.direction * _hit.distance + surface.normal * 0.001f;
+	_path.reflectDir = _path.direction - 2.f * glm::dot(_path.direction, surface.normal) * surface.normal;
+
+	_strength = _path.totalStrength;
+	_path.totalStrength *= surface.reflectFraction;
+	_path.collideGroup = _hit.group;
+	_path.collideObject = _hit.object;
+
+	return surface;
+}
+
+// Same as shadeLights in rayTracing.cl
+void CpuRenderer::shadeLights(Path& _path, const Surface& _surface, float _strength, unsigned int _occlusion) const
+{
+	glm::vec3 color(0.f);
+	for (unsigned int i = 0; i < Settings::numLights; ++i)
+	{
+		if ((_occlusion & (1u << i)) == 0)
+		{
+			color += calculateLight(_path.position, _surface.normal, _path.reflectDir, _surface.diffuseReflectivity, _surface.shininess, (*lights)[i]);
+		}
+	}
+
+	_path.accumulated += _strength * color;
+	_path.direction = _path.reflectDir;
+}
+
+unsigned int CpuRenderer::findOccludedLights(const Path& _path) const
+{
+	unsigned int occlusion = 0;
+	for (unsigned int i = 0; i < Settings::numLights; ++i)
+	{
+		glm::vec3 relativeLightPos = glm::vec3((*lights)[i].position) - _path.position;
+		float distance = glm::length(relativeLightPos);
+
+		if (isOccluded(_path.position, relativeLightPos / distance, distance, _path.collideGroup, _path.collideObject))
+		{
+			occlusion |= 1u << i;
+		}
+	}
+	return occlusion;
+}
+
+void CpuRenderer::findClosestHit(const glm::vec3& _position, const glm::vec3& _direction, int _prevGroup, int _prevObject, Hit& _hit) const
+{
+	const std::vector<Bvh::Node>& nodes = tlas.getNodes();
+	int numInstances = instances.size();
+	glm::vec3 invDirection = safeInverse(_direction);
+
+	float t;
+	if (!findBoxIntersectDistance(_position, invDirection, _hit.distance, nodes[0], t))
+	{
+		return;
+	}
+
+	int stack[Bvh::MAX_DEPTH];
+	int stackSize = 0;
+	int nodeIdx = 0;
+
+	while (true)
+	{
+		const Bvh::Node& node = nodes[nodeIdx];
+
+		if (node.count > 0)
+		{
+			for (int i = node.leftFirst; i < node.leftFirst + node.count; ++i)
+			{
+				int item = tlasItems[i];
+				if (item < numInstances)
+				{
+					findClosestInstanceHit(_position, _direction, instances[item], item + 1, _prevGroup, _prevObject, _hit);
+				}
+				else
+				{
+					int sphere = item - numInstances;
+					if (_prevGroup == SPHERE_GROUP && _prevObject == sphere)
+					{
+						continue;
+					}
+
+					if (findSphereIntersectDistance(_position, _direction, _hit.distance, (*spheres)[sphere], t))
+					{
+						_hit.distance = t;
+						_hit.group = SPHERE_GROUP;
+						_hit.object = sphere;
+					}
+				}
+			}
+		}
+		else
+		{
+			int nearChild = node.leftFirst;
+			int farChild = nearChild + 1;
+
+			float tNear;
+			float tFar;
+			bool hitNear = findBoxIntersectDistance(_position, invDirection, _hit.distance, nodes[nearChild], tNear);
+			bool hitFar = findBoxIntersectDistance(_position, invDirection, _hit.distance, nodes[farChild], tFar);
+
+			if (hitNear && hitFar)
+			{
+				if (tFar < tNear)
+				{
+					std::swap(nearChild, farChild);
+				}
+
+				stack[stackSize++] = farChild;
+				nodeIdx = nearChild;
+				continue;
+			}
+			else if (hitNear)
+			{
+				nodeIdx = nearChild;
+				continue;
+			}
+			else if (hitFar)
+			{
+				nodeIdx = farChild;
+				continue;
+			}
+		}
+
+		if (stackSize == 0)
+		{
+			break;
+		}
+
+		nodeIdx = stack[--stackSize];
+	}
+}
+
+void CpuRenderer::findClosestInstanceHit(const glm::vec3& _position, const glm::vec3& _direction, const Instance& _instance, int _groupID,
+	int _prevGroup, int _prevObject, Hit& _hit) const
+{
+	// The direction is not renormalized, which keeps t the same in object space
+	glm::vec3 objPosition(_instance.invWorld * glm::vec4(_position, 1.f));
+	glm::vec3 objDirection(_instance.invWorld * glm::vec4(_direction, 0.f));
+	glm::vec3 invDirection = safeInverse(objDirection);
+
+	const std::vector<Bvh::Node>& nodes = _instance.geometry->nodes;
+	const std::vector<TrianglePack>& packs = _instance.geometry->packs;
+	const std::vector<int32_t>& nodePacks = _instance.geometry->nodePacks;
+
+	float t;
+	if (!findBoxIntersectDistance(objPosition, invDirection, _hit.distance, nodes[0], t))
+	{
+		return;
+	}
+
+	int stack[Bvh::MAX_DEPTH];
+	int stackSize = 0;
+	int nodeIdx = 0;
+
+	while (true)
+	{
+		const Bvh::Node& node = nodes[nodeIdx];
+
+		if (node.count > 0)
+		{
+			for (int first = 0; first < node.count; first += PACKET_SIZE)
+			{
+				Simd::Float4 packT;
+				Simd::Float4 packU;
+				Simd::Float4 packV;
+				int mask = intersectTrianglePack(objPosition, objDirection, _hit.distance, packs[nodePacks[nodeIdx] + first / PACKET_SIZE], packT, packU, packV);
+				if (mask == 0)
+				{
+					continue;
+				}
+
+				float ts[PACKET_SIZE];
+				float us[PACKET_SIZE];
+				float vs[PACKET_SIZE];
+				Simd::store(ts, packT);
+				Simd::store(us, packU);
+				Simd::store(vs, packV);
+
+				// In triangle order, so the same triangle wins a tie as in the kernels
+				for (int lane = 0; lane < PACKET_SIZE; ++lane)
+				{
+					int i = node.leftFirst + first + lane;
+					if ((mask & (1 << lane)) == 0 || ts[lane] > _hit.distance || (_prevGroup == _groupID && _prevObject == i))
+					{
+						continue;
+					}
+
+					_hit.distance = ts[lane];
+					_hit.u = us[lane];
+					_hit.v = vs[lane];
+					_hit.group = _groupID;
+					_hit.object = i;
+				}
+			}
+		}
+		else
+		{
+			int nearChild = node.leftFirst;
+			int farChild = nearChild + 1;
+
+			float tNear;
+			float tFar;
+			bool hitNear = findBoxIntersectDistance(objPosition, invDirection, _hit.distance, nodes[nearChild], tNear);
+			bool hitFar = findBoxIntersectDistance(objPosition, invDirection, _hit.distance, nodes[farChild], tFar);
+
+			if (hitNear && hitFar)
+			{
+				if (tFar < tNear)
+				{
+					std::swap(nearChild, farChild);
+				}
+
+				stack[stackSize++] = farChild;
+				nodeIdx = nearChild;
+				continue;
+			}
+			else if (hitNear)
+			{
+				nodeIdx = nearChild;
+				continue;
+			}
+			else if (hitFar)
+			{
+				nodeIdx = farChild;
+				continue;
+			}
+		}
+
+		if (stackSize == 0)
+		{
+			break;
+		}
+
+		nodeIdx = stack[--stackSize];
+	}
+}
+
+bool CpuRenderer::isOccluded(const glm::vec3& _position, const glm::vec3& _direction, float _distance, int _prevGroup, int _prevObject) const
+{
+	const std::vector<Bvh::Node>& nodes = tlas.getNodes();
+	int numInstances = instances.size();
+	glm::vec3 invDirection = safeInverse(_direction);
+
+	float t;
+	if (!findBoxIntersectDistance(_position, invDirection, _distance, nodes[0], t))
+	{
+		return false;
+	}
+
+	int stack[Bvh::MAX_DEPTH];
+	int stackSize = 0;
+	int nodeIdx = 0;
+
+	while (true)
+	{
+		const Bvh::Node& node = nodes[nodeIdx];
+
+		if (node.count > 0)
+		{
+			for (int i = node.leftFirst; i < node.leftFirst + node.count; ++i)
+			{
+				int item = tlasItems[i];
+				if (item < numInstances)
+				{
+					if (isInstanceOccluding(_position, _direction, _distance, instances[item], item + 1, _prevGroup, _prevObject))
+					{
+						return true;
+					}
+				}
+				else
+				{
+					int sphere = item - numInstances;
+					if (_prevGroup == SPHERE_GROUP && _prevObject == sphere)
+					{
+						continue;
+					}
+
+					// The spheres closest to the light are the lights themselves, which should not cast shadows
+					if (findSphereIntersectDistance(_position, _direction, _distance, (*spheres)[sphere], t) && _distance - t >= 0.11f)
+					{
+						return true;
+					}
+				}
+			}
+		}
+		else
+		{
+			int left = node.leftFirst;
+
+			bool hitLeft = findBoxIntersectDistance(_position, invDirection, _distance, nodes[left], t);
+			bool hitRight = findBoxIntersectDistance(_position, invDirection, _distance, nodes[left + 1], t);
+
+			if (hitLeft && hitRight)
+			{
+				stack[stackSize++] = left + 1;
+				nodeIdx = left;
+				continue;
+			}
+			else if (hitLeft)
+			{
+				nodeIdx = left;
+				continue;
+			}
+			else if (hitRight)
+			{
+				nodeIdx = left + 1;
+				continue;
+			}
+		}
+
+		if (stackSize == 0)
+		{
+			break;
+		}
+
+		nodeIdx = stack[--stackSize];
+	}
+
+	return false;
+}
+
+bool CpuRenderer::isInstanceOccluding(const glm::vec3& _position, const glm::vec3& _direction, float _distance, const Instance& _instance, int _groupID,
+	int _prevGroup, int _prevObject) const
+{
+	glm::vec3 objPosition(_instance.invWorld * glm::vec4(_position, 1.f));
+	glm::vec3 objDirection(_instance.invWorld * glm::vec4(_direction, 0.f));
+	glm::vec3 invDirection = safeInverse(objDirection);
+
+	const std::vector<Bvh::Node>& nodes = _instance.geometry->nodes;
+	const std::vector<TrianglePack>& packs = _instance.geometry->packs;
+	const std::vector<int32_t>& nodePacks = _instance.geometry->nodePacks;
+
+	float t;
+	if (!findBoxIntersectDistance(objPosition, invDirection, _distance, nodes[0], t))
+	{
+		return false;
+	}
+
+	int stack[Bvh::MAX_DEPTH];
+	int stackSize = 0;
+	int nodeIdx = 0;
+
+	while (true)
+	{
+		const Bvh::Node& node = nodes[nodeIdx];
+
+		if (node.count > 0)
+		{
+			for (int first = 0; first < node.count; first += PACKET_SIZE)
+			{
+				Simd::Float4 packT;
+				Simd::Float4 packU;
+				Simd::Float4 packV;
+				int mask = intersectTrianglePack(objPosition, objDirection, _distance, packs[nodePacks[nodeIdx] + first / PACKET_SIZE], packT, packU, packV);
+
+				if (_prevGroup == _groupID && _prevObject >= node.leftFirst + first && _prevObject < node.leftFirst + first + PACKET_SIZE)
+				{
+					mask &= ~(1 << (_prevObject - node.leftFirst - first));
+				}
+
+				if (mask != 0)
+				{
+					return true;
+				}
+			}
+		}
+		else
+		{
+			int left = node.leftFirst;
+
+			bool hitLeft = findBoxIntersectDistance(objPosition, invDirection, _distance, nodes[left], t);
+			bool hitRight = findBoxIntersectDistance(objPosition, invDirection, _distance, nodes[left + 1], t);
+
+			if (hitLeft && hitRight)
+			{
+				stack[stackSize++] = left + 1;
+				nodeIdx = left;
+				continue;
+			}
+			else if (hitLeft)
+			{
+				nodeIdx = left;
+				continue;
+			}
+			else if (hitRight)
+			{
+				nodeIdx = left + 1;
+				continue;
+			}
+		}
+
+		if (stackSize == 0)
+		{
+			break;
+		}
+
+		nodeIdx = stack[--stackSize];
+	}
+
+	return false;
+}
+
+// Same as shadeSphereHit and shadeTriangleHit in rayTracing.cl
+CpuRenderer::Surface CpuRenderer::shadeHit(const glm::vec3& _position, const glm::vec3& _direction, const Hit& _hit, float _coneWidth) const
+{
+	Surface surface;
+
+	if (_hit.group == SPHERE_GROUP)
+	{
+		const Sphere& sphere = (*spheres)[_hit.object];
+		surface.diffuseReflectivity = glm::vec3(sphere.diffuseReflectivity) * (1.f - sphere.reflectFraction);
+		surface.reflectFraction = sphere.reflectFraction;
+		surface.shininess = sphere.reflectFraction * 400.f;
+		surface.normal = glm::normalize(_position + _direction * _hit.distance - glm::vec3(sphere.position));
+		return surface;
+	}
+
+	const Instance& instance = instances[_hit.group - 1];
+	const std::vector<Vertex>& vertices = *instance.geometry->vertices;
+	const uint32_t* indices = &(*instance.geometry->indices)[_hit.object * 3];
+	const Vertex* triangle[3] = { &vertices[indices[0]], &vertices[indices[1]], &vertices[indices[2]] };
+	float u = _hit.u;
+	float v = _hit.v;
+	float w = 1.f - u - v;
+
+	glm::vec2 texCoord = w * glm::vec2(triangle[0]->texture) + u * glm::vec2(triangle[1]->texture) + v * glm::vec2(triangle[2]->texture);
+
+	glm::vec3 e1(instance.transform * (triangle[1]->position - triangle[0]->position));
+	glm::vec3 e2(instance.transform * (triangle[2]->position - triangle[0]->position));
+	float lodBase = getTextureLodBase(e1, e2, glm::vec2(triangle[0]->texture), glm::vec2(triangle[1]->texture), glm::vec2(triangle[2]->texture),
+		_direction, _coneWidth);
+
+	glm::vec4 diffuseSample(0.f, 0.f, 0.f, 1.f);
+	glm::vec4 normalSample(0.5f, 0.5f, 1.f, 0.f);
+	if (instance.model->hostDiffuseMap)
+	{
+		diffuseSample = instance.model->hostDiffuseMap->sample(texCoord, lodBase);
+	}
+	if (instance.model->hostNormalMap)
+	{
+		normalSample = instance.model->hostNormalMap->sample(texCoord, lodBase);
+	}
+
+	// The vertices are stored in object space
+	glm::vec3 normal(instance.normalTransform * (w * triangle[0]->normal + u * triangle[1]->normal + v * triangle[2]->normal));
+	glm::vec3 tangent(instance.transform * (w * triangle[0]->tangent + u * triangle[1]->tangent + v * triangle[2]->tangent));
+	glm::vec3 bitangent(instance.transform * (w * triangle[0]->binormal + u * triangle[1]->binormal + v * triangle[2]->binormal));
+
+	float reflectFraction = Settings::cubeReflect;
+	surface.diffuseReflectivity = (1.f - reflectFraction) * glm::vec3(diffuseSample);
+	surface.reflectFraction = reflectFraction;
+	surface.shininess = reflectFraction * 400.f;
+
+	glm::vec3 textureNormal = (glm::vec3(normalSample) - 0.5f) * 2.f;
+	surface.normal = glm::normalize(
+		textureNormal.x * glm::normalize(tangent)
+		+ textureNormal.y * glm::normalize(bitangent)
+		+ textureNormal.z * glm::normalize(normal));
+
+	return surface;
+}
+
+// Packet version of findClosestHit, a node is visited if any of the rays hits it
+void CpuRenderer::findClosestHits(const RayPacket& _rays, Simd::Float4 _distance, Hit _hits[PACKET_SIZE]) const
+{
+	PacketHit hit;
+	hit.distance = _distance;
+	hit.u = Simd::zero();
+	hit.v = Simd::zero();
+	hit.group = Simd::splatInt(-1);
+	hit.object = Simd::splatInt(-1);
+
+	const std::vector<Bvh::Node>& nodes = tlas.getNodes();
+	int numInstances = instances.size();
+
+	Simd::Float4 enter;
+	if (Simd::moveMask(intersectBoxPacket(_rays, nodes[0], hit.distance, enter)) != 0)
+	{
+		int stack[Bvh::MAX_DEPTH];
+		int stackSize = 0;
+		int nodeIdx = 0;
+
+		while (true)
+		{
+			const Bvh::Node& node = nodes[nodeIdx];
+
+			if (node.count > 0)
+			{
+				for (int i = node.leftFirst; i < node.leftFirst + node.count; ++i)
+				{
+					int item = tlasItems[i];
+					if (item < numInstances)
+					{
+						findClosestInstanceHits(_rays, instances[item], item + 1, hit);
+					}
+					else
+					{
+						int sphere = item - numInstances;
+
+						Simd::Float4 t;
+						Simd::Float4 mask = intersectSpherePacket(_rays, (*spheres)[sphere], hit.distance, t);
+						mask = Simd::bitAndNot(isPrevHitPacket(_rays, SPHERE_GROUP, sphere), mask);
+
+						hit.distance = selectPacket(mask, t, hit.distance);
+						hit.group = selectPacket(mask, Simd::splatInt(SPHERE_GROUP), hit.group);
+						hit.object = selectPacket(mask, Simd::splatInt(sphere), hit.object);
+					}
+				}
+			}
+			else
+			{
+				int nearChild = node.leftFirst;
+				int farChild = nearChild + 1;
+
+				Simd::Float4 enterNear;
+				Simd::Float4 enterFar;
+				int hitNear = Simd::moveMask(intersectBoxPacket(_rays, nodes[nearChild], hit.distance, enterNear));
+				int hitFar = Simd::moveMask(intersectBoxPacket(_rays, nodes[farChild], hit.distance, enterFar));
+
+				if (hitNear && hitFar)
+				{
+					if (findFirstEnter(enterFar, hitFar) < findFirstEnter(enterNear, hitNear))
+					{
+						std::swap(nearChild, farChild);
+					}
+
+					stack[stackSize++] = farChild;
+					nodeIdx = nearChild;
+					continue;
+				}
+				else if (hitNear)
+				{
+					nodeIdx = nearChild;
+					continue;
+				}
+				else if (hitFar)
+				{
+					nodeIdx = farChild;
+					continue;
+				}
+			}
+
+			if (stackSize == 0)
+			{
+				break;
+			}
+
+			nodeIdx = stack[--stackSize];
+		}
+	}
+
+	float distances[PACKET_SIZE];
+	float us[PACKET_SIZE];
+	float vs[PACKET_SIZE];
+	int groups[PACKET_SIZE];
+	int objects[PACKET_SIZE];
+	Simd::store(distances, hit.distance);
+	Simd::store(us, hit.u);
+	Simd::store(vs, hit.v);
+	Simd::store(groups, hit.group);
+	Simd::store(objects, hit.object);
+
+	for (int lane = 0; lane < PACKET_SIZE; ++lane)
+	{
+		_hits[lane].distance = distances[lane];
+		_hits[lane].u = us[lane];
+		_hits[lane].v = vs[lane];
+		_hits[lane].group = groups[lane];
+		_hits[lane].object = objects[lane];
+	}
+}
+
+void CpuRenderer::findClosestInstanceHits(const RayPacket& _rays, const Instance& _instance, int _groupID, PacketHit& _hit) const
+{
+	RayPacket objRays;
+	transformPacket(_rays, _instance.invWorld, objRays);
+
+	const std::vector<Bvh::Node>& nodes = _instance.geometry->nodes;
+	const std::vector<TrianglePack>& packs = _instance.geometry->packs;
+	const std::vector<int32_t>& nodePacks = _instance.geometry->nodePacks;
+
+	Simd::Float4 enter;
+	if (Simd::moveMask(intersectBoxPacket(objRays, nodes[0], _hit.distance, enter)) == 0)
+	{
+		return;
+	}
+
+	int stack[Bvh::MAX_DEPTH];
+	int stackSize = 0;
+	int nodeIdx = 0;
+
+	while (true)
+	{
+		const Bvh::Node& node = nodes[nodeIdx];
+
+		if (node.count > 0)
+		{
+			for (int i = 0; i < node.count; ++i)
+			{
+				Simd::Float4 t;
+				Simd::Float4 u;
+				Simd::Float4 v;
+				Simd::Float4 mask = intersectTrianglePacket(objRays, _hit.distance, packs[nodePacks[nodeIdx] + i / PACKET_SIZE], i % PACKET_SIZE, t, u, v);
+				mask = Simd::bitAndNot(isPrevHitPacket(objRays, _groupID, node.leftFirst + i), mask);
+				if (Simd::moveMask(mask) == 0)
+				{
+					continue;
+				}
+
+				_hit.distance = selectPacket(mask, t, _hit.distance);
+				_hit.u = selectPacket(mask, u, _hit.u);
+				_hit.v = selectPacket(mask, v, _hit.v);
+				_hit.group = selectPacket(mask, Simd::splatInt(_groupID), _hit.group);
+				_hit.object = selectPacket(mask, Simd::splatInt(node.leftFirst + i), _hit.object);
+			}
+		}
+		else
+		{
+			int nearChild = node.leftFirst;
+			int farChild = nearChild + 1;
+
+			Simd::Float4 enterNear;
+			Simd::Float4 enterFar;
+			int hitNear = Simd::moveMask(intersectBoxPacket(objRays, nodes[nearChild], _hit.distance, enterNear));
+			int hitFar = Simd::moveMask(intersectBoxPacket(objRays, nodes[farChild], _hit.distance, enterFar));
+
+			if (hitNear && hitFar)
+			{
+				if (findFirstEnter(enterFar, hitFar) < findFirstEnter(enterNear, hitNear))
+				{
+					std::swap(nearChild, farChild);
+				}
+
+				stack[stackSize++] = farChild;
+				nodeIdx = nearChild;
+				continue;
+			}
+			else if (hitNear)
+			{
+				nodeIdx = nearChild;
+				continue;
+			}
+			else if (hitFar)
+			{
+				nodeIdx = farChild;
+				continue;
+			}
+		}
+
+		if (stackSize == 0)
+		{
+			break;
+		}
+
+		nodeIdx = stack[--stackSize];
+	}
+}
+
+// The shadow rays of neighbouring hits towards the same light, traced as one packet per light
+void CpuRenderer::findOccludedLights(const Path _paths[PACKET_SIZE], int _active, unsigned int _occlusion[PACKET_SIZE]) const
+{
+	if (_active == 0)
+	{
+		return;
+	}
+
+	for (unsigned int i = 0; i < Settings::numLights; ++i)
+	{
+		float position[3][PACKET_SIZE];
+		float direction[3][PACKET_SIZE];
+		float distance[PACKET_SIZE];
+		int prevGroup[PACKET_SIZE];
+		int prevObject[PACKET_SIZE];
+		for (int lane = 0; lane < PACKET_SIZE; ++lane)
+		{
+			glm::vec3 lanePosition(0.f);
+			glm::vec3 laneDirection(0.f, 0.f, 1.f);
+			distance[lane] = -std::numeric_limits<float>::infinity();
+			prevGroup[lane] = -1;
+			prevObject[lane] = -1;
+
+			if (_active & (1 << lane))
+			{
+				const Path& path = _paths[lane];
+				glm::vec3 relativeLightPos = glm::vec3((*lights)[i].position) - path.position;
+
+				lanePosition = path.position;
+				distance[lane] = glm::length(relativeLightPos);
+				laneDirection = relativeLightPos / distance[lane];
+				prevGroup[lane] = path.collideGroup;
+				prevObject[lane] = path.collideObject;
+			}
+
+			for (int c = 0; c < 3; ++c)
+			{
+				position[c][lane] = lanePosition[c];
+				direction[c][lane] = laneDirection[c];
+			}
+		}
+
+		RayPacket rays;
+		loadRayPacket(rays, position, direction, prevGroup, prevObject);
+
+		int occluded = Simd::moveMask(findOccluded(rays, Simd::load(distance))) & _active;
+		for (int lane = 0; lane < PACKET_SIZE; ++lane)
+		{
+			if (occluded & (1 << lane))
+			{
+				_occlusion[lane] |= 1u << i;
+			}
+		}
+	}
+}
+
+// Packet version of isOccluded, returns the rays that are blocked. A ray stops taking part once it is blocked,
+// and the traversal ends when all of them are.
+Simd::Float4 CpuRenderer::findOccluded(const RayPacket& _rays, Simd::Float4 _distance) const
+{
+	const Simd::Float4 inactive = Simd::splat(-std::numeric_limits<float>::infinity());
+	int activeLanes = Simd::moveMask(Simd::cmpGe(_distance, Simd::zero()));
+
+	Simd::Float4 occluded = Simd::zero();
+	Simd::Float4 distance = _distance;
+
+	const std::vector<Bvh::Node>& nodes = tlas.getNodes();
+	int numInstances = instances.size();
+
+	Simd::Float4 enter;
+	if (Simd::moveMask(intersectBoxPacket(_rays, nodes[0], distance, enter)) == 0)
+	{
+		return occluded;
+	}
+
+	int stack[Bvh::MAX_DEPTH];
+	int stackSize = 0;
+	int nodeIdx = 0;
+
+	while (true)
+	{
+		const Bvh::Node& node = nodes[nodeIdx];
+
+		if (node.count > 0)
+		{
+			for (int i = node.leftFirst; i < node.leftFirst + node.count; ++i)
+			{
+				int item = tlasItems[i];
+				if (item < numInstances)
+				{
+					occluded = Simd::bitOr(occluded, findInstanceOccluding(_rays, distance, instances[item], item + 1));
+				}
+				else
+				{
+					int sphere = item - numInstances;
+
+					// The spheres closest to the light are the lights themselves, which should not cast shadows
+					Simd::Float4 t;
+					Simd::Float4 mask = intersectSpherePacket(_rays, (*spheres)[sphere], distance, t);
+					mask = Simd::bitAnd(mask, Simd::cmpGe(Simd::sub(_distance, t), Simd::splat(0.11f)));
+					occluded = Simd::bitOr(occluded, Simd::bitAndNot(isPrevHitPacket(_rays, SPHERE_GROUP, sphere), mask));
+				}
+
+				if ((Simd::moveMask(occluded) & activeLanes) == activeLanes)
+				{
+					return occluded;
+				}
+				distance = selectPacket(occluded, inactive, _distance);
+			}
+		}
+		else
+		{
+			int left = node.leftFirst;
+
+			int hitLeft = Simd::moveMask(intersectBoxPacket(_rays, nodes[left], distance, enter));
+			int hitRight = Simd::moveMask(intersectBoxPacket(_rays, nodes[left + 1], distance, enter));
+
+			if (hitLeft && hitRight)
+			{
+				stack[stackSize++] = left + 1;
+				nodeIdx = left;
+				continue;
+			}
+			else if (hitLeft)
+			{
+				nodeIdx = left;
+				continue;
+			}
+			else if (hitRight)
+			{
+				nodeIdx = left + 1;
+				continue;
+			}
+		}
+
+		if (stackSize == 0)
+		{
+			break;
+		}
+
+		nodeIdx = stack[--stackSize];
+	}
+
+	return occluded;
+}
+
+// Rays that are already blocked have a distance of -infinity and are left out
+Simd::Float4 CpuRenderer::findInstanceOccluding(const RayPacket& _rays, Simd::Float4 _distance, const Instance& _instance, int _groupID) const
+{
+	const Simd::Float4 inactive = Simd::splat(-std::numeric_limits<float>::infinity());
+	int activeLanes = Simd::moveMask(Simd::cmpGe(_distance, Simd::zero()));
+
+	RayPacket objRays;
+	transformPacket(_rays, _instance.invWorld, objRays);
+
+	const std::vector<Bvh::Node>& nodes = _instance.geometry->nodes;
+	const std::vector<TrianglePack>& packs = _instance.geometry->packs;
+	const std::vector<int32_t>& nodePacks = _instance.geometry->nodePacks;
+
+	Simd::Float4 occluded = Simd::zero();
+	Simd::Float4 distance = _distance;
+
+	Simd::Float4 enter;
+	if (Simd::moveMask(intersectBoxPacket(objRays, nodes[0], distance, enter)) == 0)
+	{
+		return occluded;
+	}
+
+	int stack[Bvh::MAX_DEPTH];
+	int stackSize = 0;
+	int nodeIdx = 0;
+
+	while (true)
+	{
+		const Bvh::Node& node = nodes[nodeIdx];
+
+		if (node.count > 0)
+		{
+			for (int i = 0; i < node.count; ++i)
+			{
+				Simd::Float4 t;
+				Simd::Float4 u;
+				Simd::Float4 v;
+				Simd::Float4 mask = intersectTrianglePacket(objRays, distance, packs[nodePacks[nodeIdx] + i / PACKET_SIZE], i % PACKET_SIZE, t, u, v);
+				occluded = Simd::bitOr(occluded, Simd::bitAndNot(isPrevHitPacket(objRays, _groupID, node.leftFirst + i), mask));
+			}
+
+			if ((Simd::moveMask(occluded) & activeLanes) == activeLanes)
+			{
+				return occluded;
+			}
+			distance = selectPacket(occluded, inactive, _distance);
+		}
+		else
+		{
+			int left = node.leftFirst;
+
+			int hitLeft = Simd::moveMask(intersectBoxPacket(objRays, nodes[left], distance, enter));
+			int hitRight = Simd::moveMask(intersectBoxPacket(objRays, nodes[left + 1], distance, enter));
+
+			if (hitLeft && hitRight)
+			{
+				stack[stackSize++] = left + 1;
+				nodeIdx = left;
+				continue;
+			}
+			else if (hitLeft)
+			{
+				nodeIdx = left;
+				continue;
+			}
+			else if (hitRight)
+			{
+				nodeIdx = left + 1;
+				continue;
+			}
+		}
+
+		if (stackSize == 0)
+		{
+			break;
+		}
+
+		nodeIdx = stack[--stackSize];
+	}
+
+	return occluded;
+}
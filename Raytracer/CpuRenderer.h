@@ -0,0 +1,147 @@
+#pragma once
+
+#include "Bvh.h"
+#include "GLWindow.h"
+#include "Model.h"
+#include "MovingLight.h"
+#include "RayPacket.h"
+#include "Renderer.h"
+#include "Sphere.h"
+#include "ThreadPool.h"
+#include "Vertex.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// Traces the frame on the host with the same math as the kernels in rayTracing.cl. Primary rays are traced as SIMD
+// packets of 2x2 samples, together with their shadow rays, and the reflections stay in the packet while they go about
+// the same way. Once they diverge each ray is traced by itself against four triangles at once. Screen tiles are
+// spread over a work-stealing thread pool.
+// Needs the host vertices and textures of the models, see ModelData::setVertices and TextureManager::loadHostTexture.
+class CpuRenderer : public Renderer
+{
+private:
+	static const int TILE_SIZE = 16;
+
+	// The geometry of a model in object space, skinned models are skinned into world space every frame
+	struct Geometry
+	{
+		const std::vector<Vertex>* vertices;
+		const std::vector<uint32_t>* indices;	// Three per triangle
+		std::vector<Vertex> skinnedVertices;
+		std::vector<Bvh::Node> nodes;
+		// The triangles of every leaf, padded to whole packs
+		std::vector<TrianglePack> packs;
+		std::vector<int32_t> nodePacks;		// First pack of every leaf
+		std::vector<int32_t> trianglePacks;	// Pack * PACKET_SIZE + lane of every triangle, only kept for skinned models
+	};
+
+	struct Instance
+	{
+		glm::mat4 invWorld;
+		glm::mat4 transform;
+		glm::mat4 normalTransform;
+		const Geometry* geometry;
+		const Model* model;
+	};
+
+	struct Hit
+	{
+		float distance;
+		float u;
+		float v;
+		int group;
+		int object;
+	};
+
+	struct PacketHit
+	{
+		Simd::Float4 distance;
+		Simd::Float4 u;
+		Simd::Float4 v;
+		Simd::Int4 group;
+		Simd::Int4 object;
+	};
+
+	struct Surface
+	{
+		glm::vec3 diffuseReflectivity;
+		glm::vec3 normal;
+		float reflectFraction;
+		float shininess;
+	};
+
+	// The state of a ray between bounces, what the kernels keep in the ray buffer
+	struct Path
+	{
+		glm::vec3 position;
+		glm::vec3 direction;
+		glm::vec3 reflectDir;
+		glm::vec3 accumulated;
+		float totalStrength;
+		int collideGroup;
+		int collideObject;
+		float coneWidth;
+		float coneSpread;
+	};
+
+	GLWindow* window;
+	ThreadPool pool;
+
+	const Model* models;
+	unsigned int numModels;
+	std::vector<Geometry> geometry;
+	std::vector<Instance> instances;
+
+	Bvh tlas;
+	std::vector<int32_t> items;	// In build order, before sorting into tlasItems
+	std::vector<int32_t> tlasItems;
+	std::vector<glm::vec3> itemMins;
+	std::vector<glm::vec3> itemMaxs;
+
+	const std::vector<Sphere>* spheres;
+	const std::vector<Light>* lights;
+
+	int width;
+	int height;
+	std::vector<unsigned char> framePixels;
+
+public:
+	// _window may be null. _numThreads of 0 uses one thread per hardware thread.
+	CpuRenderer(GLWindow* _window, const Model* _models, unsigned int _numModels, unsigned int _numThreads);
+
+	void resize(int _width, int _height) override;
+	void render(const FrameState& _frame) override;
+	const std::vector<unsigned char>& getFramePixels() const override;
+
+private:
+	static void createTrianglePacks(Geometry& _geometry, unsigned int _numTriangles);
+	static void setPackTriangle(Geometry& _geometry, unsigned int _triangle, const glm::vec4& _v0, const glm::vec4& _v1, const glm::vec4& _v2);
+
+	void skinModel(const ModelInstance& _instance, Geometry& _geometry);
+	void updateTopLevel(const ModelInstance* _instances);
+	void renderTile(unsigned int _tile, const glm::mat4& _invViewProjection, const glm::vec3& _cameraPosition);
+
+	void tracePacket(Path _paths[PACKET_SIZE], int _active) const;
+	static bool isCoherent(const Path _paths[PACKET_SIZE], int _active);
+	void tracePath(Path& _path, unsigned int _firstBounce) const;
+	Surface moveToHit(Path& _path, const Hit& _hit, float& _strength) const;
+	void shadeLights(Path& _path, const Surface& _surface, float _strength, unsigned int _occlusion) const;
+	Surface shadeHit(const glm::vec3& _position, const glm::vec3& _direction, const Hit& _hit, float _coneWidth) const;
+
+	void findClosestHit(const glm::vec3& _position, const glm::vec3& _direction, int _prevGroup, int _prevObject, Hit& _hit) const;
+	void findClosestInstanceHit(const glm::vec3& _position, const glm::vec3& _direction, const Instance& _instance, int _groupID,
+		int _prevGroup, int _prevObject, Hit& _hit) const;
+	unsigned int findOccludedLights(const Path& _path) const;
+	bool isOccluded(const glm::vec3& _position, const glm::vec3& _direction, float _distance, int _prevGroup, int _prevObject) const;
+	bool isInstanceOccluding(const glm::vec3& _position, const glm::vec3& _direction, float _distance, const Instance& _instance, int _groupID,
+		int _prevGroup, int _prevObject) const;
+
+	void findClosestHits(const RayPacket& _rays, Simd::Float4 _distance, Hit _hits[PACKET_SIZE]) const;
+	void findClosestInstanceHits(const RayPacket& _rays, const Instance& _instance, int _groupID, PacketHit& _hit) const;
+	void findOccludedLights(const Path _paths[PACKET_SIZE], int _active, unsigned int _occlusion[PACKET_SIZE]) const;
+	Simd::Float4 findOccluded(const RayPacket& _rays, Simd::Float4 _distance) const;
+	Simd::Float4 findInstanceOccluding(const RayPacket& _rays, Simd::Float4 _distance, const Instance& _instance, int _groupID) const;
+};
@@ -0,0 +1,84 @@
+#include "EnqueueBenchmark.h"
+
+#include "CLHelper.h"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+enum WaitMode
+{
+	WAIT_FOR_ALL_EARLIER,	// Every earlier event of the frame as the wait list, how the frames used to be enqueued
+	IN_ORDER,				// No wait list, the event is still kept for profiling
+	IN_ORDER_NO_EVENT,		// No wait list and no event, the least the host can do
+};
+
+// Returns the host time per frame in milliseconds
+static double timeEnqueues(cl::CommandQueue& _queue, cl::Kernel& _kernel, const cl::NDRange& _localSize,
+	unsigned int _kernelsPerFrame, unsigned int _frames, WaitMode _mode)
+{
+	std::vector<cl::Event> events;
+	events.reserve(_kernelsPerFrame);
+
+	std::chrono::high_resolution_clock::duration total(0);
+	for (unsigned int frame = 0; frame < _frames; ++frame)
+	{
+		events.clear();
+
+		auto start = std::chrono::high_resolution_clock::now();
+		for (unsigned int i = 0; i < _kernelsPerFrame; ++i)
+		{
+			cl::Event event;
+			switch (_mode)
+			{
+			case WAIT_FOR_ALL_EARLIER:
+				_queue.enqueueNDRangeKernel(_kernel, cl::NullRange, _localSize, _localSize, &events, &event);
+				events.push_back(event);
+				break;
+
+			case IN_ORDER:
+				_queue.enqueueNDRangeKernel(_kernel, cl::NullRange, _localSize, _localSize, nullptr, &event);
+				events.push_back(event);
+				break;
+
+			case IN_ORDER_NO_EVENT:
+				_queue.enqueueNDRangeKernel(_kernel, cl::NullRange, _localSize, _localSize);
+				break;
+			}
+		}
+		_queue.flush();
+		total += std::chrono::high_resolution_clock::now() - start;
+
+		// Not timed, the next frame starts with an empty queue like a frame of the renderer after the one before is done
+		_queue.finish();
+	}
+
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(total).count() / 1000000.0 / _frames;
+}
+
+void runEnqueueBenchmark(cl::Context& _context, std::vector<cl::Device>& _devices, cl::CommandQueue& _queue,
+	unsigned int _kernelsPerFrame, unsigned int _frames, const cl::NDRange& _localSize)
+{
+	cl::Program program = createProgramFromFile(_context, _devices, "EnqueueBenchmark.cl");
+
+	cl_int zero = 0;
+	cl::Buffer data(_context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(cl_int), &zero);
+	cl::Kernel kernel(program, "touch");
+	kernel.setArg(0, data);
+
+	// Once untimed, so the first launch of the kernel is not part of the results
+	timeEnqueues(_queue, kernel, _localSize, _kernelsPerFrame, 1, IN_ORDER);
+
+	const WaitMode modes[] = { WAIT_FOR_ALL_EARLIER, IN_ORDER, IN_ORDER_NO_EVENT };
+	const char* names[] = { "wait for all earlier", "in order", "in order, no event" };
+
+	std::cout << "Enqueue benchmark, " << _kernelsPerFrame << " kernels per frame, " << _frames << " frames" << std::endl;
+	for (int i = 0; i < 3; ++i)
+	{
+		double frameTime = timeEnqueues(_queue, kernel, _localSize, _kernelsPerFrame, _frames, modes[i]);
+
+		std::cout << std::fixed << std::setprecision(3)
+			<< names[i] << ": " << frameTime << " ms per frame, "
+			<< std::setprecision(2) << frameTime * 1000.0 / _kernelsPerFrame << " us per kernel" << std::endl;
+	}
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#define __CL_ENABLE_EXCEPTIONS
+#define CL_GL_INTEROP
+#include "CL/cl.hpp"
+
+#include <vector>
+
+// Times how long the host takes to enqueue frames of small kernels, as in the "OpenCL enqueue work" timer. Compares
+// passing every earlier event of the frame as the wait list against relying on the order of the queue.
+void runEnqueueBenchmark(cl::Context& _context, std::vector<cl::Device>& _devices, cl::CommandQueue& _queue,
+	unsigned int _kernelsPerFrame, unsigned int _frames, const cl::NDRange& _localSize);
@@ -0,0 +1,55 @@
+#include "FrameComparison.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+
+FrameTolerance getDefaultFrameTolerance()
+{
+	FrameTolerance tolerance;
+	tolerance.meanDifference = 1.0;
+	tolerance.outlierDifference = 16;
+	tolerance.outlierFraction = 0.005;
+	return tolerance;
+}
+
+FrameDifference compareFrames(const std::vector<unsigned char>& _a, const std::vector<unsigned char>& _b, const FrameTolerance& _tolerance)
+{
+	if (_a.size() != _b.size() || _a.size() % 4 != 0)
+	{
+		throw std::runtime_error("Can not compare frames of different sizes");
+	}
+
+	FrameDifference result;
+	result.maxDifference = 0;
+	result.outlierPixels = 0;
+	result.numPixels = _a.size() / 4;
+
+	unsigned long long total = 0;
+	for (size_t i = 0; i < _a.size(); i += 4)
+	{
+		int pixelMax = 0;
+		for (size_t c = 0; c < 3; ++c)
+		{
+			int difference = std::abs((int)_a[i + c] - (int)_b[i + c]);
+			total += difference;
+			pixelMax = std::max(pixelMax, difference);
+		}
+
+		result.maxDifference = std::max(result.maxDifference, pixelMax);
+		if (pixelMax > _tolerance.outlierDifference)
+		{
+			result.outlierPixels++;
+		}
+	}
+
+	result.meanDifference = result.numPixels > 0 ? (double)total / (result.numPixels * 3.0) : 0.0;
+
+	return result;
+}
+
+bool isWithinTolerance(const FrameDifference& _difference, const FrameTolerance& _tolerance)
+{
+	return _difference.meanDifference <= _tolerance.meanDifference &&
+		_difference.outlierPixels <= _tolerance.outlierFraction * _difference.numPixels;
+}
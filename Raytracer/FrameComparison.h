@@ -0,0 +1,27 @@
+#pragma once
+
+#include <vector>
+
+// How far apart two RGBA8 frames of the same size are, per color channel in levels of 0-255. Alpha is ignored.
+struct FrameDifference
+{
+	int maxDifference;
+	double meanDifference;
+	unsigned int outlierPixels;	// Pixels with a channel further apart than FrameTolerance::outlierDifference
+	unsigned int numPixels;
+};
+
+// The renderers use the same math, but not the same float operations in the same order, so single pixels on the
+// silhouettes and shadow edges may flip to another object. Those are allowed as outliers as long as they are few.
+struct FrameTolerance
+{
+	double meanDifference;
+	int outlierDifference;
+	double outlierFraction;
+};
+
+// A mean of one level with at most half a percent of the pixels further apart than 16 levels
+FrameTolerance getDefaultFrameTolerance();
+// Outliers are counted with _tolerance.outlierDifference
+FrameDifference compareFrames(const std::vector<unsigned char>& _a, const std::vector<unsigned char>& _b, const FrameTolerance& _tolerance);
+bool isWithinTolerance(const FrameDifference& _difference, const FrameTolerance& _tolerance);
@@ -1,13 +1,15 @@
 #include "GLWindow.h"
 
+#ifndef HEADLESS_ONLY
 #include <sstream>
+#include <stdexcept>
 #include <string>
 
 void GLWindow::initOpenGL(const std::string& _title)
 {
 	if (!glfwInit())
 	{
-		throw std::exception("Failed to initialize GLFW.");
+		throw std::runtime_error("Failed to initialize GLFW.");
 	}
 	
 	glfwDefaultWindowHints();
@@ -18,7 +20,7 @@ void GLWindow::initOpenGL(const std::string& _title)
 	if (!window)
 	{
 		glfwTerminate();
-		throw std::exception("Failed to create window.");
+		throw std::runtime_error("Failed to create window.");
 	}
 
 	glfwMakeContextCurrent(window);
@@ -31,7 +33,7 @@ void GLWindow::initOpenGL(const std::string& _title)
 
 		std::ostringstream oss;
 		oss << "Failed to initialize GLEW: (" << err << ") " << glewGetErrorString(err) << std::endl;
-		throw std::exception(oss.str().c_str());
+		throw std::runtime_error(oss.str());
 	}
 }
 
@@ -39,8 +41,7 @@ GLWindow::GLWindow(const std::string& _title, int _width, int _height)
 	: window(nullptr),
 	  width(_width),
 	  height(_height),
-	  framebuffer(0),
-	  renderbuffer(0)
+	  currentFramebuffer(0)
 {
 	initOpenGL(_title);
 }
@@ -51,23 +52,31 @@ GLWindow::~GLWindow()
 	glfwTerminate();
 }
 
-bool GLWindow::createFramebuffer(GLuint _framebufferWidth, GLuint _framebufferHeight)
+bool GLWindow::createFramebuffer(GLuint _framebufferWidth, GLuint _framebufferHeight, unsigned int _count)
 {
 	width = _framebufferWidth;
 	height = _framebufferHeight;
 
-	glGenFramebuffers(1, &framebuffer);
-	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	framebuffers.resize(_count);
+	renderbuffers.resize(_count);
+	glGenFramebuffers(_count, framebuffers.data());
+	glGenRenderbuffers(_count, renderbuffers.data());
 
-	glGenRenderbuffers(1, &renderbuffer);
-	glBindRenderbuffer(GL_RENDERBUFFER, renderbuffer);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA32F, width, height);
+	for (unsigned int i = 0; i < _count; ++i)
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[i]);
+
+		glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[i]);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA32F, width, height);
 
-	glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffer);
+		glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[i]);
+	}
 
 	glBindRenderbuffer(GL_RENDERBUFFER, 0);
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
+	currentFramebuffer = 0;
+
 	return true;
 }
 
@@ -76,30 +85,33 @@ void GLWindow::updateFramebuffer(GLuint _framebufferWidth, GLuint _framebufferHe
 	width = _framebufferWidth;
 	height = _framebufferHeight;
 
-	glBindRenderbuffer(GL_RENDERBUFFER, renderbuffer);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA32F, width, height);
+	for (GLuint renderbuffer : renderbuffers)
+	{
+		glBindRenderbuffer(GL_RENDERBUFFER, renderbuffer);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA32F, width, height);
+	}
 
 	glBindRenderbuffer(GL_RENDERBUFFER, 0);
 }
 
 void GLWindow::destroyFramebuffer()
 {
-	if (framebuffer)
+	if (!framebuffers.empty())
 	{
-		glDeleteFramebuffers(1, &framebuffer);
-		framebuffer = 0;
+		glDeleteFramebuffers((GLsizei)framebuffers.size(), framebuffers.data());
+		framebuffers.clear();
 	}
 
-	if (renderbuffer)
+	if (!renderbuffers.empty())
 	{
-		glDeleteRenderbuffers(1, &renderbuffer);
-		renderbuffer = 0;
+		glDeleteRenderbuffers((GLsizei)renderbuffers.size(), renderbuffers.data());
+		renderbuffers.clear();
 	}
 }
 
 void GLWindow::blitFramebuffer()
 {
-	glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffers[currentFramebuffer]);
 	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
 
 	glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
@@ -109,12 +121,23 @@ void GLWindow::blitFramebuffer()
 
 void GLWindow::clearFramebuffer(float _red, float _green, float _blue)
 {
-	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[currentFramebuffer]);
 	glClearColor(_red, _green, _blue, 1.f);
 	glClear(GL_COLOR_BUFFER_BIT);
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
+void GLWindow::writeFramebuffer(const unsigned char* _pixels)
+{
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffers[currentFramebuffer]);
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glWindowPos2i(0, 0);
+	glDrawPixels(width, height, GL_RGBA, GL_UNSIGNED_BYTE, _pixels);
+
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+}
+
 void GLWindow::clearBackbuffer(float _red, float _green, float _blue)
 {
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
@@ -133,9 +156,14 @@ void GLWindow::drawFramebuffer()
 	glfwPollEvents();
 }
 
-GLuint GLWindow::getRenderbuffer() const
+void GLWindow::setCurrentFramebuffer(unsigned int _index)
+{
+	currentFramebuffer = _index;
+}
+
+GLuint GLWindow::getRenderbuffer(unsigned int _index) const
 {
-	return renderbuffer;
+	return renderbuffers[_index];
 }
 
 GLuint GLWindow::getFramebufferWidth() const
@@ -177,3 +205,4 @@ void GLWindow::setWindowSize(int _width, int _height)
 {
 	glfwSetWindowSize(window, _width, _height);
 }
+#endif
@@ -1,11 +1,22 @@
 #pragma once
 
+// OpenCL shares the OpenGL context of the window through WGL, so other platforms only build the headless renderers.
+// Define HEADLESS_ONLY to leave out the window, OpenGL and GLFW on Windows too.
+#if !defined(_WIN32) && !defined(HEADLESS_ONLY)
+#define HEADLESS_ONLY
+#endif
+
+#ifdef HEADLESS_ONLY
+// Only passed around as a null pointer
+class GLWindow;
+#else
 #include <GL/glew.h>
 #include <GL/wglew.h>
 
 #include <GLFW/glfw3.h>
 
 #include <iostream>
+#include <vector>
 
 class GLWindow
 {
@@ -14,8 +25,10 @@ private:
 	int width;
 	int height;
 
-	GLuint framebuffer;
-	GLuint renderbuffer;
+	// One per frame that can be in flight, the current one is cleared, written and drawn
+	std::vector<GLuint> framebuffers;
+	std::vector<GLuint> renderbuffers;
+	unsigned int currentFramebuffer;
 
 	void initOpenGL(const std::string& _title);
 
@@ -23,14 +36,17 @@ public:
 	GLWindow(const std::string& _title, int _width, int _height);
 	~GLWindow();
 
-	bool createFramebuffer(GLuint _framebufferWidth, GLuint _framebufferHeight);
+	bool createFramebuffer(GLuint _framebufferWidth, GLuint _framebufferHeight, unsigned int _count = 1);
 	void updateFramebuffer(GLuint _framebufferWidth, GLuint _framebufferHeight);
 	void destroyFramebuffer();
 	void blitFramebuffer();
 	void clearFramebuffer(float _red, float _green, float _blue);
+	// Copies a frame rendered on the host into the framebuffer, RGBA8 with the bottom row first
+	void writeFramebuffer(const unsigned char* _pixels);
 	void clearBackbuffer(float _red,  float _green, float _blue);
 	void drawFramebuffer();
-	GLuint getRenderbuffer() const;
+	void setCurrentFramebuffer(unsigned int _index);
+	GLuint getRenderbuffer(unsigned int _index = 0) const;
 	GLuint getFramebufferWidth() const;
 	GLuint getFramebufferHeight() const;
 
@@ -42,3 +58,4 @@ public:
 	bool shouldClose() const;
 	void setWindowSize(int _width, int _height);
 };
+#endif
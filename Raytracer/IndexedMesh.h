@@ -0,0 +1,142 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+namespace IndexedMesh
+{
+	// The attributes that decide whether two corners can share a vertex
+	struct CornerKey
+	{
+		glm::vec4 position;
+		glm::vec4 texCoord;
+		glm::vec4 normal;
+		uint32_t bone;
+
+		bool operator==(const CornerKey& _other) const
+		{
+			return memcmp(this, &_other, sizeof(CornerKey)) == 0;
+		}
+	};
+
+	struct CornerKeyHash
+	{
+		size_t operator()(const CornerKey& _key) const
+		{
+			// FNV-1a over the bytes, the key has no padding
+			const unsigned char* bytes = (const unsigned char*)&_key;
+			uint32_t hash = 2166136261u;
+			for (size_t i = 0; i < sizeof(CornerKey); ++i)
+			{
+				hash = (hash ^ bytes[i]) * 16777619u;
+			}
+			return hash;
+		}
+	};
+
+	inline void addDirection(glm::vec4& _sum, const glm::vec4& _direction)
+	{
+		float length = std::sqrt(_direction.x * _direction.x + _direction.y * _direction.y + _direction.z * _direction.z);
+		// Triangles without texture area give infinite or undefined tangents, they would spread to every neighbour
+		if (length > 0.f && length <= 1e30f)
+		{
+			_sum += _direction / length;
+		}
+	}
+
+	inline void normalizeDirection(glm::vec4& _direction)
+	{
+		float length = std::sqrt(_direction.x * _direction.x + _direction.y * _direction.y + _direction.z * _direction.z);
+		if (length > 0.f)
+		{
+			_direction /= length;
+		}
+	}
+
+	// Some orthonormal tangent and bitangent for _normal, for triangles whose texture coordinates do not define one.
+	// Branchless construction by Duff et al. 2017, _normal must be unit length.
+	inline void buildTangentFrame(const glm::vec3& _normal, glm::vec3& _tangent, glm::vec3& _bitangent)
+	{
+		float sign = _normal.z >= 0.f ? 1.f : -1.f;
+		float a = -1.f / (sign + _normal.z);
+		float b = _normal.x * _normal.y * a;
+		_tangent = glm::vec3(1.f + sign * _normal.x * _normal.x * a, sign * b, -sign * _normal.x);
+		_bitangent = glm::vec3(b, sign + _normal.y * _normal.y * a, -_normal.y);
+	}
+
+	// The unit normal to build a tangent frame around: _normal, or _faceNormal if _normal is zero, or up if both are
+	inline glm::vec3 getFrameNormal(const glm::vec3& _normal, const glm::vec3& _faceNormal)
+	{
+		float length = glm::length(_normal);
+		if (length > 0.f && length <= 1e30f)
+		{
+			return _normal / length;
+		}
+
+		length = glm::length(_faceNormal);
+		if (length > 0.f && length <= 1e30f)
+		{
+			return _faceNormal / length;
+		}
+
+		return glm::vec3(0.f, 1.f, 0.f);
+	}
+
+	// Merges the corners of a triangle list, three per triangle, that have the same position, texture coordinate,
+	// normal and bone into one vertex, and writes three indices per triangle in the order of the corners. The tangents
+	// and bitangents of merged corners are averaged. Pass a null _bone for vertices without one.
+	template <typename VertexT>
+	void indexTriangles(const std::vector<VertexT>& _corners, glm::vec4 VertexT::*_texCoord, glm::vec4 VertexT::*_bitangent,
+		uint32_t VertexT::*_bone, std::vector<VertexT>& _vertices, std::vector<uint32_t>& _indices)
+	{
+		std::unordered_map<CornerKey, uint32_t, CornerKeyHash> vertexIndices;
+		vertexIndices.reserve(_corners.size());
+
+		_vertices.clear();
+		_indices.resize(_corners.size());
+		for (size_t i = 0; i < _corners.size(); ++i)
+		{
+			const VertexT& corner = _corners[i];
+
+			CornerKey key;
+			key.position = corner.position;
+			key.texCoord = corner.*_texCoord;
+			key.normal = corner.normal;
+			key.bone = _bone ? corner.*_bone : 0;
+
+			auto inserted = vertexIndices.insert(std::make_pair(key, (uint32_t)_vertices.size()));
+			if (inserted.second)
+			{
+				_vertices.push_back(corner);
+				_vertices.back().tangent = glm::vec4(0.f);
+				_vertices.back().*_bitangent = glm::vec4(0.f);
+			}
+
+			uint32_t index = inserted.first->second;
+			addDirection(_vertices[index].tangent, corner.tangent);
+			addDirection(_vertices[index].*_bitangent, corner.*_bitangent);
+			_indices[i] = index;
+		}
+
+		for (VertexT& vertex : _vertices)
+		{
+			normalizeDirection(vertex.tangent);
+			normalizeDirection(vertex.*_bitangent);
+
+			// Opposite tangents of merged corners can cancel out, the kernels would normalize the zero into NaN
+			if (vertex.tangent.x == 0.f && vertex.tangent.y == 0.f && vertex.tangent.z == 0.f)
+			{
+				glm::vec3 tangent;
+				glm::vec3 bitangent;
+				buildTangentFrame(getFrameNormal(glm::vec3(vertex.normal), glm::vec3(0.f)), tangent, bitangent);
+				vertex.tangent = glm::vec4(tangent, 0.f);
+				vertex.*_bitangent = glm::vec4(bitangent, 0.f);
+			}
+		}
+	}
+}
@@ -0,0 +1,105 @@
+#include "KernelVariants.h"
+
+#include "CLHelper.h"
+
+#include <algorithm>
+#include <iostream>
+
+KernelVariants::KernelVariants(cl::Context _context, const std::vector<cl::Device>& _devices, const std::string& _filename,
+		const std::string& _options)
+	: context(_context),
+	devices(_devices),
+	filename(_filename),
+	options(_options)
+{
+	genericProgram = createProgramFromFile(context, devices, filename, options);
+}
+
+KernelVariants::~KernelVariants()
+{
+	if (pendingBuild.valid())
+	{
+		pendingBuild.wait();
+	}
+}
+
+cl::Program KernelVariants::getGenericProgram() const
+{
+	return genericProgram;
+}
+
+cl::Program KernelVariants::getProgram(const std::string& _defines, bool& _ready)
+{
+	_ready = true;
+	if (_defines.empty())
+	{
+		return genericProgram;
+	}
+
+	if (pendingBuild.valid() && pendingBuild.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+	{
+		finishPendingBuild();
+	}
+
+	for (const Variant& variant : variants)
+	{
+		if (variant.defines == _defines)
+		{
+			return variant.program;
+		}
+	}
+
+	if (std::find(failedDefines.begin(), failedDefines.end(), _defines) != failedDefines.end())
+	{
+		return genericProgram;
+	}
+
+	// One build at a time, a variant asked for while another is being built is started once that one is done
+	if (!pendingBuild.valid())
+	{
+		cl::Context buildContext = context;
+		std::vector<cl::Device> buildDevices = devices;
+		std::string buildFilename = filename;
+		std::string buildOptions = options + " " + _defines;
+
+		pendingDefines = _defines;
+		pendingBuild = std::async(std::launch::async, [=] () mutable -> BuildResult
+		{
+			std::chrono::high_resolution_clock::duration buildTime;
+			cl::Program program = buildProgramFromFile(buildContext, buildDevices, buildFilename, buildOptions, buildTime);
+			return std::make_pair(program, buildTime);
+		});
+	}
+
+	_ready = false;
+	return genericProgram;
+}
+
+void KernelVariants::finishPendingBuild()
+{
+	try
+	{
+		BuildResult result = pendingBuild.get();
+
+		// Programs handed out before stay valid, they hold a reference of their own
+		if (variants.size() == MAX_VARIANTS)
+		{
+			variants.erase(variants.begin());
+		}
+
+		Variant variant;
+		variant.defines = pendingDefines;
+		variant.program = result.first;
+		variants.push_back(variant);
+
+		std::cout << "Built " << filename << " with " << pendingDefines << " in "
+			<< std::chrono::duration_cast<std::chrono::milliseconds>(result.second).count() << " ms" << std::endl;
+	}
+	catch (const std::exception& e)
+	{
+		failedDefines.push_back(pendingDefines);
+
+		std::cout << "Failed to build " << filename << " with " << pendingDefines << ", using the generic program: "
+			<< e.what() << std::endl;
+	}
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#define __CL_ENABLE_EXCEPTIONS
+#define CL_GL_INTEROP
+#include "CL/cl.hpp"
+
+#include <chrono>
+#include <future>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Builds a program again with -D defines that turn run time settings into constants, so the compiler can unroll the
+// loops over them and drop the paths that are not taken. Variants are built one at a time on a background thread, the
+// generic program stands in until the one asked for is ready. Only the MAX_VARIANTS most recently built are kept.
+class KernelVariants
+{
+public:
+	static const unsigned int MAX_VARIANTS = 8;
+
+private:
+	struct Variant
+	{
+		std::string defines;
+		cl::Program program;
+	};
+
+	typedef std::pair<cl::Program, std::chrono::high_resolution_clock::duration> BuildResult;
+
+	cl::Context context;
+	std::vector<cl::Device> devices;
+	std::string filename;
+	std::string options;
+
+	cl::Program genericProgram;
+	std::vector<Variant> variants;
+	std::vector<std::string> failedDefines;
+
+	std::string pendingDefines;
+	std::future<BuildResult> pendingBuild;
+
+public:
+	// Builds the generic program before returning, _options are passed to every variant as well
+	KernelVariants(cl::Context _context, const std::vector<cl::Device>& _devices, const std::string& _filename,
+		const std::string& _options);
+	// Waits for the variant that is being built, if any
+	~KernelVariants();
+
+	cl::Program getGenericProgram() const;
+	// Returns the program built with _defines, or the generic program until it is ready. _ready is false while the
+	// variant is still to be built. Variants that fail to build are reported once and replaced by the generic program.
+	cl::Program getProgram(const std::string& _defines, bool& _ready);
+
+private:
+	void finishPendingBuild();
+};
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Read only view of a whole file mapped into memory. The pages are loaded by the OS on first access.
+class MappedFile
+{
+private:
+	const char* data;
+	size_t size;
+#ifdef _WIN32
+	void* file;
+	void* mapping;
+#else
+	int file;
+#endif
+
+public:
+	MappedFile();
+	~MappedFile();
+
+	// Fails if the file is missing or empty
+	bool open(const std::string& _path);
+	void close();
+
+	bool isOpen() const;
+	const char* getData() const;
+	size_t getSize() const;
+
+private:
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+};
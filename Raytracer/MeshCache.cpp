@@ -0,0 +1,203 @@
+#include "MeshCache.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <sys/stat.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <thread>
+
+static const char MAGIC[4] = {'R', 'T', 'M', 'C'};
+
+// A name no other thread or process writes to at the same time
+static std::string getTemporaryPath(const std::string& _path)
+{
+#ifdef _WIN32
+	unsigned long processId = GetCurrentProcessId();
+#else
+	unsigned long processId = (unsigned long)getpid();
+#endif
+	size_t threadId = std::hash<std::thread::id>()(std::this_thread::get_id());
+
+	return _path + ".tmp" + std::to_string(processId) + "-" + std::to_string(threadId);
+}
+
+// Replaces _to with _from in one step, so a reader never maps a half written file
+static bool replaceFile(const std::string& _from, const std::string& _to)
+{
+#ifdef _WIN32
+	return MoveFileExA(_from.c_str(), _to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	return std::rename(_from.c_str(), _to.c_str()) == 0;
+#endif
+}
+
+MeshCache::MeshCache()
+	: header(nullptr)
+{
+}
+
+bool MeshCache::open(const std::string& _sourcePath)
+{
+	header = nullptr;
+
+	uint64_t sourceSize;
+	int64_t sourceTime;
+	if (!getSourceStamp(_sourcePath, sourceSize, sourceTime))
+	{
+		return false;
+	}
+
+	if (!file.open(getCachePath(_sourcePath)) || file.getSize() < sizeof(Header))
+	{
+		file.close();
+		return false;
+	}
+
+	const Header* fileHeader = (const Header*)file.getData();
+	if (memcmp(fileHeader->magic, MAGIC, sizeof(MAGIC)) != 0 ||
+		fileHeader->version != VERSION ||
+		fileHeader->vertexSize != sizeof(Vertex) ||
+		fileHeader->nodeSize != sizeof(Bvh::Node) ||
+		fileHeader->sourceSize != sourceSize ||
+		fileHeader->sourceTime != sourceTime ||
+		fileHeader->vertexCount == 0 ||
+		fileHeader->nodeCount == 0 ||
+		fileHeader->indexCount == 0)
+	{
+		file.close();
+		return false;
+	}
+
+	// A write that was interrupted leaves a file that is too short
+	uint64_t expectedSize = sizeof(Header) +
+		(uint64_t)fileHeader->vertexCount * sizeof(Vertex) +
+		(uint64_t)fileHeader->nodeCount * sizeof(Bvh::Node) +
+		(uint64_t)fileHeader->indexCount * sizeof(uint32_t);
+	if (file.getSize() != expectedSize)
+	{
+		file.close();
+		return false;
+	}
+
+	header = fileHeader;
+	return true;
+}
+
+void MeshCache::close()
+{
+	file.close();
+	header = nullptr;
+}
+
+bool MeshCache::isOpen() const
+{
+	return header != nullptr;
+}
+
+const Vertex* MeshCache::getVertices() const
+{
+	return (const Vertex*)(file.getData() + sizeof(Header));
+}
+
+unsigned int MeshCache::getVertexCount() const
+{
+	return header->vertexCount;
+}
+
+const Bvh::Node* MeshCache::getNodes() const
+{
+	return (const Bvh::Node*)(file.getData() + sizeof(Header) + sizeof(Vertex) * header->vertexCount);
+}
+
+unsigned int MeshCache::getNodeCount() const
+{
+	return header->nodeCount;
+}
+
+const uint32_t* MeshCache::getIndices() const
+{
+	return (const uint32_t*)(getNodes() + header->nodeCount);
+}
+
+unsigned int MeshCache::getIndexCount() const
+{
+	return header->indexCount;
+}
+
+bool MeshCache::write(const std::string& _sourcePath, const std::vector<Vertex>& _vertices, const std::vector<uint32_t>& _indices,
+	const std::vector<Bvh::Node>& _nodes)
+{
+	Header fileHeader;
+	memset(&fileHeader, 0, sizeof(fileHeader));
+	memcpy(fileHeader.magic, MAGIC, sizeof(MAGIC));
+	fileHeader.version = VERSION;
+	fileHeader.vertexSize = sizeof(Vertex);
+	fileHeader.nodeSize = sizeof(Bvh::Node);
+	fileHeader.vertexCount = _vertices.size();
+	fileHeader.nodeCount = _nodes.size();
+	fileHeader.indexCount = _indices.size();
+	if (!getSourceStamp(_sourcePath, fileHeader.sourceSize, fileHeader.sourceTime))
+	{
+		return false;
+	}
+
+	// Written next to the cache and renamed over it once complete, two loads of the same model may write at once
+	std::string cachePath = getCachePath(_sourcePath);
+	std::string temporaryPath = getTemporaryPath(cachePath);
+	{
+		std::ofstream out(temporaryPath, std::ios::binary | std::ios::trunc);
+		if (!out)
+		{
+			return false;
+		}
+
+		out.write((const char*)&fileHeader, sizeof(fileHeader));
+		out.write((const char*)_vertices.data(), sizeof(Vertex) * _vertices.size());
+		out.write((const char*)_nodes.data(), sizeof(Bvh::Node) * _nodes.size());
+		out.write((const char*)_indices.data(), sizeof(uint32_t) * _indices.size());
+		out.close();
+
+		if (!out.good())
+		{
+			std::remove(temporaryPath.c_str());
+			return false;
+		}
+	}
+
+	// Fails on Windows while another process has the old cache mapped, it is then written again next time
+	if (!replaceFile(temporaryPath, cachePath))
+	{
+		std::remove(temporaryPath.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+std::string MeshCache::getCachePath(const std::string& _sourcePath)
+{
+	return _sourcePath + ".cache";
+}
+
+bool MeshCache::getSourceStamp(const std::string& _sourcePath, uint64_t& _size, int64_t& _time)
+{
+	struct stat sourceStat;
+	if (stat(_sourcePath.c_str(), &sourceStat) != 0)
+	{
+		return false;
+	}
+
+	_size = (uint64_t)sourceStat.st_size;
+	_time = (int64_t)sourceStat.st_mtime;
+	return true;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "Bvh.h"
+#include "MappedFile.h"
+#include "Vertex.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Binary cache of a loaded model, stored next to the source file with ".cache" appended. It holds the final
+// vertices, the indices of the triangles in BVH leaf order and the BVH nodes, so a cached model is loaded by
+// mapping the file.
+class MeshCache
+{
+private:
+	// Sized to a multiple of 16 bytes to keep the arrays after it aligned
+	struct Header
+	{
+		char magic[4];
+		uint32_t version;
+		uint32_t vertexSize;
+		uint32_t nodeSize;
+		uint64_t sourceSize;
+		int64_t sourceTime;
+		uint32_t vertexCount;
+		uint32_t nodeCount;
+		uint32_t indexCount;
+		uint32_t padding;
+	};
+
+	MappedFile file;
+	const Header* header;
+
+public:
+	// Increase whenever the layout of the file, Vertex, Bvh::Node or the way they are built changes
+	static const uint32_t VERSION = 4;
+
+	MeshCache();
+
+	// Maps the cache of _sourcePath. Fails if it is missing, from another version or older than the source.
+	bool open(const std::string& _sourcePath);
+	void close();
+	bool isOpen() const;
+
+	const Vertex* getVertices() const;
+	unsigned int getVertexCount() const;
+	const Bvh::Node* getNodes() const;
+	unsigned int getNodeCount() const;
+	const uint32_t* getIndices() const;
+	unsigned int getIndexCount() const;
+
+	static bool write(const std::string& _sourcePath, const std::vector<Vertex>& _vertices, const std::vector<uint32_t>& _indices,
+		const std::vector<Bvh::Node>& _nodes);
+
+private:
+	static std::string getCachePath(const std::string& _sourcePath);
+	static bool getSourceStamp(const std::string& _sourcePath, uint64_t& _size, int64_t& _time);
+};
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+// Mip chains are stored in a single image, since OpenCL 1.1 has no mipmapped images. The base level is at the origin
+// and the smaller levels are stacked on top of each other to its right:
+//
+//   +--------+----+
+//   |        | 2  |
+//   |   0    +----+
+//   |        | 1  |
+//   +--------+----+
+//
+// The chain stops when the smaller side reaches one texel, so every level is exactly half the size of the one before.
+namespace MipChain
+{
+	inline int getLevelCount(int _width, int _height)
+	{
+		int levels = 1;
+		while ((std::min(_width, _height) >> levels) > 0)
+		{
+			++levels;
+		}
+		return levels;
+	}
+
+	inline void getLevelOffset(int _width, int _height, int _level, int& _x, int& _y)
+	{
+		_x = _level == 0 ? 0 : _width;
+		_y = 0;
+		for (int i = 1; i < _level; ++i)
+		{
+			_y += _height >> i;
+		}
+	}
+
+	inline void getImageSize(int _width, int _height, int& _imageWidth, int& _imageHeight)
+	{
+		_imageWidth = getLevelCount(_width, _height) > 1 ? _width + (_width >> 1) : _width;
+		_imageHeight = _height;
+	}
+
+	// Builds the whole chain from the base level with a box filter. _texels has _channels interleaved values per texel,
+	// the parts of _image outside the levels are left as zero.
+	template <typename T>
+	void build(const T* _texels, int _width, int _height, int _channels, std::vector<T>& _image)
+	{
+		int imageWidth;
+		int imageHeight;
+		getImageSize(_width, _height, imageWidth, imageHeight);
+		_image.assign(imageWidth * imageHeight * _channels, T());
+
+		for (int y = 0; y < _height; ++y)
+		{
+			std::copy(_texels + y * _width * _channels, _texels + (y + 1) * _width * _channels, &_image[y * imageWidth * _channels]);
+		}
+
+		int levels = getLevelCount(_width, _height);
+		for (int level = 1; level < levels; ++level)
+		{
+			int srcX, srcY, dstX, dstY;
+			getLevelOffset(_width, _height, level - 1, srcX, srcY);
+			getLevelOffset(_width, _height, level, dstX, dstY);
+
+			for (int y = 0; y < _height >> level; ++y)
+			{
+				for (int x = 0; x < _width >> level; ++x)
+				{
+					for (int c = 0; c < _channels; ++c)
+					{
+						const T* src = &_image[((srcY + y * 2) * imageWidth + srcX + x * 2) * _channels + c];
+						float sum = (float)src[0] + (float)src[_channels] + (float)src[imageWidth * _channels] + (float)src[(imageWidth + 1) * _channels];
+
+						// Rounds to nearest for integer texels, exact for float texels
+						_image[((dstY + y) * imageWidth + dstX + x) * _channels + c] = (T)(sum * 0.25f + (0.5f - (float)(T)0.5f));
+					}
+				}
+			}
+		}
+	}
+}
@@ -3,14 +3,19 @@
 #include "CachedTransform.h"
 #include "ModelData.h"
 #include "Skeleton.h"
+#include "Texture.h"
 
 class Model
 {
 public:
 	ModelData::ptr data;
-	cl::Buffer transformedVertices;
-	cl::Image2D diffuseMap;
-	cl::Image2D normalMap;
+	int vertexOffset;	// Offsets into the combined buffers of the Scene
+	int triangleOffset;
+	int nodeOffset;
+	int diffuseMap;	// Indices into the texture atlas, see TextureManager::buildAtlas
+	int normalMap;
+	Texture::c_ptr hostDiffuseMap;	// Only loaded for the CPU renderer
+	Texture::c_ptr hostNormalMap;
 };
 
 class ModelInstance
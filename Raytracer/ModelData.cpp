@@ -1,8 +1,13 @@
 #include "ModelData.h"
 
-ModelData::ModelData(cl::Buffer _vertexBuffer, int _vertexCount)
+#include "SkinnedBvh.h"
+
+ModelData::ModelData(cl::Buffer _vertexBuffer, int _vertexCount, cl::Buffer _indexBuffer, int _triangleCount)
 	: vertexCount(_vertexCount),
+	triangleCount(_triangleCount),
 	vertexBuffer(_vertexBuffer),
+	indexBuffer(_indexBuffer),
+	bvhNodeCount(0),
 	_isAnimated(false)
 {
 }
@@ -22,11 +27,97 @@ int ModelData::getVertexCount() const
 	return vertexCount;
 }
 
+int ModelData::getTriangleCount() const
+{
+	return triangleCount;
+}
+
 cl::Buffer ModelData::getVertexBuffer() const
 {
 	return vertexBuffer;
 }
 
+cl::Buffer ModelData::getIndexBuffer() const
+{
+	return indexBuffer;
+}
+
+const std::vector<Vertex>& ModelData::getVertices() const
+{
+	return vertices;
+}
+
+const std::vector<uint32_t>& ModelData::getIndices() const
+{
+	return indices;
+}
+
+void ModelData::setVertices(const std::vector<Vertex>& _vertices, const std::vector<uint32_t>& _indices)
+{
+	vertices = _vertices;
+	indices = _indices;
+}
+
+cl::Buffer ModelData::getBvhBuffer() const
+{
+	return bvhBuffer;
+}
+
+int ModelData::getBvhNodeCount() const
+{
+	return bvhNodeCount;
+}
+
+int ModelData::getBvhNodeCapacity() const
+{
+	if (skinnedBvh)
+	{
+		return skinnedBvh->getNodeCapacity();
+	}
+
+	return bvhNodeCount;
+}
+
+const glm::vec4& ModelData::getBoundsMin() const
+{
+	return boundsMin;
+}
+
+const glm::vec4& ModelData::getBoundsMax() const
+{
+	return boundsMax;
+}
+
+void ModelData::setBounds(const glm::vec4& _min, const glm::vec4& _max)
+{
+	boundsMin = _min;
+	boundsMax = _max;
+}
+
+void ModelData::setBvh(const Bvh& _bvh, cl::Buffer _bvhBuffer)
+{
+	bvhBuffer = _bvhBuffer;
+	bvh = _bvh;
+	bvhNodeCount = _bvh.getNodes().size();
+	boundsMin = _bvh.getNodes()[0].min;
+	boundsMax = _bvh.getNodes()[0].max;
+}
+
+const Bvh& ModelData::getBvh() const
+{
+	return bvh;
+}
+
+std::shared_ptr<SkinnedBvh> ModelData::getSkinnedBvh() const
+{
+	return skinnedBvh;
+}
+
+void ModelData::setSkinnedBvh(std::shared_ptr<SkinnedBvh> _skinnedBvh)
+{
+	skinnedBvh = _skinnedBvh;
+}
+
 Pose::c_ptr ModelData::getBindPose() const
 {
 	return bindPose;
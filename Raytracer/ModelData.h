@@ -1,12 +1,17 @@
 #pragma once
 
 #include "Bone.h"
+#include "Bvh.h"
 #include "Pose.h"
+#include "Vertex.h"
 
 #include "CL/cl.hpp"
 
+#include <cstdint>
 #include <memory>
 
+class SkinnedBvh;
+
 class ModelData
 {
 public:
@@ -15,17 +20,48 @@ public:
 private:
 	bool _isAnimated;
 	int vertexCount;
+	int triangleCount;
 	cl::Buffer vertexBuffer;
+	cl::Buffer indexBuffer;
+	cl::Buffer bvhBuffer;
+	int bvhNodeCount;
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	Bvh bvh;
+	glm::vec4 boundsMin;
+	glm::vec4 boundsMax;
+	std::shared_ptr<SkinnedBvh> skinnedBvh;
 	Pose::c_ptr bindPose;
 
 public:
-	ModelData(cl::Buffer _vertexBuffer, int _vertexCount);
+	// _indexBuffer holds three vertex indices per triangle
+	ModelData(cl::Buffer _vertexBuffer, int _vertexCount, cl::Buffer _indexBuffer, int _triangleCount);
 
 	bool isAnimated() const;
 	void isAnimated(bool _val);
 
 	int getVertexCount() const;
+	int getTriangleCount() const;
 	cl::Buffer getVertexBuffer() const;
+	cl::Buffer getIndexBuffer() const;
+	// Host copy of the vertices and indices of a rigid model, for renderers that do not use the buffers.
+	// The vertices of an animated model are kept by its SkinnedBvh.
+	const std::vector<Vertex>& getVertices() const;
+	const std::vector<uint32_t>& getIndices() const;
+	void setVertices(const std::vector<Vertex>& _vertices, const std::vector<uint32_t>& _indices);
+
+	cl::Buffer getBvhBuffer() const;
+	int getBvhNodeCount() const;
+	// Number of nodes to reserve for the hierarchy, a skinned hierarchy may grow when rebuilt
+	int getBvhNodeCapacity() const;
+	const glm::vec4& getBoundsMin() const;
+	const glm::vec4& getBoundsMax() const;
+	void setBounds(const glm::vec4& _min, const glm::vec4& _max);
+	void setBvh(const Bvh& _bvh, cl::Buffer _bvhBuffer);
+	const Bvh& getBvh() const;
+
+	std::shared_ptr<SkinnedBvh> getSkinnedBvh() const;
+	void setSkinnedBvh(std::shared_ptr<SkinnedBvh> _skinnedBvh);
 
 	Pose::c_ptr getBindPose() const;
 	void setBindPose(const std::vector<Bone>& _bones);
@@ -1,6 +1,9 @@
 #include "ObjModel.h"
-#include <fstream>
-using std::ifstream;
+
+#include "IndexedMesh.h"
+#include "ObjParser.h"
+
+#include <iostream>
 
 
 ObjModel::ObjModel(void)
@@ -15,10 +18,10 @@ ObjModel::~ObjModel(void)
 {
 }
 
-//int ObjModel::GetIndexCount(void)
-//{
-//	return mIndexCount;
-//}
+int ObjModel::GetIndexCount(void)
+{
+	return mIndexCount;
+}
 
 int ObjModel::GetVertexCount(void)
 {
@@ -49,16 +52,14 @@ bool ObjModel::Initialize(cl::Context &context, const char *modelFilename/*,
 {
 	bool tResult;
 
-	tResult = LoadFile(modelFilename);
+	tResult = Load(modelFilename);
 	if(!tResult)
 	{
 		return false;
 	}
 
-	CalculateModelVectors();
-
 	//Calling initialization functions for vertex and index buffers
-	tResult = InitializeBuffers(context);
+	tResult = InitializeBuffers(context, false);
 	if(!tResult)
 	{
 		return false;
@@ -73,6 +74,36 @@ bool ObjModel::Initialize(cl::Context &context, const char *modelFilename/*,
 	return true;
 }
 
+bool ObjModel::Load(const char *modelFilename)
+{
+	bool tResult;
+
+	if(mCache.open(modelFilename))
+	{
+		mVertexCount = mCache.getVertexCount();
+		mIndexCount = mCache.getIndexCount();
+		mVertices.clear();
+		mIndices.clear();
+		mBvh.setNodes(mCache.getNodes(), mCache.getNodeCount());
+		return true;
+	}
+
+	tResult = LoadFile(modelFilename);
+	if(!tResult)
+	{
+		return false;
+	}
+
+	CalculateModelVectors();
+	BuildBvh();
+	InitializeVertices();
+
+	//A cache that could not be written only means the file is parsed again next time
+	MeshCache::write(modelFilename, mVertices, mIndices, mBvh.getNodes());
+
+	return true;
+}
+
 void ObjModel::Shutdown(void)
 {
 	//ReleaseTextures();
@@ -85,13 +116,49 @@ cl::Buffer ObjModel::getBuffer()
 	return mVertexBuffer;
 }
 
-bool ObjModel::InitializeBuffers(cl::Context &context)
+cl::Buffer ObjModel::getIndexBuffer()
+{
+	return mIndexBuffer;
+}
+
+cl::Buffer ObjModel::getBvhBuffer()
+{
+	return mBvhBuffer;
+}
+
+const Bvh& ObjModel::getBvh() const
 {
-	vector<Vertex>	tVertices;
-	tVertices.resize(mVertexCount);
+	return mBvh;
+}
+
+const vector<Vertex>& ObjModel::getVertices() const
+{
+	return mVertices;
+}
+
+const vector<uint32_t>& ObjModel::getIndices() const
+{
+	return mIndices;
+}
+
+void ObjModel::BuildBvh(void)
+{
+	vector<glm::vec3> tPositions(mIndexCount);
+	for(int i = 0; i < mIndexCount; i++)
+	{
+		tPositions[i] = glm::vec3(mModel[i].x, mModel[i].y, mModel[i].z);
+	}
+
+	mBvh.build(tPositions);
+	mBvh.reorderTriangles(mModel);
+}
+
+void ObjModel::InitializeVertices(void)
+{
+	vector<Vertex> tVertices(mIndexCount);
 
 	//Load the vertex array and index array with data.
-	for(int i = 0; i < mVertexCount; i++)
+	for(int i = 0; i < mIndexCount; i++)
 	{
 		tVertices[i].position = glm::vec4(mModel[i].x, mModel[i].y, mModel[i].z, 1.f);
 		tVertices[i].texture = glm::vec4(mModel[i].tu, mModel[i].tv, 0.f, 0.f);
@@ -100,14 +167,46 @@ bool ObjModel::InitializeBuffers(cl::Context &context)
 		tVertices[i].binormal = glm::vec4(mModel[i].bx, mModel[i].by, mModel[i].bz, 0.f);
 	}
 
-	mVertexBuffer = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(Vertex) * mVertexCount, tVertices.data());
-	
+	//Corners shared between triangles become one vertex
+	IndexedMesh::indexTriangles(tVertices, &Vertex::texture, &Vertex::binormal, (uint32_t Vertex::*)nullptr, mVertices, mIndices);
+	mVertexCount = mVertices.size();
+}
+
+bool ObjModel::InitializeBuffers(cl::Context &context, bool keepHostCopy)
+{
+	//Only a consumer on the host, such as the CPU renderer, needs a copy out of the mapped file
+	if (keepHostCopy && mCache.isOpen())
+	{
+		mVertices.assign(mCache.getVertices(), mCache.getVertices() + mVertexCount);
+		mIndices.assign(mCache.getIndices(), mCache.getIndices() + mIndexCount);
+	}
+
+	if (context() != nullptr)
+	{
+		//Upload straight from the mapped pages when the model came from its cache
+		const Vertex* tVertices = mCache.isOpen() ? mCache.getVertices() : mVertices.data();
+		const uint32_t* tIndices = mCache.isOpen() ? mCache.getIndices() : mIndices.data();
+		mVertexBuffer = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(Vertex) * mVertexCount, (void*)tVertices);
+		mIndexBuffer = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(uint32_t) * mIndexCount, (void*)tIndices);
+		mBvhBuffer = mBvh.createBuffer(context);
+	}
+
+	mCache.close();
+
+	if (!keepHostCopy)
+	{
+		vector<Vertex>().swap(mVertices);
+		vector<uint32_t>().swap(mIndices);
+	}
+
 	return true;
 }
 
 void ObjModel::ShutdownBuffers(void) 
 {
 	mVertexBuffer = cl::Buffer();
+	mIndexBuffer = cl::Buffer();
+	mBvhBuffer = cl::Buffer();
 }
 
 /*bool ObjModel::LoadTextures(ID3D11Device *d3DDevice, WCHAR *filename1,
@@ -136,254 +235,49 @@ void ObjModel::ShutdownBuffers(void)
 //}
 
 bool ObjModel::LoadFile(const char *filename)
-{	
-	bool tResult;
-	int tVertexCount;
-	int tTextureCount;
-	int tNormalCount;
-	int tFaceCount;
-	int tGroupCount;
-
-	tResult = ReadFileCounts(filename, tVertexCount, tTextureCount,
-		tNormalCount, tFaceCount, tGroupCount);
-	if(!tResult)
-	{
-		return false;
-	}
-
-	mVertexCount = (tFaceCount * 3);
-	//mIndexCount = (tFaceCount * 3);
-	tResult = LoadDataStructures(filename, tVertexCount, tTextureCount,
-		tNormalCount, tFaceCount);
-	if(!tResult)
-	{
-		return false;
-	}
-
-	return true;
-}
-
-bool ObjModel::ReadFileCounts(const char *filename, int &vertexCount,
-	int &textureCount, int &normalCount, int &faceCount, int &groupCount)
-{	
-	ifstream tFileIn;
-	char tInput;
-	vertexCount = 0;
-	textureCount = 0;
-	normalCount = 0;
-	faceCount = 0;
-
-	tFileIn.open(filename);
-	if(tFileIn.fail() == true)
-	{
-		return false;
-	}
-
-	tFileIn.get(tInput);
-	while(!tFileIn.eof())
-	{
-		if(tInput == 'v')
-		{
-			tFileIn.get(tInput);
-			if(tInput == ' ') 
-			{
-				vertexCount++;
-			}
-
-			if(tInput == 't')
-			{
-				textureCount++;
-			}
-
-			if(tInput == 'n')
-			{
-				normalCount++;
-			}
-		}
-
-		if(tInput == 'g')
-		{
-			groupCount++;
-		}
-
-		if(tInput == 'f')
-		{
-			faceCount++;
-		}
-
-		while(tInput != '\n')
-		{
-			tFileIn.get(tInput);
-		}
-
-		tFileIn.get(tInput);
-	}
-	tFileIn.close();
-
-	return true;
-}
-
-bool ObjModel::LoadDataStructures(const char *filename, int &vertexCount,
-	int &textureCount, int &normalCount, int &faceCount)
 {
-	vector<ReadVertexType> tVertices;
-	vector<ReadVertexType> tTexCoords;
-	vector<ReadVertexType> tNormals;
-	vector<FaceType> tFaces;
-	ifstream tFileIn;
-	int tVertexIndex;
-	int tTexcoordIndex;
-	int tNormalIndex;
-	int tFaceIndex;
-	int vIndex;
-	int tIndex;
-	int nIndex;
-	char tInput1;
-	char tInput2;
-	
-	tVertexIndex = 0;
-	tTexcoordIndex = 0;
-	tNormalIndex = 0;
-	tFaceIndex = 0;
-
-	tFileIn.open(filename);
-	if(tFileIn.fail() == true)
+	ObjParser::Data tData;
+	std::string tError;
+	if(!ObjParser::parseFile(filename, tData, tError))
 	{
+		std::cout << tError << std::endl;
 		return false;
 	}
 
-	mModel.resize(faceCount * 3);
-
-	//Initialize the four data structures.
-	tVertices.resize(vertexCount);
-	tTexCoords.resize(textureCount);
-	tNormals.resize(normalCount);
-	tFaces.resize(faceCount);
+	mIndexCount = tData.corners.size();
+	mModel.resize(mIndexCount);
 
-	tFileIn.get(tInput1);
-	while(!tFileIn.eof())
+	for(int i = 0; i < mIndexCount; i += 3)
 	{
-		tFileIn.get(tInput1);
-		if(tInput1 == 'v')
-		{
-			tFileIn.get(tInput1);
-
-			//Read in the vertices.
-			if(tInput1 == ' ') 
-			{ 
-				tFileIn >> tVertices[tVertexIndex].x;
-				tFileIn >> tVertices[tVertexIndex].y;
-				tFileIn >> tVertices[tVertexIndex].z;
-
-				//Invert the Z vertex to change to left hand system.
-				//tVertices[tVertexIndex].z = tVertices[tVertexIndex].z * -1.0f;
-				tVertexIndex++; 
-			}
-
-			//Read in the texture uv coordinates.
-			if(tInput1 == 't') 
-			{ 
-				tFileIn >> tTexCoords[tTexcoordIndex].x;
-				tFileIn >> tTexCoords[tTexcoordIndex].y;
-
-				//Invert the V texture coordinates to left hand system.
-				//tTexCoords[tTexcoordIndex].y = 1.0f - tTexCoords[tTexcoordIndex].y;
-				tTexcoordIndex++; 
-			}
-
-			//Read in the normals.
-			if(tInput1 == 'n') 
-			{ 
-				tFileIn >> tNormals[tNormalIndex].x;
-				tFileIn >> tNormals[tNormalIndex].y;
-				tFileIn >> tNormals[tNormalIndex].z;
-
-				//Invert the Z normal to change to left hand system.
-				//tNormals[tNormalIndex].z = tNormals[tNormalIndex].z * -1.0f;
-				tNormalIndex++; 
-			}
-		}
+		const ObjParser::Corner *tCorners = &tData.corners[i];
 
-		//Read in the faces.
-		if(tInput1 == 'f') 
+		//Faces without normals get the normal of the triangle
+		glm::vec3 tFaceNormal;
+		if(tCorners[0].normal == -1 || tCorners[1].normal == -1 || tCorners[2].normal == -1)
 		{
-			tFileIn.get(tInput1);
-			if(tInput1 == ' ')
-			{
-				//Read the face data in backwards to convert it to a left hand
-				//system from right hand system.
-				tFileIn >> tFaces[tFaceIndex].vIndex1 >> tInput2 >>
-					tFaces[tFaceIndex].tIndex1 >> tInput2 >>
-					tFaces[tFaceIndex].nIndex1 >> tFaces[tFaceIndex].vIndex2 >>
-					tInput2 >> tFaces[tFaceIndex].tIndex2 >> tInput2 >>
-					tFaces[tFaceIndex].nIndex2 >> tFaces[tFaceIndex].vIndex3 >>
-					tInput2 >> tFaces[tFaceIndex].tIndex3 >> tInput2 >>
-					tFaces[tFaceIndex].nIndex3;
-				tFaceIndex++;
-			}
+			const glm::vec3 &tV0 = tData.positions[tCorners[0].position];
+			tFaceNormal = glm::normalize(glm::cross(tData.positions[tCorners[1].position] - tV0,
+				tData.positions[tCorners[2].position] - tV0));
 		}
-	}
-	tFileIn.close();
-
-	int i = 0;
-	int j = 0;
-	bool done = false;
-	while(!done)
-	{		
-		vIndex = tFaces[i].vIndex1 - 1;
-		tIndex = tFaces[i].tIndex1 - 1;
-		nIndex = tFaces[i].nIndex1 - 1;
-
-		mModel[j].x = tVertices[vIndex].x;
-		mModel[j].y = tVertices[vIndex].y;
-		mModel[j].z = tVertices[vIndex].z;
-		mModel[j].tu = tTexCoords[tIndex].x;
-		mModel[j].tv = tTexCoords[tIndex].y;
-		mModel[j].nx = tNormals[nIndex].x;
-		mModel[j].ny = tNormals[nIndex].y;
-		mModel[j].nz = tNormals[nIndex].z;
-		j++;
-
-		vIndex = tFaces[i].vIndex2 - 1;
-		tIndex = tFaces[i].tIndex2 - 1;
-		nIndex = tFaces[i].nIndex2 - 1;
-
-		mModel[j].x = tVertices[vIndex].x;
-		mModel[j].y = tVertices[vIndex].y;
-		mModel[j].z = tVertices[vIndex].z;
-		mModel[j].tu = tTexCoords[tIndex].x;
-		mModel[j].tv = tTexCoords[tIndex].y;
-		mModel[j].nx = tNormals[nIndex].x;
-		mModel[j].ny = tNormals[nIndex].y;
-		mModel[j].nz = tNormals[nIndex].z;
-		j++;
-
-		vIndex = tFaces[i].vIndex3 - 1;
-		tIndex = tFaces[i].tIndex3 - 1;
-		nIndex = tFaces[i].nIndex3 - 1;
-
-		mModel[j].x = tVertices[vIndex].x;
-		mModel[j].y = tVertices[vIndex].y;
-		mModel[j].z = tVertices[vIndex].z;
-		mModel[j].tu = tTexCoords[tIndex].x;
-		mModel[j].tv = tTexCoords[tIndex].y;
-		mModel[j].nx = tNormals[nIndex].x;
-		mModel[j].ny = tNormals[nIndex].y;
-		mModel[j].nz = tNormals[nIndex].z;
-		j++;
-
-		i++;
-		if((i == tFaceIndex) || (j == mVertexCount))
+
+		for(int j = 0; j < 3; j++)
 		{
-			done = true;
+			const ObjParser::Corner &tCorner = tCorners[j];
+			const glm::vec3 &tPosition = tData.positions[tCorner.position];
+			glm::vec2 tTexCoord = tCorner.texCoord != -1 ? tData.texCoords[tCorner.texCoord] : glm::vec2(0.f);
+			glm::vec3 tNormal = tCorner.normal != -1 ? tData.normals[tCorner.normal] : tFaceNormal;
+
+			mModel[i + j].x = tPosition.x;
+			mModel[i + j].y = tPosition.y;
+			mModel[i + j].z = tPosition.z;
+			mModel[i + j].tu = tTexCoord.x;
+			mModel[i + j].tv = tTexCoord.y;
+			mModel[i + j].nx = tNormal.x;
+			mModel[i + j].ny = tNormal.y;
+			mModel[i + j].nz = tNormal.z;
 		}
 	}
 
-	/*SAFE_DELETE_ARRAY(tVertices);
-	SAFE_DELETE_ARRAY(tTexCoords);
-	SAFE_DELETE_ARRAY(tNormals);
-	SAFE_DELETE_ARRAY(tFaces);*/
-
 	return true;
 }
 
@@ -402,7 +296,7 @@ void ObjModel::CalculateModelVectors(void)
 	VectorType tTangent;
 	VectorType tBinormal;
 
-	tFaceCount = mVertexCount / 3;
+	tFaceCount = mIndexCount / 3;
 	tIndex = 0;
 	for(int i = 0; i < tFaceCount; i++)
 	{
@@ -487,7 +381,15 @@ void ObjModel::CalculateTangentBinormal(TempVertexType vertex1,
 	tuVector[1] = vertex3.tu - vertex1.tu;
 	tvVector[1] = vertex3.tv - vertex1.tv;
 
-	den = 1.0f / (tuVector[0] * tvVector[1] - tuVector[1] * tvVector[0]);
+	//Faces without texture coordinates get (0, 0) on every corner, which leaves no direction for the tangent
+	float tDeterminant = tuVector[0] * tvVector[1] - tuVector[1] * tvVector[0];
+	if(tDeterminant == 0.f)
+	{
+		BuildFallbackTangentBinormal(vertex1, vertex2, vertex3, tangent, binormal);
+		return;
+	}
+
+	den = 1.0f / tDeterminant;
 
 	tangent.x = (tvVector[1] * tVector1[0] - tvVector[0] * tVector2[0]) * den;
 	tangent.y = (tvVector[1] * tVector1[1] - tvVector[0] * tVector2[1]) * den;
@@ -500,7 +402,37 @@ void ObjModel::CalculateTangentBinormal(TempVertexType vertex1,
 	tLength = sqrt((tangent.x * tangent.x) + (tangent.y * tangent.y) +
 		(tangent.z * tangent.z));
 
+	//Nearly degenerate texture coordinates overflow, and a triangle without area has no tangent either
+	if(!(tLength > 0.f && tLength <= 1e30f))
+	{
+		BuildFallbackTangentBinormal(vertex1, vertex2, vertex3, tangent, binormal);
+		return;
+	}
+
 	binormal.x = binormal.x / tLength;
 	binormal.y = binormal.y / tLength;
 	binormal.z = binormal.z / tLength;
+}
+
+void ObjModel::BuildFallbackTangentBinormal(const TempVertexType &vertex1,
+	const TempVertexType &vertex2, const TempVertexType &vertex3, VectorType &tangent,
+	VectorType &binormal)
+{
+	glm::vec3 tPosition1(vertex1.x, vertex1.y, vertex1.z);
+	glm::vec3 tPosition2(vertex2.x, vertex2.y, vertex2.z);
+	glm::vec3 tPosition3(vertex3.x, vertex3.y, vertex3.z);
+	glm::vec3 tNormal(vertex1.nx + vertex2.nx + vertex3.nx, vertex1.ny + vertex2.ny + vertex3.ny,
+		vertex1.nz + vertex2.nz + vertex3.nz);
+
+	glm::vec3 tTangent;
+	glm::vec3 tBinormal;
+	IndexedMesh::buildTangentFrame(IndexedMesh::getFrameNormal(tNormal,
+		glm::cross(tPosition2 - tPosition1, tPosition3 - tPosition1)), tTangent, tBinormal);
+
+	tangent.x = tTangent.x;
+	tangent.y = tTangent.y;
+	tangent.z = tTangent.z;
+	binormal.x = tBinormal.x;
+	binormal.y = tBinormal.y;
+	binormal.z = tBinormal.z;
 }
\ No newline at end of file
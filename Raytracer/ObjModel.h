@@ -1,25 +1,18 @@
 #pragma once
 
+#include "Bvh.h"
+#include "MeshCache.h"
 #include "Vertex.h"
 
 #include <glm/glm.hpp>
 #include "CL/cl.hpp"
+#include <cstdint>
 #include <vector>
 using std::vector;
 
 class ObjModel
 {
 private:
-	struct FaceType
-	{
-		int vIndex1, vIndex2, vIndex3;
-		int tIndex1, tIndex2, tIndex3;
-		int nIndex1, nIndex2, nIndex3;
-	};
-	struct ReadVertexType
-	{
-		float x, y, z;
-	};
 	struct ModelType
 	{
 		float x, y, z;
@@ -40,9 +33,15 @@ private:
 	};
 
 	cl::Buffer mVertexBuffer;
-	//cl::Buffer mIndexBuffer;
+	cl::Buffer mBvhBuffer;
+	Bvh mBvh;
+	vector<Vertex> mVertices;
+	//Kept mapped from Load until the buffers are created from it
+	MeshCache mCache;
+	cl::Buffer mIndexBuffer;
+	vector<uint32_t> mIndices;
 	int	mVertexCount;
-	//int mIndexCount;
+	int mIndexCount;
 	//TextureArray *mTextureArray;
 	vector<ModelType> mModel;
 	float mPositionX;
@@ -54,20 +53,35 @@ public:
 	ObjModel(const ObjModel &objModel);
 	~ObjModel(void);
 
-	//int GetIndexCount(void);
+	int GetIndexCount(void);
 	int GetVertexCount(void);
 	void GetPosition(float &posX, float &posY, float &posZ);
 	//ID3D11ShaderResourceView **GetTextureArray(void);
 
 	void SetPosition(float posX, float posY, float posZ);
 
+	// Load followed by InitializeBuffers
 	bool Initialize(cl::Context &context, const char *modelFilename/*, WCHAR *textureFilename1, WCHAR *textureFilename2*/);
+	// Reads the model into host memory and builds its BVH without touching OpenCL, so it can run on any thread.
+	// Loads from the mesh cache of the file if it is up to date and writes the cache otherwise.
+	bool Load(const char *modelFilename);
+	// The buffers are only created if context is valid. The host copies of the vertices and indices are only kept
+	// with keepHostCopy, a model loaded from its cache is otherwise uploaded straight from the mapped file.
+	bool InitializeBuffers(cl::Context &context, bool keepHostCopy);
 	void Shutdown(void);
 
 	cl::Buffer getBuffer();
+	cl::Buffer getIndexBuffer();
+	cl::Buffer getBvhBuffer();
+	const Bvh& getBvh() const;
+	// Vertices shared between the triangles, GetVertexCount of them. Empty unless kept by InitializeBuffers.
+	const vector<Vertex>& getVertices() const;
+	// Three per triangle, in the order of the leaves of the BVH
+	const vector<uint32_t>& getIndices() const;
 
 private:
-	bool InitializeBuffers(cl::Context &context);
+	void BuildBvh(void);
+	void InitializeVertices(void);
 	void ShutdownBuffers(void);
 	
 
@@ -76,14 +90,14 @@ private:
 	void ReleaseTextures(void);*/
 
 	bool LoadFile(const char *filename);
-	bool ReadFileCounts(const char *filename,	int &vertexCount, int &textureCount, 
-		int &normalCount, int &faceCout, int &groupCount);
-	bool LoadDataStructures(const char *filename, int &vertexCount, int &textureCount, 
-		int &normalCount, int &faceCount);
 	void ReleaseModel(void);
 
 	void CalculateModelVectors(void);
 	void CalculateTangentBinormal(TempVertexType vertex1,
 		TempVertexType vertex2, TempVertexType vertex3, VectorType &tangent,
 		VectorType &binormal);
+	//Some orthonormal frame around the normals of a face whose texture coordinates do not give a tangent
+	void BuildFallbackTangentBinormal(const TempVertexType &vertex1,
+		const TempVertexType &vertex2, const TempVertexType &vertex3, VectorType &tangent,
+		VectorType &binormal);
 };
\ No newline at end of file
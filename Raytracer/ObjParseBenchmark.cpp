@@ -0,0 +1,58 @@
+#include "ObjParseBenchmark.h"
+
+#include "MappedFile.h"
+#include "ObjParser.h"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+static double toMegabytesPerSecond(size_t _bytes, std::chrono::high_resolution_clock::duration _duration)
+{
+	double seconds = std::chrono::duration_cast<std::chrono::duration<double>>(_duration).count();
+	return seconds > 0.0 ? _bytes / 1e6 / seconds : 0.0;
+}
+
+void runObjParseBenchmark(const std::vector<std::string>& _paths, unsigned int _iterations)
+{
+	std::cout << "OBJ parse benchmark, " << _iterations << " iterations" << std::endl;
+
+	size_t totalBytes = 0;
+	std::chrono::high_resolution_clock::duration totalTime(0);
+	for (const std::string& path : _paths)
+	{
+		MappedFile file;
+		if (!file.open(path))
+		{
+			std::cout << path << ": could not open" << std::endl;
+			continue;
+		}
+
+		// Touch every page first so the benchmark does not measure the disk
+		ObjParser::Data data;
+		std::string error;
+		if (!ObjParser::parse(file.getData(), file.getSize(), data, error))
+		{
+			std::cout << path << ": " << error << std::endl;
+			continue;
+		}
+
+		auto startTime = std::chrono::high_resolution_clock::now();
+		for (unsigned int i = 0; i < _iterations; ++i)
+		{
+			ObjParser::Data iterationData;
+			ObjParser::parse(file.getData(), file.getSize(), iterationData, error);
+		}
+		auto duration = std::chrono::high_resolution_clock::now() - startTime;
+
+		totalBytes += file.getSize() * _iterations;
+		totalTime += duration;
+
+		std::cout << std::fixed << std::setprecision(1)
+			<< path << ": " << file.getSize() / 1024.0 << " KiB, " << data.corners.size() / 3 << " triangles, "
+			<< toMegabytesPerSecond(file.getSize() * _iterations, duration) << " MB/s" << std::endl;
+	}
+
+	std::cout << std::fixed << std::setprecision(1)
+		<< "Total: " << toMegabytesPerSecond(totalBytes, totalTime) << " MB/s" << std::endl;
+}
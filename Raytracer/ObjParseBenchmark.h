@@ -0,0 +1,8 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Parses every file in memory _iterations times and prints the throughput of ObjParser in MB/s,
+// the time to read the files from disk is not included
+void runObjParseBenchmark(const std::vector<std::string>& _paths, unsigned int _iterations);
@@ -0,0 +1,322 @@
+#include "ObjParser.h"
+
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+// Mantissa digits beyond this are dropped, a double can not hold more of them anyway
+static const int MAX_MANTISSA_DIGITS = 19;
+
+static const double POWERS_OF_TEN[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+	1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+static const int MAX_EXACT_POWER = sizeof(POWERS_OF_TEN) / sizeof(POWERS_OF_TEN[0]) - 1;
+
+static bool isDigit(char _c)
+{
+	return _c >= '0' && _c <= '9';
+}
+
+static bool isBlank(char _c)
+{
+	return _c == ' ' || _c == '\t';
+}
+
+static bool isLineEnd(const char* _p, const char* _end)
+{
+	return _p == _end || *_p == '\n' || *_p == '\r';
+}
+
+static void skipBlanks(const char*& _p, const char* _end)
+{
+	while (_p != _end && isBlank(*_p))
+	{
+		++_p;
+	}
+}
+
+static void skipLine(const char*& _p, const char* _end)
+{
+	while (_p != _end && *_p != '\n')
+	{
+		++_p;
+	}
+}
+
+static bool parseInt(const char*& _p, const char* _end, int& _value)
+{
+	bool negative = false;
+	if (_p != _end && (*_p == '-' || *_p == '+'))
+	{
+		negative = *_p == '-';
+		++_p;
+	}
+
+	if (_p == _end || !isDigit(*_p))
+	{
+		return false;
+	}
+
+	// Runs of digits that do not fit an int are malformed, not wrapped around
+	int value = 0;
+	while (_p != _end && isDigit(*_p))
+	{
+		int digit = *_p - '0';
+		if (value > (std::numeric_limits<int>::max() - digit) / 10)
+		{
+			return false;
+		}
+		value = value * 10 + digit;
+		++_p;
+	}
+
+	_value = negative ? -value : value;
+	return true;
+}
+
+static bool parseFloat(const char*& _p, const char* _end, float& _value)
+{
+	skipBlanks(_p, _end);
+
+	bool negative = false;
+	if (_p != _end && (*_p == '-' || *_p == '+'))
+	{
+		negative = *_p == '-';
+		++_p;
+	}
+
+	uint64_t mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+	bool anyDigits = false;
+
+	while (_p != _end && isDigit(*_p))
+	{
+		if (digits < MAX_MANTISSA_DIGITS)
+		{
+			mantissa = mantissa * 10 + (*_p - '0');
+			if (mantissa != 0)
+			{
+				++digits;
+			}
+		}
+		else
+		{
+			++exponent;
+		}
+		anyDigits = true;
+		++_p;
+	}
+
+	if (_p != _end && *_p == '.')
+	{
+		++_p;
+		while (_p != _end && isDigit(*_p))
+		{
+			if (digits < MAX_MANTISSA_DIGITS)
+			{
+				mantissa = mantissa * 10 + (*_p - '0');
+				if (mantissa != 0)
+				{
+					++digits;
+				}
+				--exponent;
+			}
+			anyDigits = true;
+			++_p;
+		}
+	}
+
+	if (!anyDigits)
+	{
+		return false;
+	}
+
+	if (_p != _end && (*_p == 'e' || *_p == 'E'))
+	{
+		++_p;
+		int explicitExponent;
+		if (!parseInt(_p, _end, explicitExponent))
+		{
+			return false;
+		}
+		exponent += explicitExponent;
+	}
+
+	double value = (double)mantissa;
+	if (exponent < 0)
+	{
+		value = -exponent <= MAX_EXACT_POWER ? value / POWERS_OF_TEN[-exponent] : value * std::pow(10.0, exponent);
+	}
+	else if (exponent > 0)
+	{
+		value = exponent <= MAX_EXACT_POWER ? value * POWERS_OF_TEN[exponent] : value * std::pow(10.0, exponent);
+	}
+
+	_value = (float)(negative ? -value : value);
+	return true;
+}
+
+// Turns a one based or negative relative index into a zero based one
+static bool resolveIndex(int _index, size_t _count, int& _resolved)
+{
+	if (_index > 0)
+	{
+		_resolved = _index - 1;
+	}
+	else if (_index < 0)
+	{
+		_resolved = (int)_count + _index;
+	}
+	else
+	{
+		return false;
+	}
+
+	return _resolved >= 0 && (size_t)_resolved < _count;
+}
+
+static bool parseCorner(const char*& _p, const char* _end, const ObjParser::Data& _data, ObjParser::Corner& _corner)
+{
+	_corner.position = -1;
+	_corner.texCoord = -1;
+	_corner.normal = -1;
+	_corner.bone = -1;
+
+	const size_t counts[] = { _data.positions.size(), _data.texCoords.size(), _data.normals.size(), _data.bones.size() };
+	int* indices[] = { &_corner.position, &_corner.texCoord, &_corner.normal, &_corner.bone };
+
+	for (int i = 0; i < 4; ++i)
+	{
+		if (i > 0)
+		{
+			if (_p == _end || *_p != '/')
+			{
+				break;
+			}
+			++_p;
+
+			// Empty fields, as in "1//3"
+			if (_p == _end || *_p == '/' || isBlank(*_p) || isLineEnd(_p, _end))
+			{
+				continue;
+			}
+		}
+
+		int index;
+		if (!parseInt(_p, _end, index) || !resolveIndex(index, counts[i], *indices[i]))
+		{
+			return false;
+		}
+	}
+
+	return _corner.position != -1;
+}
+
+bool ObjParser::parse(const char* _text, size_t _size, Data& _data, std::string& _error)
+{
+	const char* p = _text;
+	const char* end = _text + _size;
+	unsigned int line = 1;
+	std::vector<Corner> face;
+
+	while (p != end)
+	{
+		skipBlanks(p, end);
+
+		const char* keyword = p;
+		while (p != end && !isBlank(*p) && *p != '\n' && *p != '\r')
+		{
+			++p;
+		}
+		size_t keywordLength = p - keyword;
+
+		bool valid = true;
+		if (keywordLength == 1 && keyword[0] == 'v')
+		{
+			glm::vec3 position;
+			valid = parseFloat(p, end, position.x) && parseFloat(p, end, position.y) && parseFloat(p, end, position.z);
+			_data.positions.push_back(position);
+		}
+		else if (keywordLength == 2 && keyword[0] == 'v' && keyword[1] == 't')
+		{
+			glm::vec2 texCoord;
+			valid = parseFloat(p, end, texCoord.x) && parseFloat(p, end, texCoord.y);
+			_data.texCoords.push_back(texCoord);
+		}
+		else if (keywordLength == 2 && keyword[0] == 'v' && keyword[1] == 'n')
+		{
+			glm::vec3 normal;
+			valid = parseFloat(p, end, normal.x) && parseFloat(p, end, normal.y) && parseFloat(p, end, normal.z);
+			_data.normals.push_back(normal);
+		}
+		else if (keywordLength == 1 && keyword[0] == 'f')
+		{
+			face.clear();
+			while (valid)
+			{
+				skipBlanks(p, end);
+				if (isLineEnd(p, end))
+				{
+					break;
+				}
+
+				Corner corner;
+				valid = parseCorner(p, end, _data, corner);
+				face.push_back(corner);
+			}
+
+			valid = valid && face.size() >= 3;
+			for (size_t i = 1; valid && i + 1 < face.size(); ++i)
+			{
+				_data.corners.push_back(face[0]);
+				_data.corners.push_back(face[i]);
+				_data.corners.push_back(face[i + 1]);
+			}
+		}
+		else if (keywordLength == 1 && keyword[0] == 'b')
+		{
+			const char* bone = p;
+			skipLine(p, end);
+			_data.bones.push_back(std::string(bone, p));
+		}
+
+		if (!valid)
+		{
+			_error = "Malformed line " + std::to_string(line) + ": " + std::string(keyword, std::find(keyword, end, '\n'));
+			return false;
+		}
+
+		// Comments, groups, materials and anything after the values read above
+		skipLine(p, end);
+		if (p != end)
+		{
+			++p;
+			++line;
+		}
+	}
+
+	return true;
+}
+
+bool ObjParser::parseFile(const std::string& _path, Data& _data, std::string& _error)
+{
+	MappedFile file;
+	if (!file.open(_path))
+	{
+		_error = "Could not open model file: " + _path;
+		return false;
+	}
+
+	if (!parse(file.getData(), file.getSize(), _data, _error))
+	{
+		_error = _path + ": " + _error;
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+
+// Single pass parser for the OBJ files in resources, reading from text in memory instead of a stream.
+// Faces with more than three corners are split into a fan of triangles and negative indices count back from
+// the last element read so far. The animated format adds "b" lines and a fourth index per corner for the bone.
+namespace ObjParser
+{
+	// Zero based indices into the lists of Data, -1 where the face leaves an index out
+	struct Corner
+	{
+		int position;
+		int texCoord;
+		int normal;
+		int bone;
+	};
+
+	struct Data
+	{
+		std::vector<glm::vec3> positions;
+		std::vector<glm::vec2> texCoords;
+		std::vector<glm::vec3> normals;
+		// Three corners per triangle
+		std::vector<Corner> corners;
+		// The text after "b" on every bone line, in file order
+		std::vector<std::string> bones;
+	};
+
+	// Returns false and describes the first problem in _error if the text is malformed
+	bool parse(const char* _text, size_t _size, Data& _data, std::string& _error);
+	// Maps the file and parses it
+	bool parseFile(const std::string& _path, Data& _data, std::string& _error);
+}
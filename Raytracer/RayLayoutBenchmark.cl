@@ -0,0 +1,94 @@
+#include "Types.hcl"
+
+// The array of structures layout the rays were stored in before getRays, kept to compare against
+typedef struct Ray
+{
+	float4 position;
+	float4 direction;
+	float4 diffuseReflectivity;
+	float4 surfaceNormal;
+	float4 reflectDir;
+	float distance;
+	float shininess;
+	float strength;
+	float totalStrength;
+	int occlusion;
+	int collideGroup;
+	int collideObject;
+	float hitU;
+	float hitV;
+} Ray;
+
+// Points the rays at a light, reads the position and writes the direction and distance
+__kernel void lightPassAoS(__global Ray* _rays, int _numRays, float4 _lightPosition)
+{
+	int id = get_global_id(0);
+	if (id >= _numRays)
+		return;
+
+	float4 relativeLightPos = _lightPosition - _rays[id].position;
+	float newDistance = length(relativeLightPos);
+
+	_rays[id].distance = newDistance;
+	_rays[id].direction = relativeLightPos / newDistance;
+	_rays[id].occlusion = 0;
+}
+
+__kernel void lightPassSoA(__global float4* _rayData, int _rayCapacity, float4 _lightPosition)
+{
+	int id = get_global_id(0);
+	if (id >= _rayCapacity)
+		return;
+
+	Rays rays = getRays(_rayData, _rayCapacity);
+
+	float4 relativeLightPos = _lightPosition - rays.position[id];
+	float newDistance = length(relativeLightPos);
+
+	rays.distance[id] = newDistance;
+	rays.direction[id] = relativeLightPos / newDistance;
+	rays.occlusion[id] = 0;
+}
+
+// Accumulates the light at the hit points, reads the surface fields of the rays
+__kernel void shadePassAoS(__global Ray* _rays, int _numRays, __global float4* _accumulationBuffer, float4 _lightPosition)
+{
+	int id = get_global_id(0);
+	if (id >= _numRays)
+		return;
+
+	Ray r = _rays[id];
+	if (r.occlusion)
+		return;
+
+	float4 lightDir = normalize(_lightPosition - r.position);
+	float4 halfway = normalize(lightDir - r.reflectDir);
+	float intensity = clamp(dot(r.surfaceNormal, lightDir), 0.f, 1.f) + pow(clamp(dot(r.surfaceNormal, halfway), 0.f, 1.f), r.shininess);
+
+	_accumulationBuffer[id] += r.strength * intensity * r.diffuseReflectivity;
+
+	_rays[id].direction = r.reflectDir;
+	_rays[id].distance = INFINITY;
+}
+
+__kernel void shadePassSoA(__global float4* _rayData, int _rayCapacity, __global float4* _accumulationBuffer, float4 _lightPosition)
+{
+	int id = get_global_id(0);
+	if (id >= _rayCapacity)
+		return;
+
+	Rays rays = getRays(_rayData, _rayCapacity);
+	if (rays.occlusion[id])
+		return;
+
+	float4 normal = rays.surfaceNormal[id];
+	float4 reflectDir = rays.reflectDir[id];
+	float4 lightDir = normalize(_lightPosition - rays.position[id]);
+	float4 halfway = normalize(lightDir - reflectDir);
+	float intensity = clamp(dot(normal, lightDir), 0.f, 1.f) + pow(clamp(dot(normal, halfway), 0.f, 1.f), rays.shininess[id]);
+
+	_accumulationBuffer[id] += rays.strength[id] * intensity * rays.diffuseReflectivity[id];
+
+	rays.direction[id] = reflectDir;
+	rays.distance[id] = INFINITY;
+}
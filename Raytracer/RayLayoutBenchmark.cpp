@@ -0,0 +1,76 @@
+#include "RayLayoutBenchmark.h"
+
+#include "CLHelper.h"
+#include "RayQueue.h"
+
+#include <iomanip>
+#include <iostream>
+
+// Size of Ray in RayLayoutBenchmark.cl, padded to the alignment of its float4 members
+static const size_t AOS_RAY_SIZE = 128;
+
+static double timeKernel(cl::CommandQueue& _queue, cl::Kernel& _kernel, const cl::NDRange& _globalSize, const cl::NDRange& _localSize, unsigned int _iterations)
+{
+	std::vector<cl::Event> events;
+	for (unsigned int i = 0; i < _iterations; ++i)
+	{
+		cl::Event event;
+		_queue.enqueueNDRangeKernel(_kernel, cl::NullRange, _globalSize, _localSize, nullptr, &event);
+		events.push_back(event);
+	}
+	_queue.finish();
+
+	cl_ulong total = 0;
+	for (const cl::Event& event : events)
+	{
+		total += getExecutionTime(event);
+	}
+
+	return toSeconds(total) * 1000.0 / _iterations;
+}
+
+void runRayLayoutBenchmark(cl::Context& _context, std::vector<cl::Device>& _devices, cl::CommandQueue& _queue,
+	int _numRays, unsigned int _iterations, const cl::NDRange& _localSize)
+{
+	cl::Program program = createProgramFromFile(_context, _devices, "RayLayoutBenchmark.cl");
+
+	std::vector<char> zeros(AOS_RAY_SIZE * _numRays, 0);
+	cl::Buffer aosRays(_context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, AOS_RAY_SIZE * _numRays, zeros.data());
+	cl::Buffer soaRays(_context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, RAY_STATE_SIZE * _numRays, zeros.data());
+	cl::Buffer accumulationBuffer(_context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(cl_float4) * _numRays, zeros.data());
+
+	cl_float4 lightPosition = { 0.f, 10.f, 0.f, 1.f };
+	cl::NDRange globalSize(((_numRays + _localSize[0] - 1) / _localSize[0]) * _localSize[0]);
+
+	const char* passes[] = { "light", "shade" };
+	std::cout << "Ray layout benchmark, " << _numRays << " rays, " << _iterations << " iterations" << std::endl;
+	for (const char* pass : passes)
+	{
+		cl::Kernel aosKernel(program, (std::string(pass) + "PassAoS").c_str());
+		cl::Kernel soaKernel(program, (std::string(pass) + "PassSoA").c_str());
+
+		aosKernel.setArg(0, aosRays);
+		soaKernel.setArg(0, soaRays);
+		cl::Kernel* kernels[] = { &aosKernel, &soaKernel };
+		for (cl::Kernel* kernel : kernels)
+		{
+			kernel->setArg(1, _numRays);
+			if (std::string(pass) == "shade")
+			{
+				kernel->setArg(2, accumulationBuffer);
+				kernel->setArg(3, lightPosition);
+			}
+			else
+			{
+				kernel->setArg(2, lightPosition);
+			}
+		}
+
+		double aosTime = timeKernel(_queue, aosKernel, globalSize, _localSize, _iterations);
+		double soaTime = timeKernel(_queue, soaKernel, globalSize, _localSize, _iterations);
+
+		std::cout << std::fixed << std::setprecision(3)
+			<< pass << " pass: AoS " << aosTime << " ms, SoA " << soaTime << " ms, "
+			<< std::setprecision(2) << aosTime / soaTime << "x" << std::endl;
+	}
+}
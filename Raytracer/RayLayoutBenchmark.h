@@ -0,0 +1,12 @@
+#pragma once
+
+#define __CL_ENABLE_EXCEPTIONS
+#define CL_GL_INTEROP
+#include "CL/cl.hpp"
+
+#include <vector>
+
+// Times a pass that points the rays at a light and one that accumulates the light at the hit points,
+// once with the rays as an array of structures and once as the structure of arrays the ray tracer uses
+void runRayLayoutBenchmark(cl::Context& _context, std::vector<cl::Device>& _devices, cl::CommandQueue& _queue,
+	int _numRays, unsigned int _iterations, const cl::NDRange& _localSize);
@@ -0,0 +1,220 @@
+#pragma once
+
+#include "Bvh.h"
+#include "Simd.h"
+#include "Sphere.h"
+
+#include <glm/glm.hpp>
+
+// Four lane versions of the intersection tests of rayTracing.cl, either four rays against one primitive or one ray
+// against four triangles. See Simd.h for how the lanes map to the CPU.
+
+static const int PACKET_SIZE = 4;
+
+// Four triangles as a structure of arrays, so that one ray can be tested against all of them at once.
+// Unused lanes are left zeroed, the tests reject them as degenerate.
+struct TrianglePack
+{
+	float v0[3][PACKET_SIZE];
+	float e1[3][PACKET_SIZE];
+	float e2[3][PACKET_SIZE];
+};
+
+// Four rays traced together, one per lane. Lanes that should not hit anything get a distance of -infinity.
+struct RayPacket
+{
+	Simd::Float4 position[3];
+	Simd::Float4 direction[3];
+	Simd::Float4 invDirection[3];
+	// The primitive each ray left from, which it never hits again
+	Simd::Int4 prevGroup;
+	Simd::Int4 prevObject;
+};
+
+inline Simd::Float4 selectPacket(Simd::Float4 _mask, Simd::Float4 _a, Simd::Float4 _b)
+{
+	return Simd::bitOr(Simd::bitAnd(_mask, _a), Simd::bitAndNot(_mask, _b));
+}
+
+inline Simd::Int4 selectPacket(Simd::Float4 _mask, Simd::Int4 _a, Simd::Int4 _b)
+{
+	Simd::Int4 mask = Simd::asInt(_mask);
+	return Simd::bitOr(Simd::bitAnd(mask, _a), Simd::bitAndNot(mask, _b));
+}
+
+inline Simd::Float4 absPacket(Simd::Float4 _value)
+{
+	return Simd::bitAndNot(Simd::splat(-0.f), _value);
+}
+
+// Avoids divisions by zero for axis aligned rays, like safeInverse in rayTracing.cl
+inline void setDirection(RayPacket& _rays, Simd::Float4 _x, Simd::Float4 _y, Simd::Float4 _z)
+{
+	_rays.direction[0] = _x;
+	_rays.direction[1] = _y;
+	_rays.direction[2] = _z;
+
+	Simd::Float4 signMask = Simd::splat(-0.f);
+	for (int i = 0; i < 3; ++i)
+	{
+		Simd::Float4 magnitude = Simd::maximum(absPacket(_rays.direction[i]), Simd::splat(1e-8f));
+		_rays.invDirection[i] = Simd::div(Simd::splat(1.f), Simd::bitOr(magnitude, Simd::bitAnd(_rays.direction[i], signMask)));
+	}
+}
+
+// Moves the rays into the space of _transform, the directions are not renormalized so t stays the same
+inline void transformPacket(const RayPacket& _rays, const glm::mat4& _transform, RayPacket& _out)
+{
+	Simd::Float4 direction[3];
+	for (int row = 0; row < 3; ++row)
+	{
+		_out.position[row] = Simd::add(
+			Simd::add(Simd::mul(Simd::splat(_transform[0][row]), _rays.position[0]), Simd::mul(Simd::splat(_transform[1][row]), _rays.position[1])),
+			Simd::add(Simd::mul(Simd::splat(_transform[2][row]), _rays.position[2]), Simd::splat(_transform[3][row])));
+		direction[row] = Simd::add(
+			Simd::add(Simd::mul(Simd::splat(_transform[0][row]), _rays.direction[0]), Simd::mul(Simd::splat(_transform[1][row]), _rays.direction[1])),
+			Simd::mul(Simd::splat(_transform[2][row]), _rays.direction[2]));
+	}
+
+	setDirection(_out, direction[0], direction[1], direction[2]);
+	_out.prevGroup = _rays.prevGroup;
+	_out.prevObject = _rays.prevObject;
+}
+
+// Slab test of four rays against one box, _enter is set to where each ray enters it
+inline Simd::Float4 intersectBoxPacket(const RayPacket& _rays, const Bvh::Node& _node, Simd::Float4 _distance, Simd::Float4& _enter)
+{
+	Simd::Float4 tNear[3];
+	Simd::Float4 tFar[3];
+	for (int i = 0; i < 3; ++i)
+	{
+		Simd::Float4 t0 = Simd::mul(Simd::sub(Simd::splat(_node.min[i]), _rays.position[i]), _rays.invDirection[i]);
+		Simd::Float4 t1 = Simd::mul(Simd::sub(Simd::splat(_node.max[i]), _rays.position[i]), _rays.invDirection[i]);
+		tNear[i] = Simd::minimum(t0, t1);
+		tFar[i] = Simd::maximum(t0, t1);
+	}
+
+	_enter = Simd::maximum(Simd::maximum(tNear[0], tNear[1]), Simd::maximum(tNear[2], Simd::zero()));
+	Simd::Float4 exit = Simd::minimum(Simd::minimum(tFar[0], tFar[1]), Simd::minimum(tFar[2], _distance));
+	return Simd::cmpLe(_enter, exit);
+}
+
+// Shared by both triangle tests, the same math as findTriangleIntersectDistance in rayTracing.cl
+inline Simd::Float4 intersectTriangleLanes(const Simd::Float4 _position[3], const Simd::Float4 _direction[3], Simd::Float4 _distance,
+	const Simd::Float4 _v0[3], const Simd::Float4 _e1[3], const Simd::Float4 _e2[3], Simd::Float4& _t, Simd::Float4& _u, Simd::Float4& _v)
+{
+	Simd::Float4 q[3];
+	q[0] = Simd::sub(Simd::mul(_direction[1], _e2[2]), Simd::mul(_direction[2], _e2[1]));
+	q[1] = Simd::sub(Simd::mul(_direction[2], _e2[0]), Simd::mul(_direction[0], _e2[2]));
+	q[2] = Simd::sub(Simd::mul(_direction[0], _e2[1]), Simd::mul(_direction[1], _e2[0]));
+
+	Simd::Float4 a = Simd::add(Simd::add(Simd::mul(_e1[0], q[0]), Simd::mul(_e1[1], q[1])), Simd::mul(_e1[2], q[2]));
+	Simd::Float4 mask = Simd::cmpGe(absPacket(a), Simd::splat(0.00001f));
+
+	Simd::Float4 f = Simd::div(Simd::splat(1.f), a);
+
+	Simd::Float4 s[3];
+	for (int i = 0; i < 3; ++i)
+	{
+		s[i] = Simd::sub(_position[i], _v0[i]);
+	}
+
+	_u = Simd::mul(f, Simd::add(Simd::add(Simd::mul(s[0], q[0]), Simd::mul(s[1], q[1])), Simd::mul(s[2], q[2])));
+	mask = Simd::bitAnd(mask, Simd::cmpGe(_u, Simd::zero()));
+
+	Simd::Float4 r[3];
+	r[0] = Simd::sub(Simd::mul(s[1], _e1[2]), Simd::mul(s[2], _e1[1]));
+	r[1] = Simd::sub(Simd::mul(s[2], _e1[0]), Simd::mul(s[0], _e1[2]));
+	r[2] = Simd::sub(Simd::mul(s[0], _e1[1]), Simd::mul(s[1], _e1[0]));
+
+	_v = Simd::mul(f, Simd::add(Simd::add(Simd::mul(_direction[0], r[0]), Simd::mul(_direction[1], r[1])), Simd::mul(_direction[2], r[2])));
+	mask = Simd::bitAnd(mask, Simd::cmpGe(_v, Simd::zero()));
+	mask = Simd::bitAnd(mask, Simd::cmpLe(Simd::add(_u, _v), Simd::splat(1.f)));
+
+	_t = Simd::mul(f, Simd::add(Simd::add(Simd::mul(_e2[0], r[0]), Simd::mul(_e2[1], r[1])), Simd::mul(_e2[2], r[2])));
+	mask = Simd::bitAnd(mask, Simd::cmpLe(_t, _distance));
+	return Simd::bitAnd(mask, Simd::cmpGt(_t, Simd::zero()));
+}
+
+// One ray against the four triangles of a pack, returns the lanes that are hit closer than _distance as a bitmask
+inline int intersectTrianglePack(const glm::vec3& _position, const glm::vec3& _direction, float _distance, const TrianglePack& _triangles,
+	Simd::Float4& _t, Simd::Float4& _u, Simd::Float4& _v)
+{
+	Simd::Float4 position[3];
+	Simd::Float4 direction[3];
+	Simd::Float4 v0[3];
+	Simd::Float4 e1[3];
+	Simd::Float4 e2[3];
+	for (int i = 0; i < 3; ++i)
+	{
+		position[i] = Simd::splat(_position[i]);
+		direction[i] = Simd::splat(_direction[i]);
+		v0[i] = Simd::load(_triangles.v0[i]);
+		e1[i] = Simd::load(_triangles.e1[i]);
+		e2[i] = Simd::load(_triangles.e2[i]);
+	}
+
+	return Simd::moveMask(intersectTriangleLanes(position, direction, Simd::splat(_distance), v0, e1, e2, _t, _u, _v));
+}
+
+// Four rays against triangle _lane of a pack, returns the rays that hit it closer than their _distance
+inline Simd::Float4 intersectTrianglePacket(const RayPacket& _rays, Simd::Float4 _distance, const TrianglePack& _triangles, int _lane,
+	Simd::Float4& _t, Simd::Float4& _u, Simd::Float4& _v)
+{
+	Simd::Float4 v0[3];
+	Simd::Float4 e1[3];
+	Simd::Float4 e2[3];
+	for (int i = 0; i < 3; ++i)
+	{
+		v0[i] = Simd::splat(_triangles.v0[i][_lane]);
+		e1[i] = Simd::splat(_triangles.e1[i][_lane]);
+		e2[i] = Simd::splat(_triangles.e2[i][_lane]);
+	}
+
+	return intersectTriangleLanes(_rays.position, _rays.direction, _distance, v0, e1, e2, _t, _u, _v);
+}
+
+// Four rays against one sphere, the same math as findSphereIntersectDistance in rayTracing.cl
+inline Simd::Float4 intersectSpherePacket(const RayPacket& _rays, const Sphere& _sphere, Simd::Float4 _distance, Simd::Float4& _t)
+{
+	Simd::Float4 rDistance[3];
+	for (int i = 0; i < 3; ++i)
+	{
+		rDistance[i] = Simd::sub(Simd::splat(_sphere.position[i]), _rays.position[i]);
+	}
+
+	Simd::Float4 rayDist = Simd::add(Simd::add(Simd::mul(rDistance[0], _rays.direction[0]), Simd::mul(rDistance[1], _rays.direction[1])),
+		Simd::mul(rDistance[2], _rays.direction[2]));
+	Simd::Float4 rDist2 = Simd::add(Simd::add(Simd::mul(rDistance[0], rDistance[0]), Simd::mul(rDistance[1], rDistance[1])),
+		Simd::mul(rDistance[2], rDistance[2]));
+	Simd::Float4 radius2 = Simd::splat(_sphere.radius * _sphere.radius);
+
+	Simd::Float4 outside = Simd::cmpGt(rDist2, radius2);
+	Simd::Float4 mask = Simd::bitAndNot(Simd::bitAnd(Simd::cmpLt(rayDist, Simd::zero()), outside), Simd::asFloat(Simd::splatInt(-1)));
+
+	Simd::Float4 centerDistance2 = Simd::sub(rDist2, Simd::mul(rayDist, rayDist));
+	mask = Simd::bitAnd(mask, Simd::cmpLe(centerDistance2, radius2));
+
+	Simd::Float4 rayDistInSphere = Simd::sqrt(Simd::maximum(Simd::sub(radius2, centerDistance2), Simd::zero()));
+	_t = Simd::add(rayDist, selectPacket(outside, Simd::sub(Simd::zero(), rayDistInSphere), rayDistInSphere));
+
+	return Simd::bitAnd(mask, Simd::cmpLe(_t, _distance));
+}
+
+inline void loadRayPacket(RayPacket& _rays, const float _position[3][PACKET_SIZE], const float _direction[3][PACKET_SIZE],
+	const int _prevGroup[PACKET_SIZE], const int _prevObject[PACKET_SIZE])
+{
+	for (int i = 0; i < 3; ++i)
+	{
+		_rays.position[i] = Simd::load(_position[i]);
+	}
+	setDirection(_rays, Simd::load(_direction[0]), Simd::load(_direction[1]), Simd::load(_direction[2]));
+	_rays.prevGroup = Simd::load(_prevGroup);
+	_rays.prevObject = Simd::load(_prevObject);
+}
+
+// The lanes whose previous hit is the given primitive
+inline Simd::Float4 isPrevHitPacket(const RayPacket& _rays, int _group, int _object)
+{
+	return Simd::asFloat(Simd::bitAnd(Simd::cmpEq(_rays.prevGroup, Simd::splatInt(_group)), Simd::cmpEq(_rays.prevObject, Simd::splatInt(_object))));
+}
@@ -0,0 +1,123 @@
+#include "RayQueue.h"
+
+// Work group sizes are powers of two no larger than this, so rounding the launches up to it covers all of them
+static const unsigned int MAX_GROUP_SIZE = 1024;
+
+static unsigned int roundUp(unsigned int _val, unsigned int _mul)
+{
+	return ((_val + _mul - 1) / _mul) * _mul;
+}
+
+RayQueue::RayQueue(cl::Program _compactionProgram)
+	: scanLiveRaysKernel(_compactionProgram, "scanLiveRays"),
+	scanGroupSumsKernel(_compactionProgram, "scanGroupSums"),
+	scatterLiveRaysKernel(_compactionProgram, "scatterLiveRays"),
+	current(0),
+	numRays(0),
+	queuedRays(0),
+	readCount(0),
+	countPending(false)
+{
+}
+
+void RayQueue::resize(cl::Context _context, int _numRays)
+{
+	numRays = _numRays;
+
+	unsigned int maxGlobalSize = roundUp(numRays, MAX_GROUP_SIZE);
+	for (int i = 0; i < 2; ++i)
+	{
+		queueBuffers[i] = cl::Buffer(_context, CL_MEM_READ_WRITE, sizeof(cl_int) * numRays);
+		countBuffers[i] = cl::Buffer(_context, CL_MEM_READ_WRITE, sizeof(cl_int));
+	}
+	scannedBuffer = cl::Buffer(_context, CL_MEM_READ_WRITE, sizeof(cl_int) * maxGlobalSize);
+	groupSumBuffer = cl::Buffer(_context, CL_MEM_READ_WRITE, sizeof(cl_int) * maxGlobalSize);
+}
+
+void RayQueue::reset(cl::CommandQueue _queue)
+{
+	// A length still being read belongs to the last frame, which may not be done yet. It is dropped instead of waited for,
+	// the read lands before the next one on the in-order queue.
+	countPending = false;
+
+	current = 0;
+	queuedRays = numRays;
+
+	_queue.enqueueWriteBuffer(countBuffers[current], false, 0, sizeof(cl_int), &numRays);
+}
+
+void RayQueue::compact(cl::CommandQueue _queue, cl::Buffer _rays, const cl::NDRange& _localSize, std::vector<cl::Event>& _compactEvents)
+{
+	cl::NDRange globalSize = getGlobalSize(_localSize);
+	int numGroups = globalSize[0] / _localSize[0];
+	unsigned int next = 1 - current;
+
+	scanLiveRaysKernel.setArg(0, _rays);
+	scanLiveRaysKernel.setArg(1, numRays);
+	scanLiveRaysKernel.setArg(2, queueBuffers[current]);
+	scanLiveRaysKernel.setArg(3, countBuffers[current]);
+	scanLiveRaysKernel.setArg(4, scannedBuffer);
+	scanLiveRaysKernel.setArg(5, groupSumBuffer);
+	scanLiveRaysKernel.setArg(6, cl::__local(sizeof(cl_int) * _localSize[0]));
+
+	scanGroupSumsKernel.setArg(0, groupSumBuffer);
+	scanGroupSumsKernel.setArg(1, numGroups);
+	scanGroupSumsKernel.setArg(2, countBuffers[next]);
+	scanGroupSumsKernel.setArg(3, cl::__local(sizeof(cl_int) * _localSize[0]));
+
+	scatterLiveRaysKernel.setArg(0, _rays);
+	scatterLiveRaysKernel.setArg(1, numRays);
+	scatterLiveRaysKernel.setArg(2, queueBuffers[current]);
+	scatterLiveRaysKernel.setArg(3, countBuffers[current]);
+	scatterLiveRaysKernel.setArg(4, scannedBuffer);
+	scatterLiveRaysKernel.setArg(5, groupSumBuffer);
+	scatterLiveRaysKernel.setArg(6, queueBuffers[next]);
+
+	const cl::Kernel* kernels[] = { &scanLiveRaysKernel, &scanGroupSumsKernel, &scatterLiveRaysKernel };
+	const cl::NDRange globalSizes[] = { globalSize, _localSize, globalSize };
+	for (int i = 0; i < 3; ++i)
+	{
+		cl::Event event;
+		_queue.enqueueNDRangeKernel(*kernels[i], cl::NullRange, globalSizes[i], _localSize, nullptr, &event);
+		_compactEvents.push_back(event);
+	}
+
+	_queue.enqueueReadBuffer(countBuffers[next], false, 0, sizeof(cl_int), &readCount, nullptr, &readCountEvent);
+	_queue.flush();
+	countPending = true;
+
+	current = next;
+}
+
+int RayQueue::getQueuedRays()
+{
+	if (countPending)
+	{
+		readCountEvent.wait();
+		queuedRays = readCount;
+		countPending = false;
+	}
+
+	return queuedRays;
+}
+
+cl::NDRange RayQueue::getGlobalSize(const cl::NDRange& _localSize)
+{
+	return cl::NDRange(roundUp(getQueuedRays(), _localSize[0]));
+}
+
+cl::Buffer RayQueue::getQueueBuffer() const
+{
+	return queueBuffers[current];
+}
+
+cl::Buffer RayQueue::getCountBuffer() const
+{
+	return countBuffers[current];
+}
+
+void RayQueue::setKernelArgs(cl::Kernel& _kernel, unsigned int _index) const
+{
+	_kernel.setArg(_index, queueBuffers[current]);
+	_kernel.setArg(_index + 1, countBuffers[current]);
+}
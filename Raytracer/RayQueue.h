@@ -0,0 +1,52 @@
+#pragma once
+
+#define __CL_ENABLE_EXCEPTIONS
+#define CL_GL_INTEROP
+#include "CL/cl.hpp"
+
+#include <vector>
+
+// Size of the state of one ray, the rays are stored as a structure of arrays as laid out by getRays in Types.hcl
+static const size_t RAY_STATE_SIZE = 5 * sizeof(cl_float4) + 11 * sizeof(cl_int);
+
+// Queue with the indices of the rays that are still alive. It is compacted after the closest hits of every bounce,
+// so the kernels of the rest of the bounce, and of later bounces, only run over the rays that hit something.
+class RayQueue
+{
+private:
+	cl::Kernel scanLiveRaysKernel;
+	cl::Kernel scanGroupSumsKernel;
+	cl::Kernel scatterLiveRaysKernel;
+
+	cl::Buffer queueBuffers[2];
+	cl::Buffer countBuffers[2];
+	cl::Buffer scannedBuffer;
+	cl::Buffer groupSumBuffer;
+	unsigned int current;
+
+	cl_int numRays;
+	cl_int queuedRays;	// Upper bound of the length of the current queue known on the host
+	cl_int readCount;
+	cl::Event readCountEvent;
+	bool countPending;
+
+public:
+	RayQueue(cl::Program _compactionProgram);
+
+	void resize(cl::Context _context, int _numRays);
+
+	// Starts a frame with every ray in the queue, the indices are written by the primary rays kernel
+	void reset(cl::CommandQueue _queue);
+
+	// Compacts the queue down to the rays with a hit. The new length is read back without blocking,
+	// it is waited for the next time the length is needed on the host.
+	void compact(cl::CommandQueue _queue, cl::Buffer _rays, const cl::NDRange& _localSize, std::vector<cl::Event>& _compactEvents);
+
+	int getQueuedRays();
+	cl::NDRange getGlobalSize(const cl::NDRange& _localSize);
+
+	cl::Buffer getQueueBuffer() const;
+	cl::Buffer getCountBuffer() const;
+	// Sets the queue and its length as the arguments _index and _index + 1 of a kernel
+	void setKernelArgs(cl::Kernel& _kernel, unsigned int _index) const;
+};
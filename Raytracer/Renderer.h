@@ -0,0 +1,40 @@
+#pragma once
+
+#include "Model.h"
+#include "MovingLight.h"
+#include "Sphere.h"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+// Everything that changes between frames, owned by the main loop
+struct FrameState
+{
+	glm::mat4 invViewProjection;
+	glm::vec3 cameraPosition;
+	const ModelInstance* instances;
+	const std::vector<Sphere>* spheres;
+	const std::vector<Light>* lights;
+};
+
+// Traces a frame into the framebuffer of the window, or into host memory when there is no window.
+// The main loop picks one at startup, the number of bounces, lights and the rest come from Settings.
+class Renderer
+{
+public:
+	virtual ~Renderer() {}
+
+	// Called before the first frame and whenever the size or the supersampling changes,
+	// after the framebuffer of the window has been updated
+	virtual void resize(int _width, int _height) = 0;
+	// Skins the visible animated models and traces the frame. May return before the frame is done, the window then
+	// shows an earlier one.
+	virtual void render(const FrameState& _frame) = 0;
+	// Waits for the frames that are still being rendered, before resizing and before reading the last frame
+	virtual void finishFrames() {}
+	// The last finished frame as RGBA8 with the bottom row first, only kept when there is no window
+	virtual const std::vector<unsigned char>& getFramePixels() const = 0;
+	// True while the renderer is still getting ready for the current settings, the tests wait before timing it
+	virtual bool isWarmingUp() const { return false; }
+};
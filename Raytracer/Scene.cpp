@@ -0,0 +1,217 @@
+#include "Scene.h"
+
+#include "Vertex.h"
+
+Scene::Scene(cl::Context _context, cl::CommandQueue _queue, cl::Program _transformProgram, Model* _models, unsigned int _numModels, unsigned int _maxSpheres,
+		bool _packedVertices)
+	: numInstances(_numModels),
+	maxSpheres(_maxSpheres),
+	instances(_numModels),
+	shading(_numModels)
+{
+	int vertexCount = 0;
+	int triangleCount = 0;
+	int nodeCount = 0;
+	for (unsigned int i = 0; i < _numModels; ++i)
+	{
+		_models[i].vertexOffset = vertexCount;
+		_models[i].triangleOffset = triangleCount;
+		_models[i].nodeOffset = nodeCount;
+		vertexCount += _models[i].data->getVertexCount();
+		triangleCount += _models[i].data->getTriangleCount();
+		nodeCount += _models[i].data->getBvhNodeCapacity();
+	}
+
+	vertexBufferSize = (_packedVertices ? sizeof(PackedVertex) : sizeof(Vertex)) * vertexCount;
+	vertexBuffer = cl::Buffer(_context, CL_MEM_READ_WRITE, vertexBufferSize);
+	indexBuffer = cl::Buffer(_context, CL_MEM_READ_WRITE, sizeof(int32_t) * 3 * triangleCount);
+	intersectBuffer = cl::Buffer(_context, CL_MEM_READ_WRITE, sizeof(IntersectTriangle) * triangleCount);
+	blasBuffer = cl::Buffer(_context, CL_MEM_READ_ONLY, sizeof(Bvh::Node) * nodeCount);
+
+	cl::Kernel buildIntersectKernel(_transformProgram, "buildIntersectTriangles");
+	buildIntersectKernel.setArg(0, vertexBuffer);
+	buildIntersectKernel.setArg(1, indexBuffer);
+	buildIntersectKernel.setArg(2, intersectBuffer);
+
+	cl::Kernel storeVerticesKernel(_transformProgram, "storeSceneVertices");
+	storeVerticesKernel.setArg(1, vertexBuffer);
+
+	for (unsigned int i = 0; i < _numModels; ++i)
+	{
+		const ModelData& data = *_models[i].data;
+		_queue.enqueueCopyBuffer(data.getBvhBuffer(), blasBuffer, 0, sizeof(Bvh::Node) * _models[i].nodeOffset,
+			sizeof(Bvh::Node) * data.getBvhNodeCount());
+		_queue.enqueueCopyBuffer(data.getIndexBuffer(), indexBuffer, 0, sizeof(int32_t) * 3 * _models[i].triangleOffset,
+			sizeof(int32_t) * 3 * data.getTriangleCount());
+
+		// Rigid models are intersected in object space and never change, skinned vertices are written every frame
+		if (!data.isAnimated())
+		{
+			if (_packedVertices)
+			{
+				storeVerticesKernel.setArg(0, data.getVertexBuffer());
+				storeVerticesKernel.setArg(2, data.getVertexCount());
+				storeVerticesKernel.setArg(3, _models[i].vertexOffset);
+				_queue.enqueueNDRangeKernel(storeVerticesKernel, cl::NullRange, cl::NDRange(data.getVertexCount()), cl::NullRange);
+			}
+			else
+			{
+				_queue.enqueueCopyBuffer(data.getVertexBuffer(), vertexBuffer, 0, sizeof(Vertex) * _models[i].vertexOffset,
+					sizeof(Vertex) * data.getVertexCount());
+			}
+
+			buildIntersectKernel.setArg(3, data.getTriangleCount());
+			buildIntersectKernel.setArg(4, _models[i].triangleOffset);
+			buildIntersectKernel.setArg(5, _models[i].vertexOffset);
+			_queue.enqueueNDRangeKernel(buildIntersectKernel, cl::NullRange, cl::NDRange(data.getTriangleCount()), cl::NullRange);
+		}
+	}
+
+	unsigned int maxItems = _numModels + _maxSpheres;
+	instanceBuffer = cl::Buffer(_context, CL_MEM_READ_ONLY, sizeof(Instance) * _numModels);
+	shadingBuffer = cl::Buffer(_context, CL_MEM_READ_ONLY, sizeof(InstanceShading) * _numModels);
+	tlasBuffer = cl::Buffer(_context, CL_MEM_READ_ONLY, sizeof(Bvh::Node) * (maxItems * 2 + 1));
+	tlasItemBuffer = cl::Buffer(_context, CL_MEM_READ_ONLY, sizeof(int32_t) * maxItems);
+
+	tlasItems.reserve(maxItems);
+	items.reserve(maxItems);
+	itemMins.reserve(maxItems);
+	itemMaxs.reserve(maxItems);
+}
+
+void Scene::updateTopLevel(cl::CommandQueue _queue, const ModelInstance* _instances, const bool* _visible,
+	const Sphere* _spheres, unsigned int _numSpheres)
+{
+	// The uploads of the last frame read straight from the host copies and may still be queued behind an earlier frame
+	if (!uploadEvents.empty())
+	{
+		cl::Event::waitForEvents(uploadEvents);
+		uploadEvents.clear();
+	}
+
+	items.clear();
+	itemMins.clear();
+	itemMaxs.clear();
+
+	for (unsigned int i = 0; i < numInstances; ++i)
+	{
+		const Model& model = *_instances[i].model;
+
+		// Skinned vertices are already in world space
+		glm::mat4 world;
+		if (!model.data->isAnimated())
+		{
+			world = _instances[i].world.getTransform();
+		}
+
+		instances[i].invWorld = glm::transpose(glm::inverse(world));
+		instances[i].nodeOffset = model.nodeOffset;
+		instances[i].triangleOffset = model.triangleOffset;
+		instances[i].groupID = i + 1;
+		instances[i].vertexOffset = model.vertexOffset;
+
+		shading[i].transform = glm::transpose(world);
+		shading[i].normalTransform = glm::inverse(world);
+		shading[i].diffuseMap = model.diffuseMap;
+		shading[i].normalMap = model.normalMap;
+
+		if (_visible[i])
+		{
+			glm::vec3 worldMin;
+			glm::vec3 worldMax;
+			Bvh::transformBounds(world, model.data->getBoundsMin(), model.data->getBoundsMax(), worldMin, worldMax);
+
+			items.push_back(i);
+			itemMins.push_back(worldMin);
+			itemMaxs.push_back(worldMax);
+		}
+	}
+
+	for (unsigned int i = 0; i < _numSpheres && i < maxSpheres; ++i)
+	{
+		glm::vec3 center(_spheres[i].position);
+
+		items.push_back(numInstances + i);
+		itemMins.push_back(center - glm::vec3(_spheres[i].radius));
+		itemMaxs.push_back(center + glm::vec3(_spheres[i].radius));
+	}
+
+	tlas.buildFromBounds(itemMins, itemMaxs);
+
+	const std::vector<unsigned int>& order = tlas.getPrimitiveOrder();
+	tlasItems.resize(order.size());
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		tlasItems[i] = items[order[i]];
+	}
+
+	const std::vector<Bvh::Node>& nodes = tlas.getNodes();
+
+	cl::Event instanceEvent, shadingEvent, tlasEvent, itemEvent;
+	_queue.enqueueWriteBuffer(instanceBuffer, false, 0, sizeof(Instance) * instances.size(), instances.data(), nullptr, &instanceEvent);
+	_queue.enqueueWriteBuffer(shadingBuffer, false, 0, sizeof(InstanceShading) * shading.size(), shading.data(), nullptr, &shadingEvent);
+	_queue.enqueueWriteBuffer(tlasBuffer, false, 0, sizeof(Bvh::Node) * nodes.size(), nodes.data(), nullptr, &tlasEvent);
+	if (!tlasItems.empty())
+	{
+		_queue.enqueueWriteBuffer(tlasItemBuffer, false, 0, sizeof(int32_t) * tlasItems.size(), tlasItems.data(), nullptr, &itemEvent);
+		uploadEvents.push_back(itemEvent);
+	}
+	uploadEvents.push_back(instanceEvent);
+	uploadEvents.push_back(shadingEvent);
+	uploadEvents.push_back(tlasEvent);
+}
+
+cl::Buffer Scene::getVertexBuffer() const
+{
+	return vertexBuffer;
+}
+
+size_t Scene::getVertexBufferSize() const
+{
+	return vertexBufferSize;
+}
+
+cl::Buffer Scene::getIndexBuffer() const
+{
+	return indexBuffer;
+}
+
+cl::Buffer Scene::getIntersectBuffer() const
+{
+	return intersectBuffer;
+}
+
+cl::Buffer Scene::getBlasBuffer() const
+{
+	return blasBuffer;
+}
+
+cl::Buffer Scene::getInstanceBuffer() const
+{
+	return instanceBuffer;
+}
+
+cl::Buffer Scene::getShadingBuffer() const
+{
+	return shadingBuffer;
+}
+
+cl::Buffer Scene::getTlasBuffer() const
+{
+	return tlasBuffer;
+}
+
+cl::Buffer Scene::getTlasItemBuffer() const
+{
+	return tlasItemBuffer;
+}
+
+unsigned int Scene::getNumInstances() const
+{
+	return numInstances;
+}
+
+const Bvh& Scene::getTopLevel() const
+{
+	return tlas;
+}
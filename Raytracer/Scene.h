@@ -0,0 +1,97 @@
+#pragma once
+
+#define __CL_ENABLE_EXCEPTIONS
+#define CL_GL_INTEROP
+#include "CL/cl.hpp"
+
+#include "Bvh.h"
+#include "Model.h"
+#include "Sphere.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// Owns the geometry of all models in combined buffers, so that a single kernel can reach every instance,
+// and a top-level hierarchy over the world space bounds of the instances and spheres.
+class Scene
+{
+public:
+	//this struct must match the layout of Instance in Types.hcl
+	struct Instance
+	{
+		glm::mat4 invWorld;
+		int32_t nodeOffset;
+		int32_t triangleOffset;
+		int32_t groupID;
+		int32_t vertexOffset;
+	};
+
+	//this struct must match the layout of InstanceShading in Types.hcl
+	struct InstanceShading
+	{
+		glm::mat4 transform;
+		glm::mat4 normalTransform;
+		int32_t diffuseMap;
+		int32_t normalMap;
+		int32_t padding[2];
+	};
+
+	//this struct must match the layout of IntersectTriangle in Types.hcl
+	struct IntersectTriangle
+	{
+		glm::vec4 v0;
+		glm::vec4 e1;
+		glm::vec4 e2;
+	};
+
+private:
+	unsigned int numInstances;
+	unsigned int maxSpheres;
+	size_t vertexBufferSize;
+
+	cl::Buffer vertexBuffer;
+	cl::Buffer indexBuffer;
+	cl::Buffer intersectBuffer;
+	cl::Buffer blasBuffer;
+	cl::Buffer instanceBuffer;
+	cl::Buffer shadingBuffer;
+	cl::Buffer tlasBuffer;
+	cl::Buffer tlasItemBuffer;
+
+	std::vector<Instance> instances;
+	std::vector<InstanceShading> shading;
+	std::vector<int32_t> tlasItems;
+	std::vector<int32_t> items;	// In build order, before sorting into tlasItems
+	std::vector<glm::vec3> itemMins;
+	std::vector<glm::vec3> itemMaxs;
+	Bvh tlas;
+	std::vector<cl::Event> uploadEvents;	// Read from the vectors above
+
+public:
+	// The compact triangles of rigid models are built with buildIntersectTriangles from _transformProgram. With _packedVertices
+	// the scene vertices are PackedVertex and _transformProgram must be built with -D PACKED_VERTICES.
+	Scene(cl::Context _context, cl::CommandQueue _queue, cl::Program _transformProgram, Model* _models, unsigned int _numModels, unsigned int _maxSpheres,
+		bool _packedVertices);
+
+	// Uploads the transforms of the instances, and rebuilds and uploads the top-level hierarchy over the visible instances and the spheres
+	void updateTopLevel(cl::CommandQueue _queue, const ModelInstance* _instances, const bool* _visible,
+		const Sphere* _spheres, unsigned int _numSpheres);
+
+	// Vertices in the SceneVertex format of Types.hcl, only read when shading the closest hits. Indexed by the vertex offset of a model plus an index.
+	cl::Buffer getVertexBuffer() const;
+	// In bytes
+	size_t getVertexBufferSize() const;
+	// Three vertex indices per triangle, relative to the vertex offset of the model
+	cl::Buffer getIndexBuffer() const;
+	// Precomputed edges of the triangles, read during traversal. Indexed by the same triangle offsets as the indices.
+	cl::Buffer getIntersectBuffer() const;
+	cl::Buffer getBlasBuffer() const;
+	cl::Buffer getInstanceBuffer() const;
+	cl::Buffer getShadingBuffer() const;
+	cl::Buffer getTlasBuffer() const;
+	cl::Buffer getTlasItemBuffer() const;
+	unsigned int getNumInstances() const;
+	const Bvh& getTopLevel() const;
+};
@@ -9,7 +9,7 @@ int Settings::windowHeight = 0;
 
 bool Settings::shouldChangeWindowSize = false;
 
-const static unsigned int Settings::MAX_LIGHTS = 10;
+const unsigned int Settings::MAX_LIGHTS = 10;	// At most 32, the occluded lights of a ray are stored as a bitmask
 unsigned int Settings::numLights = 1;
 unsigned int Settings::numBounces = 1;
 
@@ -17,12 +17,26 @@ bool Settings::showModels[NUM_MODELS] = {true};
 unsigned int Settings::modelTriangleCount[NUM_MODELS];
 
 float Settings::cubeReflect = 0.5f;
+
+bool Settings::packedVertices = false;
+bool Settings::specializeKernels = true;
 static const float cubeReflectStep = 0.1f;
 
 int Settings::superSampling = 1;
 bool Settings::sizeChanged = true;
 
-std::vector<std::pair<std::string, std::string>> Settings::settings;
+namespace
+{
+	struct LoggedSetting
+	{
+		std::string name;
+		std::string text;
+		float number;
+		bool isNumber;
+	};
+}
+
+static std::vector<LoggedSetting> loggedSettings;
 
 void Settings::updateModelCount()
 {
@@ -70,23 +84,61 @@ void Settings::useSettings(const TestSetting& setting)
 	updateModelCount();
 }
 
-void Settings::updateSetting(const std::string& _name, const std::string& _value)
+Settings::Handle Settings::getSetting(const std::string& _name)
 {
-	for (auto& val : settings)
+	for (unsigned int i = 0; i < loggedSettings.size(); i++)
 	{
-		if (val.first == _name)
-		{
-			val.second = _value;
-			return;
-		}
+		if (loggedSettings[i].name == _name)
+			return i;
 	}
 
-	settings.push_back(std::make_pair(_name, _value));
+	LoggedSetting setting;
+	setting.name = _name;
+	setting.number = 0.f;
+	setting.isNumber = false;
+	loggedSettings.push_back(setting);
+
+	return loggedSettings.size() - 1;
+}
+
+void Settings::updateSetting(Handle _setting, const std::string& _value)
+{
+	LoggedSetting& setting = loggedSettings[_setting];
+	setting.text = _value;
+	setting.isNumber = false;
+}
+
+void Settings::updateSetting(Handle _setting, float _value)
+{
+	LoggedSetting& setting = loggedSettings[_setting];
+	setting.number = _value;
+	setting.isNumber = true;
+}
+
+void Settings::updateSetting(const std::string& _name, const std::string& _value)
+{
+	updateSetting(getSetting(_name), _value);
 }
 
 void Settings::updateSetting(const std::string& _name, float _value)
 {
-	updateSetting(_name, std::to_string(_value));
+	updateSetting(getSetting(_name), _value);
+}
+
+unsigned int Settings::getSettingCount()
+{
+	return loggedSettings.size();
+}
+
+const std::string& Settings::getSettingName(Handle _setting)
+{
+	return loggedSettings[_setting].name;
+}
+
+std::string Settings::getSettingValue(Handle _setting)
+{
+	const LoggedSetting& setting = loggedSettings[_setting];
+	return setting.isNumber ? std::to_string(setting.number) : setting.text;
 }
 
 void Settings::increaseLights()
@@ -25,18 +25,32 @@ namespace Settings
 	extern unsigned int modelTriangleCount[NUM_MODELS];
 	
 	extern float cubeReflect;
+
+	// Stores the scene vertices as PackedVertex, the kernels are built with -D PACKED_VERTICES
+	extern bool packedVertices;
+	// Builds variants of the kernels with the number of lights and the supersampling as constants, see KernelVariants
+	extern bool specializeKernels;
 	
 	extern int superSampling;
 	extern bool sizeChanged;
 
-	extern std::vector<std::pair<std::string, std::string>> settings;
+	// Settings logged with the timers, registered by name the first time and then updated through their handle
+	typedef unsigned int Handle;
 
 	void updateModelCount();
 
 	void useSettings(const TestSetting& setting);
+	Handle getSetting(const std::string& _name);
+	void updateSetting(Handle _setting, const std::string& _value);
+	// The number is only turned into text when the setting is logged
+	void updateSetting(Handle _setting, float _value);
 	void updateSetting(const std::string& _name, const std::string& _value);
 	void updateSetting(const std::string& _name, float _value);
 
+	unsigned int getSettingCount();
+	const std::string& getSettingName(Handle _setting);
+	std::string getSettingValue(Handle _setting);
+
 	void increaseLights();
 	void decreaseLights();
 
@@ -0,0 +1,152 @@
+#pragma once
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMD_SSE2
+#include <emmintrin.h>
+#else
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#endif
+
+// Four lanes of floats or ints, with the operations RayPacket.h and CpuRenderer use. With SSE2 each maps to one
+// intrinsic, other CPUs such as ARM compute each lane on its own with the same float operations, so the results are
+// the same, only slower.
+namespace Simd
+{
+#ifdef SIMD_SSE2
+	typedef __m128 Float4;
+	typedef __m128i Int4;
+
+	inline Float4 zero() { return _mm_setzero_ps(); }
+	inline Float4 splat(float _a) { return _mm_set1_ps(_a); }
+	inline Int4 splatInt(int _a) { return _mm_set1_epi32(_a); }
+
+	inline Float4 load(const float* _p) { return _mm_loadu_ps(_p); }
+	inline Int4 load(const int* _p) { return _mm_loadu_si128((const __m128i*)_p); }
+	inline void store(float* _p, Float4 _a) { _mm_storeu_ps(_p, _a); }
+	inline void store(int* _p, Int4 _a) { _mm_storeu_si128((__m128i*)_p, _a); }
+
+	inline Float4 add(Float4 _a, Float4 _b) { return _mm_add_ps(_a, _b); }
+	inline Float4 sub(Float4 _a, Float4 _b) { return _mm_sub_ps(_a, _b); }
+	inline Float4 mul(Float4 _a, Float4 _b) { return _mm_mul_ps(_a, _b); }
+	inline Float4 div(Float4 _a, Float4 _b) { return _mm_div_ps(_a, _b); }
+	inline Float4 sqrt(Float4 _a) { return _mm_sqrt_ps(_a); }
+	inline Float4 minimum(Float4 _a, Float4 _b) { return _mm_min_ps(_a, _b); }
+	inline Float4 maximum(Float4 _a, Float4 _b) { return _mm_max_ps(_a, _b); }
+
+	inline Float4 cmpEq(Float4 _a, Float4 _b) { return _mm_cmpeq_ps(_a, _b); }
+	inline Float4 cmpLt(Float4 _a, Float4 _b) { return _mm_cmplt_ps(_a, _b); }
+	inline Float4 cmpLe(Float4 _a, Float4 _b) { return _mm_cmple_ps(_a, _b); }
+	inline Float4 cmpGt(Float4 _a, Float4 _b) { return _mm_cmpgt_ps(_a, _b); }
+	inline Float4 cmpGe(Float4 _a, Float4 _b) { return _mm_cmpge_ps(_a, _b); }
+	inline Int4 cmpEq(Int4 _a, Int4 _b) { return _mm_cmpeq_epi32(_a, _b); }
+
+	inline Float4 bitAnd(Float4 _a, Float4 _b) { return _mm_and_ps(_a, _b); }
+	inline Float4 bitAndNot(Float4 _a, Float4 _b) { return _mm_andnot_ps(_a, _b); }
+	inline Float4 bitOr(Float4 _a, Float4 _b) { return _mm_or_ps(_a, _b); }
+	inline Int4 bitAnd(Int4 _a, Int4 _b) { return _mm_and_si128(_a, _b); }
+	inline Int4 bitAndNot(Int4 _a, Int4 _b) { return _mm_andnot_si128(_a, _b); }
+	inline Int4 bitOr(Int4 _a, Int4 _b) { return _mm_or_si128(_a, _b); }
+
+	inline Int4 asInt(Float4 _a) { return _mm_castps_si128(_a); }
+	inline Float4 asFloat(Int4 _a) { return _mm_castsi128_ps(_a); }
+
+	// The sign bits of the lanes, lane 0 in bit 0
+	inline int moveMask(Float4 _a) { return _mm_movemask_ps(_a); }
+#else
+	struct Float4
+	{
+		float f[4];
+	};
+
+	struct Int4
+	{
+		int32_t i[4];
+	};
+
+	inline uint32_t toBits(float _value)
+	{
+		uint32_t bits;
+		std::memcpy(&bits, &_value, sizeof(bits));
+		return bits;
+	}
+
+	inline float fromBits(uint32_t _bits)
+	{
+		float value;
+		std::memcpy(&value, &_bits, sizeof(value));
+		return value;
+	}
+
+	inline float laneMask(bool _set)
+	{
+		return fromBits(_set ? 0xffffffffu : 0u);
+	}
+
+#define SIMD_LANES(_expression) \
+	Float4 result; \
+	for (int lane = 0; lane < 4; ++lane) \
+	{ \
+		result.f[lane] = (_expression); \
+	} \
+	return result
+
+#define SIMD_LANES_INT(_expression) \
+	Int4 result; \
+	for (int lane = 0; lane < 4; ++lane) \
+	{ \
+		result.i[lane] = (_expression); \
+	} \
+	return result
+
+	inline Float4 zero() { SIMD_LANES(0.f); }
+	inline Float4 splat(float _a) { SIMD_LANES(_a); }
+	inline Int4 splatInt(int _a) { SIMD_LANES_INT(_a); }
+
+	inline Float4 load(const float* _p) { SIMD_LANES(_p[lane]); }
+	inline Int4 load(const int* _p) { SIMD_LANES_INT(_p[lane]); }
+	inline void store(float* _p, Float4 _a) { std::memcpy(_p, _a.f, sizeof(_a.f)); }
+	inline void store(int* _p, Int4 _a) { std::memcpy(_p, _a.i, sizeof(_a.i)); }
+
+	inline Float4 add(Float4 _a, Float4 _b) { SIMD_LANES(_a.f[lane] + _b.f[lane]); }
+	inline Float4 sub(Float4 _a, Float4 _b) { SIMD_LANES(_a.f[lane] - _b.f[lane]); }
+	inline Float4 mul(Float4 _a, Float4 _b) { SIMD_LANES(_a.f[lane] * _b.f[lane]); }
+	inline Float4 div(Float4 _a, Float4 _b) { SIMD_LANES(_a.f[lane] / _b.f[lane]); }
+	inline Float4 sqrt(Float4 _a) { SIMD_LANES(std::sqrt(_a.f[lane])); }
+	// Like minps and maxps the second operand is returned when either is NaN
+	inline Float4 minimum(Float4 _a, Float4 _b) { SIMD_LANES(_a.f[lane] < _b.f[lane] ? _a.f[lane] : _b.f[lane]); }
+	inline Float4 maximum(Float4 _a, Float4 _b) { SIMD_LANES(_a.f[lane] > _b.f[lane] ? _a.f[lane] : _b.f[lane]); }
+
+	inline Float4 cmpEq(Float4 _a, Float4 _b) { SIMD_LANES(laneMask(_a.f[lane] == _b.f[lane])); }
+	inline Float4 cmpLt(Float4 _a, Float4 _b) { SIMD_LANES(laneMask(_a.f[lane] < _b.f[lane])); }
+	inline Float4 cmpLe(Float4 _a, Float4 _b) { SIMD_LANES(laneMask(_a.f[lane] <= _b.f[lane])); }
+	inline Float4 cmpGt(Float4 _a, Float4 _b) { SIMD_LANES(laneMask(_a.f[lane] > _b.f[lane])); }
+	inline Float4 cmpGe(Float4 _a, Float4 _b) { SIMD_LANES(laneMask(_a.f[lane] >= _b.f[lane])); }
+	inline Int4 cmpEq(Int4 _a, Int4 _b) { SIMD_LANES_INT(_a.i[lane] == _b.i[lane] ? -1 : 0); }
+
+	inline Float4 bitAnd(Float4 _a, Float4 _b) { SIMD_LANES(fromBits(toBits(_a.f[lane]) & toBits(_b.f[lane]))); }
+	inline Float4 bitAndNot(Float4 _a, Float4 _b) { SIMD_LANES(fromBits(~toBits(_a.f[lane]) & toBits(_b.f[lane]))); }
+	inline Float4 bitOr(Float4 _a, Float4 _b) { SIMD_LANES(fromBits(toBits(_a.f[lane]) | toBits(_b.f[lane]))); }
+	inline Int4 bitAnd(Int4 _a, Int4 _b) { SIMD_LANES_INT(_a.i[lane] & _b.i[lane]); }
+	inline Int4 bitAndNot(Int4 _a, Int4 _b) { SIMD_LANES_INT(~_a.i[lane] & _b.i[lane]); }
+	inline Int4 bitOr(Int4 _a, Int4 _b) { SIMD_LANES_INT(_a.i[lane] | _b.i[lane]); }
+
+	inline Int4 asInt(Float4 _a) { SIMD_LANES_INT((int32_t)toBits(_a.f[lane])); }
+	inline Float4 asFloat(Int4 _a) { SIMD_LANES(fromBits((uint32_t)_a.i[lane])); }
+
+	// The sign bits of the lanes, lane 0 in bit 0
+	inline int moveMask(Float4 _a)
+	{
+		int result = 0;
+		for (int lane = 0; lane < 4; ++lane)
+		{
+			result |= (int)(toBits(_a.f[lane]) >> 31) << lane;
+		}
+		return result;
+	}
+
+#undef SIMD_LANES
+#undef SIMD_LANES_INT
+#endif
+}
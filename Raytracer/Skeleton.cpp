@@ -8,9 +8,12 @@ Skeleton::Skeleton(cl::Context _context, Pose::c_ptr _bindPose)
 	: bindPose(_bindPose),
 	currentPose(new Pose(_bindPose)),
 	bufferUpdated(false),
-	bindToCurrentTransforms(_bindPose->getNumberOfBones()),
-	transformBuffer(_context, CL_MEM_READ_ONLY, sizeof(glm::mat4) * bindToCurrentTransforms.size())
+	bindToCurrentTransforms(_bindPose->getNumberOfBones())
 {
+	if (_context() != nullptr)
+	{
+		transformBuffer = cl::Buffer(_context, CL_MEM_READ_ONLY, sizeof(glm::mat4) * bindToCurrentTransforms.size());
+	}
 }
 
 void Skeleton::setWorld(const glm::mat4& _world)
@@ -35,14 +38,30 @@ cl::Buffer Skeleton::getTransformBuffer(cl::CommandQueue _queue) const
 	return transformBuffer;
 }
 
-void Skeleton::updateBuffer(cl::CommandQueue _queue) const
+const std::vector<glm::mat4>& Skeleton::getTransforms() const
 {
+	return bindToCurrentTransforms;
+}
+
+void Skeleton::updateTransforms() const
+{
+	// The last upload reads straight from the transforms and may still be queued behind an earlier frame
+	if (writeEvent())
+	{
+		writeEvent.wait();
+	}
+
 	bindPose->calculateOffsetTo(currentPose, bindToCurrentTransforms);
 
 	for (auto& transform : bindToCurrentTransforms)
 	{
 		transform = glm::transpose(world * transform);
 	}
+}
+
+void Skeleton::updateBuffer(cl::CommandQueue _queue) const
+{
+	updateTransforms();
 
-	_queue.enqueueWriteBuffer(transformBuffer, false, 0, sizeof(glm::mat4) * bindToCurrentTransforms.size(), bindToCurrentTransforms.data());
+	_queue.enqueueWriteBuffer(transformBuffer, false, 0, sizeof(glm::mat4) * bindToCurrentTransforms.size(), bindToCurrentTransforms.data(), nullptr, &writeEvent);
 }
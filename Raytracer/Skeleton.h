@@ -15,6 +15,7 @@ private:
 	mutable bool bufferUpdated;
 	mutable std::vector<glm::mat4> bindToCurrentTransforms;
 	mutable cl::Buffer transformBuffer;
+	mutable cl::Event writeEvent;
 
 public:
 	Skeleton();
@@ -24,6 +25,10 @@ public:
 	Pose::ptr getCurrentPose() const;
 
 	cl::Buffer getTransformBuffer(cl::CommandQueue _queue) const;
+	// The bone transforms of the last getTransformBuffer or updateTransforms call, transposed for the kernels
+	const std::vector<glm::mat4>& getTransforms() const;
+	// Recalculates the bone transforms from the current pose without uploading them
+	void updateTransforms() const;
 
 private:
 	void updateBuffer(cl::CommandQueue _queue) const;
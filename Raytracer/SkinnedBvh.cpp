@@ -0,0 +1,155 @@
+#include "SkinnedBvh.h"
+
+#include <algorithm>
+
+SkinnedBvh::SkinnedBvh(cl::Context _context, const Bvh& _bvh, const std::vector<AnimatedObjModel::VertexType>& _vertices,
+	const std::vector<uint32_t>& _indices, unsigned int _numBones, float _rebuildRatio)
+	: vertices(_vertices),
+	indices(_indices),
+	boneMins(_numBones, glm::vec4(1e30f)),
+	boneMaxs(_numBones, glm::vec4(-1e30f)),
+	bvh(_bvh),
+	buildCost(Bvh::calculateCost(_bvh.getNodes())),
+	rebuildRatio(_rebuildRatio),
+	hasRefittedNodes(false)
+{
+	// Every vertex follows a single bone, so the bind pose bounds per bone bound the model in every pose
+	for (const AnimatedObjModel::VertexType& vertex : vertices)
+	{
+		boneMins[vertex.bone] = glm::min(boneMins[vertex.bone], vertex.position);
+		boneMaxs[vertex.bone] = glm::max(boneMaxs[vertex.bone], vertex.position);
+	}
+
+	bvh.getRefitOrder(refitOrder, levelOffsets);
+
+	// Sized for the largest possible hierarchy, since rebuilds may add nodes
+	if (_context() != nullptr)
+	{
+		std::vector<int32_t> initialOrder(refitOrder);
+		initialOrder.resize(getNodeCapacity());
+		refitOrderBuffer = cl::Buffer(_context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(int32_t) * initialOrder.size(), initialOrder.data());
+	}
+}
+
+const Bvh& SkinnedBvh::getBvh() const
+{
+	return bvh;
+}
+
+const std::vector<AnimatedObjModel::VertexType>& SkinnedBvh::getVertices() const
+{
+	return vertices;
+}
+
+const std::vector<uint32_t>& SkinnedBvh::getIndices() const
+{
+	return indices;
+}
+
+int SkinnedBvh::getNodeCapacity() const
+{
+	return std::max(1, (int)(indices.size() / 3) * 2 - 1);
+}
+
+bool SkinnedBvh::rebuildIfDegraded(cl::CommandQueue _queue, const Skeleton& _skeleton, cl::Buffer _indexBuffer, int _firstIndex,
+	cl::Buffer _blasBuffer, int _nodeOffset)
+{
+	if (rebuildRatio <= 0.f || !hasRefittedNodes)
+	{
+		return false;
+	}
+
+	readNodesEvent.wait();
+	if (Bvh::calculateCost(refittedNodes) <= buildCost * rebuildRatio)
+	{
+		return false;
+	}
+
+	const std::vector<glm::mat4>& transforms = _skeleton.getTransforms();
+
+	std::vector<glm::vec3> positions(indices.size());
+	for (size_t i = 0; i < indices.size(); ++i)
+	{
+		const AnimatedObjModel::VertexType& vertex = vertices[indices[i]];
+		positions[i] = glm::vec3(glm::transpose(transforms[vertex.bone]) * vertex.position);
+	}
+
+	bvh.build(positions);
+	bvh.reorderTriangles(indices);
+	buildCost = Bvh::calculateCost(bvh.getNodes());
+	hasRefittedNodes = false;
+
+	const std::vector<Bvh::Node>& nodes = bvh.getNodes();
+	_queue.enqueueWriteBuffer(_indexBuffer, false, sizeof(uint32_t) * _firstIndex, sizeof(uint32_t) * indices.size(), indices.data());
+	_queue.enqueueWriteBuffer(_blasBuffer, false, sizeof(Bvh::Node) * _nodeOffset, sizeof(Bvh::Node) * nodes.size(), nodes.data());
+
+	bvh.getRefitOrder(refitOrder, levelOffsets);
+	_queue.enqueueWriteBuffer(refitOrderBuffer, false, 0, sizeof(int32_t) * refitOrder.size(), refitOrder.data());
+
+	return true;
+}
+
+void SkinnedBvh::refit(cl::CommandQueue _queue, cl::Kernel& _refitKernel, cl::Buffer _blasBuffer, int _nodeOffset,
+	cl::Buffer _triangleBuffer, int _triangleOffset, const cl::NDRange& _localSize,
+	std::vector<cl::Event>& _refitEvents)
+{
+	_refitKernel.setArg(0, _blasBuffer);
+	_refitKernel.setArg(1, _nodeOffset);
+	_refitKernel.setArg(2, refitOrderBuffer);
+	_refitKernel.setArg(5, _triangleBuffer);
+	_refitKernel.setArg(6, _triangleOffset);
+
+	for (size_t level = 0; level + 1 < levelOffsets.size(); ++level)
+	{
+		int first = levelOffsets[level];
+		int count = levelOffsets[level + 1] - first;
+		_refitKernel.setArg(3, first);
+		_refitKernel.setArg(4, count);
+
+		cl::NDRange globalSize(((count + _localSize[0] - 1) / _localSize[0]) * _localSize[0]);
+
+		cl::Event event;
+		_queue.enqueueNDRangeKernel(_refitKernel, cl::NullRange, globalSize, _localSize, nullptr, &event);
+		_refitEvents.push_back(event);
+	}
+
+	if (rebuildRatio <= 0.f)
+	{
+		return;
+	}
+
+	// Read back to decide on a rebuild next frame, the result is not needed before then
+	if (hasRefittedNodes)
+	{
+		readNodesEvent.wait();
+	}
+
+	refittedNodes.resize(bvh.getNodes().size());
+	_queue.enqueueReadBuffer(_blasBuffer, false, sizeof(Bvh::Node) * _nodeOffset, sizeof(Bvh::Node) * refittedNodes.size(),
+		refittedNodes.data(), nullptr, &readNodesEvent);
+	hasRefittedNodes = true;
+}
+
+void SkinnedBvh::calculateBounds(const Skeleton& _skeleton, glm::vec4& _min, glm::vec4& _max) const
+{
+	const std::vector<glm::mat4>& transforms = _skeleton.getTransforms();
+
+	glm::vec3 modelMin(1e30f);
+	glm::vec3 modelMax(-1e30f);
+	for (size_t i = 0; i < boneMins.size(); ++i)
+	{
+		if (boneMins[i].x > boneMaxs[i].x)
+		{
+			continue;
+		}
+
+		glm::vec3 boneMin;
+		glm::vec3 boneMax;
+		Bvh::transformBounds(glm::transpose(transforms[i]), boneMins[i], boneMaxs[i], boneMin, boneMax);
+		modelMin = glm::min(modelMin, boneMin);
+		modelMax = glm::max(modelMax, boneMax);
+	}
+
+	_min = glm::vec4(modelMin, 1.f);
+	_max = glm::vec4(modelMax, 1.f);
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#define __CL_ENABLE_EXCEPTIONS
+#define CL_GL_INTEROP
+#include "CL/cl.hpp"
+
+#include "AnimatedObjModel.h"
+#include "Bvh.h"
+#include "Skeleton.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Keeps the hierarchy of a skinned model valid by refitting its bounds after every skinning pass.
+// Refitting keeps the topology of the bind pose, so the hierarchy is rebuilt from the current pose
+// once its cost has grown past a given ratio of the cost it had when it was built.
+class SkinnedBvh
+{
+public:
+	typedef std::shared_ptr<SkinnedBvh> ptr;
+
+private:
+	std::vector<AnimatedObjModel::VertexType> vertices;
+	std::vector<uint32_t> indices;
+	std::vector<glm::vec4> boneMins;
+	std::vector<glm::vec4> boneMaxs;
+
+	Bvh bvh;
+	float buildCost;
+	float rebuildRatio;
+
+	std::vector<int32_t> refitOrder;
+	std::vector<unsigned int> levelOffsets;
+	cl::Buffer refitOrderBuffer;
+
+	std::vector<Bvh::Node> refittedNodes;
+	cl::Event readNodesEvent;
+	bool hasRefittedNodes;
+
+public:
+	// _bvh must have been built over the triangles of _indices, with the triangles already reordered.
+	// A _rebuildRatio of 0 disables the rebuilds.
+	SkinnedBvh(cl::Context _context, const Bvh& _bvh, const std::vector<AnimatedObjModel::VertexType>& _vertices,
+		const std::vector<uint32_t>& _indices, unsigned int _numBones, float _rebuildRatio = 1.5f);
+
+	const Bvh& getBvh() const;
+	// The skeletal vertices, shared between triangles
+	const std::vector<AnimatedObjModel::VertexType>& getVertices() const;
+	// Three vertex indices per triangle, in the order of the hierarchy
+	const std::vector<uint32_t>& getIndices() const;
+	int getNodeCapacity() const;
+
+	// Rebuilds the hierarchy from the current pose if the last refit degraded it too much. Rebuilding reorders the
+	// triangles of _indexBuffer from _firstIndex on, so this must run before the compact triangles are built.
+	bool rebuildIfDegraded(cl::CommandQueue _queue, const Skeleton& _skeleton, cl::Buffer _indexBuffer, int _firstIndex,
+		cl::Buffer _blasBuffer, int _nodeOffset);
+
+	// Updates the bounds bottom-up, one level per launch, from the compact skinned triangles
+	void refit(cl::CommandQueue _queue, cl::Kernel& _refitKernel, cl::Buffer _blasBuffer, int _nodeOffset,
+		cl::Buffer _triangleBuffer, int _triangleOffset, const cl::NDRange& _localSize,
+		std::vector<cl::Event>& _refitEvents);
+
+	// World space bounds of the current pose, from the bind pose bounds of the vertices of each bone
+	void calculateBounds(const Skeleton& _skeleton, glm::vec4& _min, glm::vec4& _max) const;
+};
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+//this struct must match the layout of Sphere in Types.hcl
+struct Sphere
+{
+	glm::vec4 position;
+	glm::vec4 diffuseReflectivity;
+	float radius;
+	float reflectFraction;
+	float padding[2];
+};
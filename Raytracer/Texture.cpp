@@ -0,0 +1,74 @@
+#include "Texture.h"
+
+#include "MipChain.h"
+
+#include <algorithm>
+#include <cmath>
+
+Texture::Texture(int _width, int _height, const uint8_t* _texels)
+	: width(_width),
+	height(_height),
+	levels(MipChain::getLevelCount(_width, _height)),
+	sizeLod(0.5f * std::log((float)_width * (float)_height) / std::log(2.f))
+{
+	int imageHeight;
+	MipChain::getImageSize(width, height, imageWidth, imageHeight);
+	MipChain::build(_texels, width, height, 4, texels);
+}
+
+int Texture::getWidth() const
+{
+	return width;
+}
+
+int Texture::getHeight() const
+{
+	return height;
+}
+
+glm::vec4 Texture::sample(const glm::vec2& _texCoord, float _lodBase) const
+{
+	float lod = std::min(std::max(_lodBase + sizeLod, 0.f), (float)(levels - 1));
+	int level = (int)lod;
+	float fraction = lod - level;
+
+	glm::vec4 texel = sampleLevel(_texCoord, level);
+	if (fraction > 0.f)
+	{
+		texel = glm::mix(texel, sampleLevel(_texCoord, level + 1), fraction);
+	}
+	return texel;
+}
+
+glm::vec4 Texture::sampleLevel(const glm::vec2& _texCoord, int _level) const
+{
+	int offsetX;
+	int offsetY;
+	MipChain::getLevelOffset(width, height, _level, offsetX, offsetY);
+	float levelWidth = (float)(width >> _level);
+	float levelHeight = (float)(height >> _level);
+
+	// Kept half a texel inside the level, so the filter never reaches into the next one
+	float x = std::min(std::max(std::min(std::max(_texCoord.x, 0.f), 1.f) * levelWidth, 0.5f), levelWidth - 0.5f) + offsetX - 0.5f;
+	float y = std::min(std::max(std::min(std::max(_texCoord.y, 0.f), 1.f) * levelHeight, 0.5f), levelHeight - 0.5f) + offsetY - 0.5f;
+	float floorX = std::floor(x);
+	float floorY = std::floor(y);
+	float fracX = x - floorX;
+	float fracY = y - floorY;
+	int x0 = (int)floorX;
+	int y0 = (int)floorY;
+
+	glm::vec4 bottom = glm::mix(getTexel(x0, y0), getTexel(x0 + 1, y0), fracX);
+	glm::vec4 top = glm::mix(getTexel(x0, y0 + 1), getTexel(x0 + 1, y0 + 1), fracX);
+	return glm::mix(bottom, top, fracY);
+}
+
+glm::vec4 Texture::getTexel(int _x, int _y) const
+{
+	// Only reached with a weight of zero, when a coordinate lies exactly on the last texel of the image
+	int x = std::min(_x, imageWidth - 1);
+	int y = std::min(_y, height - 1);
+
+	const uint8_t* texel = &texels[(y * imageWidth + x) * 4];
+	return glm::vec4(texel[0], texel[1], texel[2], texel[3]) * (1.f / 255.f);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Host copy of a texture for renderers that do not use OpenCL images. RGBA8 with the bottom row first and the mip chain
+// laid out as in MipChain.h, the same layout as the images TextureManager creates.
+class Texture
+{
+public:
+	typedef std::shared_ptr<const Texture> c_ptr;
+
+private:
+	int width;
+	int height;
+	int levels;
+	float sizeLod;	// The level of detail added by the size of the base level
+	int imageWidth;
+	std::vector<uint8_t> texels;
+
+public:
+	// _texels is the base level, the rest of the mip chain is generated
+	Texture(int _width, int _height, const uint8_t* _texels);
+
+	// The size of the base level
+	int getWidth() const;
+	int getHeight() const;
+
+	// Trilinear filtering with normalized coordinates clamped to the edge, like sampleMipChain in rayTracing.cl.
+	// _lodBase is the level of detail for a texture of a single texel.
+	glm::vec4 sample(const glm::vec2& _texCoord, float _lodBase) const;
+
+private:
+	glm::vec4 sampleLevel(const glm::vec2& _texCoord, int _level) const;
+	glm::vec4 getTexel(int _x, int _y) const;
+};
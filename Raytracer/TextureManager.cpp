@@ -1,5 +1,10 @@
 #include "TextureManager.h"
 
+#include "MipChain.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
 
 TextureManager::TextureManager(cl::Context _context)
 {
@@ -20,72 +25,169 @@ TextureManager::~TextureManager()
 void TextureManager::releaseAllLoadedTextures()
 {
 	loadedTextures.clear();
+	loadedHostTextures.clear();
+	atlasTextures.clear();
+	atlas = cl::Image2D();
+	atlasRects = cl::Buffer();
 }
 
-cl::Image2D TextureManager::loadTexture(const std::string& _filename)
+int TextureManager::loadTexture(const std::string& _filename)
 {
 	for (auto &texture : loadedTextures)
 	{
 		if(texture.first == _filename)
 			return texture.second;
 	}
-	if (!ilLoadImage(_filename.c_str()))
+
+	return addTexture(decodeImage(_filename));
+}
+
+Texture::c_ptr TextureManager::loadHostTexture(const std::string& _filename)
+{
+	for (auto& texture : loadedHostTextures)
 	{
-		throw std::exception(("Failed to load file: " + _filename).c_str());
+		if (texture.first == _filename)
+			return texture.second;
 	}
 
-	static const std::pair<int, int> formatOrders[] =
+	return addHostTexture(decodeImage(_filename));
+}
+
+TextureManager::DecodedImage TextureManager::decodeImage(const std::string& _filename)
+{
+	std::lock_guard<std::mutex> lock(devilMutex);
+
+	ilBindImage(image);
+	if (!ilLoadImage(_filename.c_str()))
 	{
-		std::make_pair(IL_RGBA, CL_RGBA),
-		std::make_pair(IL_RGB, CL_RGB),
-	};
+		throw std::runtime_error("Failed to load file: " + _filename);
+	}
 
-	static const std::pair<int, int> formatTypes[] =
+	if (!ilConvertImage(IL_RGBA, IL_UNSIGNED_BYTE))
 	{
-		std::make_pair(IL_FLOAT, CL_FLOAT),
-		std::make_pair(IL_UNSIGNED_BYTE, CL_UNORM_INT8),
-	};
-
-	cl::ImageFormat format(0, 0);
-	ILint imageFormat = ilGetInteger(IL_IMAGE_FORMAT);
-	ILint imageType = ilGetInteger(IL_IMAGE_TYPE);
-	for (auto& f : formatOrders)
+		throw std::runtime_error("Failed to convert image: " + _filename);
+	}
+
+	DecodedImage decoded;
+	decoded.filename = _filename;
+	decoded.width = ilGetInteger(IL_IMAGE_WIDTH);
+	decoded.height = ilGetInteger(IL_IMAGE_HEIGHT);
+
+	const ILubyte* data = ilGetData();
+	decoded.data.assign(data, data + ilGetInteger(IL_IMAGE_SIZE_OF_DATA));
+
+	return decoded;
+}
+
+int TextureManager::addTexture(const DecodedImage& _image)
+{
+	int index = atlasTextures.size();
+	atlasTextures.push_back(_image);
+	loadedTextures.push_back(std::make_pair(_image.filename, index));
+
+	return index;
+}
+
+Texture::c_ptr TextureManager::addHostTexture(const DecodedImage& _image)
+{
+	Texture::c_ptr texture(new Texture(_image.width, _image.height, _image.data.data()));
+	loadedHostTextures.push_back(std::make_pair(_image.filename, texture));
+
+	return texture;
+}
+
+void TextureManager::buildAtlas()
+{
+	static const int CHANNELS = 4;
+
+	std::vector<int> chainWidths(atlasTextures.size());
+	std::vector<int> chainHeights(atlasTextures.size());
+	std::vector<int> order(atlasTextures.size());
+	int atlasWidth = 1;
+	int area = 0;
+	for (size_t i = 0; i < atlasTextures.size(); ++i)
 	{
-		if (f.first == imageFormat)
-		{
-			format.image_channel_order = f.second;
-			break;
-		}
+		MipChain::getImageSize(atlasTextures[i].width, atlasTextures[i].height, chainWidths[i], chainHeights[i]);
+		order[i] = i;
+		atlasWidth = std::max(atlasWidth, chainWidths[i]);
+		area += chainWidths[i] * chainHeights[i];
 	}
+	atlasWidth = std::max(atlasWidth, (int)std::ceil(std::sqrt((float)area)));
+
+	// Shelves of chains sorted by height, which wastes little space for textures of a few common sizes
+	std::sort(order.begin(), order.end(), [&] (int _a, int _b) { return chainHeights[_a] > chainHeights[_b]; });
 
-	for (auto& f : formatTypes)
+	std::vector<cl_int4> rects(std::max<size_t>(atlasTextures.size(), 1));
+	int shelfX = 0;
+	int shelfY = 0;
+	int shelfHeight = 0;
+	for (int i : order)
 	{
-		if (f.first == imageType)
+		if (shelfX + chainWidths[i] > atlasWidth)
 		{
-			format.image_channel_data_type = f.second;
-			break;
+			shelfX = 0;
+			shelfY += shelfHeight;
+			shelfHeight = 0;
 		}
+
+		rects[i].s[0] = shelfX;
+		rects[i].s[1] = shelfY;
+		rects[i].s[2] = atlasTextures[i].width;
+		rects[i].s[3] = atlasTextures[i].height;
+		shelfX += chainWidths[i];
+		shelfHeight = std::max(shelfHeight, chainHeights[i]);
 	}
+	int atlasHeight = std::max(shelfY + shelfHeight, 1);
 
-	if (format.image_channel_data_type == 0 || format.image_channel_order == 0)
+	cl::Device device = context.getInfo<CL_CONTEXT_DEVICES>()[0];
+	if ((size_t)atlasWidth > device.getInfo<CL_DEVICE_IMAGE2D_MAX_WIDTH>() || (size_t)atlasHeight > device.getInfo<CL_DEVICE_IMAGE2D_MAX_HEIGHT>())
 	{
-		throw std::exception("Invalid image format");
+		throw std::runtime_error("Texture atlas too large for the device: " + std::to_string(atlasWidth) + "x" + std::to_string(atlasHeight));
 	}
 
-	ILubyte* data = ilGetData();
-	ILint width = ilGetInteger(IL_IMAGE_WIDTH);
-	ILint height = ilGetInteger(IL_IMAGE_HEIGHT);
+	std::vector<uint8_t> texels(atlasWidth * atlasHeight * CHANNELS);
+	std::vector<uint8_t> chain;
+	for (size_t i = 0; i < atlasTextures.size(); ++i)
+	{
+		MipChain::build(atlasTextures[i].data.data(), atlasTextures[i].width, atlasTextures[i].height, CHANNELS, chain);
+
+		int rowSize = chainWidths[i] * CHANNELS;
+		for (int y = 0; y < chainHeights[i]; ++y)
+		{
+			std::copy(&chain[y * rowSize], &chain[y * rowSize] + rowSize, &texels[((rects[i].s[1] + y) * atlasWidth + rects[i].s[0]) * CHANNELS]);
+		}
+	}
 
 	cl_int err = CL_SUCCESS;
-	cl::Image2D texture(context, CL_MEM_COPY_HOST_PTR | CL_MEM_READ_ONLY, format, ilGetInteger(IL_IMAGE_WIDTH),
-		ilGetInteger(IL_IMAGE_HEIGHT), 0, ilGetData(), &err);
+	atlas = cl::Image2D(context, CL_MEM_COPY_HOST_PTR | CL_MEM_READ_ONLY, cl::ImageFormat(CL_RGBA, CL_UNORM_INT8), atlasWidth,
+		atlasHeight, 0, texels.data(), &err);
 
 	if (err != CL_SUCCESS)
 	{
-		throw std::exception("Hey! Listen!");
+		throw std::runtime_error("Failed to create texture atlas " + std::to_string(atlasWidth) + "x" + std::to_string(atlasHeight) +
+			": " + std::to_string(err));
 	}
 
-	loadedTextures.push_back(std::make_pair(_filename, texture));
+	atlasRects = cl::Buffer(context, CL_MEM_COPY_HOST_PTR | CL_MEM_READ_ONLY, sizeof(cl_int4) * rects.size(), rects.data(), &err);
+	if (err != CL_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create texture atlas rects for " + std::to_string(rects.size()) + " textures: " +
+			std::to_string(err));
+	}
 
-	return texture;
-}
\ No newline at end of file
+	// The texels only live in the atlas from now on
+	for (DecodedImage& texture : atlasTextures)
+	{
+		std::vector<uint8_t>().swap(texture.data);
+	}
+}
+
+cl::Image2D TextureManager::getAtlas() const
+{
+	return atlas;
+}
+
+cl::Buffer TextureManager::getAtlasRects() const
+{
+	return atlasRects;
+}
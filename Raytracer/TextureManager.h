@@ -4,16 +4,38 @@
 #define CL_GL_INTEROP
 #include "CL/cl.hpp"
 
+#include "Texture.h"
+
+#include <cstdint>
+#include <mutex>
 #include <string>
 #include <vector>
 #include <IL/il.h>
 
 class TextureManager
 {
+public:
+	// RGBA8 pixels of an image file in host memory, ready to be turned into a texture on the thread owning the context
+	struct DecodedImage
+	{
+		std::string filename;
+		int width;
+		int height;
+		std::vector<uint8_t> data;
+	};
+
 private:
 	cl::Context context;
+	// DevIL keeps its state in globals, so only one thread at a time may use it
+	std::mutex devilMutex;
 	ILuint image;
-	std::vector<std::pair<std::string, cl::Image2D>> loadedTextures;
+	std::vector<std::pair<std::string, int>> loadedTextures;
+	std::vector<std::pair<std::string, Texture::c_ptr>> loadedHostTextures;
+
+	// Kept on the host until the atlas is built
+	std::vector<DecodedImage> atlasTextures;
+	cl::Image2D atlas;
+	cl::Buffer atlasRects;
 
 public:
 	TextureManager(cl::Context context);
@@ -21,5 +43,25 @@ public:
 
 	void releaseAllLoadedTextures();
 
-	cl::Image2D loadTexture(const std::string& _filename);
+	// Returns the index of the texture in the atlas
+	int loadTexture(const std::string& _filename);
+	// Loads a texture into host memory only, converted to RGBA8. Does not need a context.
+	Texture::c_ptr loadHostTexture(const std::string& _filename);
+
+	// Decodes a file without touching the context, can be called from any thread
+	DecodedImage decodeImage(const std::string& _filename);
+	// Create and cache the texture of a decoded file, later loads of the same file return it
+	int addTexture(const DecodedImage& _image);
+	Texture::c_ptr addHostTexture(const DecodedImage& _image);
+
+	// Packs the mip chains of every texture added so far into a single RGBA8 image, so a kernel can reach the textures
+	// of every model through one argument. Call once all textures are added.
+	void buildAtlas();
+	cl::Image2D getAtlas() const;
+	// One int4 per texture index with the position of its mip chain in the atlas and the size of its base level
+	cl::Buffer getAtlasRects() const;
+
+private:
+	TextureManager(const TextureManager&);
+	TextureManager& operator=(const TextureManager&);
 };
\ No newline at end of file
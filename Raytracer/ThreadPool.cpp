@@ -0,0 +1,151 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(unsigned int _numThreads)
+	: currentTask(nullptr),
+	batch(0),
+	stopping(false)
+{
+	remainingTasks = 0;
+
+	if (_numThreads == 0)
+	{
+		_numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+	}
+
+	for (unsigned int i = 0; i < _numThreads; ++i)
+	{
+		queues.push_back(std::unique_ptr<TaskQueue>(new TaskQueue));
+	}
+
+	for (unsigned int i = 1; i < _numThreads; ++i)
+	{
+		threads.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	startCondition.notify_all();
+
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+}
+
+unsigned int ThreadPool::getNumThreads() const
+{
+	return queues.size();
+}
+
+void ThreadPool::run(unsigned int _numTasks, const std::function<void (unsigned int)>& _task)
+{
+	if (_numTasks == 0)
+	{
+		return;
+	}
+
+	// Set before any task is queued, the queue mutexes make them visible to the thread that pops the task
+	currentTask = &_task;
+	remainingTasks = _numTasks;
+
+	// Consecutive tasks go to the same queue, neighbouring tiles tend to cost about the same
+	unsigned int numQueues = queues.size();
+	for (unsigned int q = 0; q < numQueues; ++q)
+	{
+		TaskQueue& queue = *queues[q];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		for (unsigned int i = _numTasks * q / numQueues; i < _numTasks * (q + 1) / numQueues; ++i)
+		{
+			queue.tasks.push_back(i);
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		++batch;
+	}
+	startCondition.notify_all();
+
+	work(0);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	while (remainingTasks != 0)
+	{
+		doneCondition.wait(lock);
+	}
+}
+
+void ThreadPool::workerLoop(unsigned int _queueIndex)
+{
+	unsigned int lastBatch = 0;
+
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			while (!stopping && batch == lastBatch)
+			{
+				startCondition.wait(lock);
+			}
+
+			if (stopping)
+			{
+				return;
+			}
+
+			lastBatch = batch;
+		}
+
+		work(_queueIndex);
+	}
+}
+
+void ThreadPool::work(unsigned int _queueIndex)
+{
+	unsigned int task;
+	while (popTask(_queueIndex, task))
+	{
+		(*currentTask)(task);
+
+		if (--remainingTasks == 0)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			doneCondition.notify_all();
+		}
+	}
+}
+
+bool ThreadPool::popTask(unsigned int _queueIndex, unsigned int& _task)
+{
+	{
+		TaskQueue& own = *queues[_queueIndex];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (!own.tasks.empty())
+		{
+			_task = own.tasks.front();
+			own.tasks.pop_front();
+			return true;
+		}
+	}
+
+	for (unsigned int i = 1; i < queues.size(); ++i)
+	{
+		TaskQueue& victim = *queues[(_queueIndex + i) % queues.size()];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.tasks.empty())
+		{
+			_task = victim.tasks.back();
+			victim.tasks.pop_back();
+			return true;
+		}
+	}
+
+	return false;
+}
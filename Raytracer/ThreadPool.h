@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs batches of tasks on a fixed set of threads. Every thread has its own queue of tasks, takes work from the
+// front of it and steals from the back of the others once it runs dry, so uneven tasks still balance out.
+class ThreadPool
+{
+private:
+	struct TaskQueue
+	{
+		std::mutex mutex;
+		std::deque<unsigned int> tasks;
+	};
+
+	// Queue 0 belongs to the thread calling run
+	std::vector<std::unique_ptr<TaskQueue>> queues;
+	std::vector<std::thread> threads;
+
+	std::mutex mutex;
+	std::condition_variable startCondition;
+	std::condition_variable doneCondition;
+	const std::function<void (unsigned int)>* currentTask;
+	std::atomic<unsigned int> remainingTasks;
+	unsigned int batch;
+	bool stopping;
+
+public:
+	// Uses one thread per hardware thread if _numThreads is 0, the calling thread counts as one of them
+	explicit ThreadPool(unsigned int _numThreads = 0);
+	~ThreadPool();
+
+	unsigned int getNumThreads() const;
+
+	// Runs _task for every index in [0, _numTasks) and returns once all of them are done
+	void run(unsigned int _numTasks, const std::function<void (unsigned int)>& _task);
+
+private:
+	ThreadPool(const ThreadPool&);
+	ThreadPool& operator=(const ThreadPool&);
+
+	void workerLoop(unsigned int _queueIndex);
+	void work(unsigned int _queueIndex);
+	bool popTask(unsigned int _queueIndex, unsigned int& _task);
+};
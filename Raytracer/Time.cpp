@@ -1,13 +1,21 @@
 #include "Time.h"
 
+#include <atomic>
 #include <iomanip>
 #include <iostream>
+#include <mutex>
+#include <stdexcept>
 
 #include "CLHelper.h"
 
-std::vector<std::pair<std::string, uint64_t>> Time::timers;
 std::chrono::high_resolution_clock::time_point Time::prevTimingPoint;
 
+// Only registration takes the lock, the arrays never move so the counters can be added to without it
+static std::mutex registerMutex;
+static std::string timerNames[Time::MAX_TIMERS];
+static std::atomic<uint64_t> timerValues[Time::MAX_TIMERS];
+static std::atomic<unsigned int> timerCount;
+
 static unsigned int widestName = 0;
 
 void Time::initTimer()
@@ -15,55 +23,88 @@ void Time::initTimer()
 	prevTimingPoint = std::chrono::high_resolution_clock::now();
 }
 
-void Time::registerTimer(const std::string& _name, uint64_t _initVal)
+Time::Handle Time::getTimer(const std::string& _name)
 {
+	std::lock_guard<std::mutex> lock(registerMutex);
+
+	unsigned int count = timerCount.load();
+	for (unsigned int i = 0; i < count; i++)
+	{
+		if (timerNames[i] == _name)
+			return i;
+	}
+
+	if (count == MAX_TIMERS)
+	{
+		throw std::runtime_error("Too many timers, could not add: " + _name);
+	}
+
 	if (_name.size() > widestName)
 		widestName = _name.size();
 
-	timers.push_back(std::make_pair(_name, 0));
+	timerNames[count] = _name;
+	timerValues[count].store(0);
+	timerCount.store(count + 1);
+
+	return count;
+}
+
+void Time::incTime(Handle _timer, uint64_t _nanoSeconds)
+{
+	timerValues[_timer].fetch_add(_nanoSeconds, std::memory_order_relaxed);
 }
 
-void Time::incTime(const std::string& _name, uint64_t _nanoSeconds)
+void Time::incTime(Handle _timer, const std::chrono::system_clock::duration& _duration)
 {
-	for (auto& val : timers)
+	incTime(_timer, (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(_duration).count());
+}
+
+void Time::incTime(Handle _timer, const cl::Event& _event)
+{
+	incTime(_timer, (uint64_t)getExecutionTime(_event));
+}
+
+void Time::incTime(Handle _timer, const std::vector<cl::Event>& _events)
+{
+	uint64_t total = 0;
+	for (const cl::Event& ev : _events)
 	{
-		if (val.first == _name)
-		{
-			val.second += _nanoSeconds;
-			return;
-		}
+		total += getExecutionTime(ev);
 	}
 
-	registerTimer(_name, _nanoSeconds);
+	incTime(_timer, total);
 }
 
 void Time::incTime(const std::string& _name, const std::chrono::system_clock::duration& _duration)
 {
-	incTime(_name, std::chrono::duration_cast<std::chrono::nanoseconds>(_duration).count());
+	incTime(getTimer(_name), _duration);
 }
 
-void Time::incTime(const std::string& _name, const cl::Event& _event)
+unsigned int Time::getTimerCount()
 {
-	incTime(_name, getExecutionTime(_event));
+	return timerCount.load();
 }
 
-void Time::incTime(const std::string& _name, const std::vector<cl::Event>& _events)
+const std::string& Time::getTimerName(Handle _timer)
 {
-	for (const cl::Event& ev : _events)
-	{
-		incTime(_name, ev);
-	}
+	return timerNames[_timer];
+}
+
+uint64_t Time::takeTime(Handle _timer)
+{
+	return timerValues[_timer].exchange(0);
 }
 
-void Time::printTimerToConsole(const std::pair<std::string, uint64_t>& _timer, double _deltaTime)
+void Time::printTimerToConsole(Handle _timer, uint64_t _nanoSeconds, double _deltaTime)
 {
-	std::cout << std::left << std::setw(widestName) << _timer.first << ": " << std::right << std::setw(5) << toSeconds(_timer.second) * 100.0 / _deltaTime << "%" << std::endl;
+	std::cout << std::left << std::setw(widestName) << timerNames[_timer] << ": " << std::right << std::setw(5) << toSeconds(_nanoSeconds) * 100.0 / _deltaTime << "%" << std::endl;
 }
 
 void Time::resetTimers()
 {
-	for (auto& timer : timers)
+	unsigned int count = timerCount.load();
+	for (unsigned int i = 0; i < count; i++)
 	{
-		timer.second = 0;
+		timerValues[i].store(0);
 	}
 }
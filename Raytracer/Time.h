@@ -9,17 +9,31 @@
 #include <string>
 #include <vector>
 
+// Named counters of nanoseconds. Timers are registered by name once and then added to through their handle, which is
+// an index into fixed arrays, so adding to a timer neither searches nor allocates and can be done from any thread.
 namespace Time
 {
-	extern std::vector<std::pair<std::string, uint64_t>> timers;
+	typedef unsigned int Handle;
+
+	static const unsigned int MAX_TIMERS = 64;
+
 	extern std::chrono::high_resolution_clock::time_point prevTimingPoint;
 
 	void initTimer();
-	void registerTimer(const std::string& _name, uint64_t _initVal = 0ui64);
-	void incTime(const std::string& _name, uint64_t _nanoSeconds);
+	// Returns the timer with _name, registering it the first time. Look the handle up once, such as into a static,
+	// the order of registration is the order of the timers in the log.
+	Handle getTimer(const std::string& _name);
+	void incTime(Handle _timer, uint64_t _nanoSeconds);
+	void incTime(Handle _timer, const std::chrono::system_clock::duration& _duration);
+	void incTime(Handle _timer, const cl::Event& _event);
+	void incTime(Handle _timer, const std::vector<cl::Event>& _events);
+	// Looks the timer up by name every time, for timers that are only added to a few times
 	void incTime(const std::string& _name, const std::chrono::system_clock::duration& _duration);
-	void incTime(const std::string& _name, const cl::Event& _event);
-	void incTime(const std::string& _name, const std::vector<cl::Event>& _events);
-	void printTimerToConsole(const std::pair<std::string, uint64_t>& _timer, double _deltaTime);
+
+	unsigned int getTimerCount();
+	const std::string& getTimerName(Handle _timer);
+	// Returns the time of the timer and sets it to zero
+	uint64_t takeTime(Handle _timer);
+	void printTimerToConsole(Handle _timer, uint64_t _nanoSeconds, double _deltaTime);
 	void resetTimers();
 }
@@ -1,37 +1,93 @@
 #include "Types.hcl"
 
-__kernel void transformVertices(__global Vertex* _vertIn, __global Vertex* _vertOut, const mat4 _transform, const mat4 _invTransform, int _numVert)
+IntersectTriangle makeIntersectTriangle(float4 _v0, float4 _v1, float4 _v2)
+{
+	IntersectTriangle triangle;
+	triangle.v0 = _v0;
+	triangle.e1 = _v1 - _v0;
+	triangle.e2 = _v2 - _v0;
+	return triangle;
+}
+
+// Skins one vertex per work item, a vertex shared by several triangles is only transformed once
+__kernel void transformSkeletalVertices(__global const SkeletalVertex* _vertIn, __global SceneVertex* _vertOut, __global const mat4* _transforms,
+	int _numVertices, int _vertexOffset)
 {
 	int id = get_global_id(0);
-	if (id >= _numVert)
+	if (id >= _numVertices)
+		return;
+
+	SkeletalVertex sv = _vertIn[id];
+	mat4 transform = _transforms[sv.bone];
+
+	storeSceneVertex(&_vertOut[_vertexOffset + id], matmul(&transform, &sv.position), sv.textureCoord.xy,
+		matmul(&transform, &sv.normal), matmul(&transform, &sv.tangent), matmul(&transform, &sv.bitangent));
+}
+
+// Converts the vertices of a rigid model to the scene vertex format, only needed when that is not Vertex itself
+__kernel void storeSceneVertices(__global const Vertex* _vertIn, __global SceneVertex* _vertOut, int _numVertices, int _vertexOffset)
+{
+	int id = get_global_id(0);
+	if (id >= _numVertices)
 		return;
 
 	Vertex v = _vertIn[id];
+	storeSceneVertex(&_vertOut[_vertexOffset + id], v.position, v.textureCoord.xy, v.normal, v.tangent, v.bitangent);
+}
 
-	v.position = matmul(&_transform, &v.position);
-	v.normal = matmul(&_invTransform, &v.normal);
-	v.tangent = matmul(&_transform, &v.tangent);
-	v.bitangent = matmul(&_transform, &v.bitangent);
+// Builds the compact triangles of a model from its indexed vertices. Run once when the scene is created for models that
+// do not move in object space, and after every skinning pass for the others.
+__kernel void buildIntersectTriangles(__global const SceneVertex* _vertices, __global const int* _indices, __global IntersectTriangle* _intersectOut,
+	int _numTriangles, int _triangleOffset, int _vertexOffset)
+{
+	int id = get_global_id(0);
+	if (id >= _numTriangles)
+		return;
 
-	_vertOut[id] = v;
+	__global const int* indices = &_indices[(_triangleOffset + id) * 3];
+	__global const SceneVertex* vertices = _vertices + _vertexOffset;
+	_intersectOut[_triangleOffset + id] = makeIntersectTriangle(loadScenePosition(&vertices[indices[0]]),
+		loadScenePosition(&vertices[indices[1]]), loadScenePosition(&vertices[indices[2]]));
 }
 
-__kernel void transformSkeletalVertices(__global SkeletalVertex* _vertIn, __global Vertex* _vertOut, __global mat4* _transforms, int _numVert)
+// Recalculates the bounds of one level of a hierarchy after its triangles have moved. The levels are processed
+// from the deepest up, so the children of an inner node are always up to date.
+__kernel void refitBvh(__global BvhNode* _nodes, int _nodeOffset, __global const int* _refitOrder, int _first, int _count,
+	__global const IntersectTriangle* _triangles, int _triangleOffset)
 {
 	int id = get_global_id(0);
-	if (id >= _numVert)
+	if (id >= _count)
 		return;
 
-	SkeletalVertex sv = _vertIn[id];
+	__global BvhNode* nodes = _nodes + _nodeOffset;
+	__global const IntersectTriangle* triangles = _triangles + _triangleOffset;
+	__global BvhNode* node = &nodes[_refitOrder[_first + id]];
 
-	mat4 transform = _transforms[sv.bone];
+	float4 nodeMin;
+	float4 nodeMax;
+	if (node->count > 0)
+	{
+		nodeMin = (float4)(INFINITY, INFINITY, INFINITY, 1.f);
+		nodeMax = (float4)(-INFINITY, -INFINITY, -INFINITY, 1.f);
+
+		for (int i = node->leftFirst; i < node->leftFirst + node->count; i++)
+		{
+			float4 v0 = triangles[i].v0;
+			float4 v1 = v0 + triangles[i].e1;
+			float4 v2 = v0 + triangles[i].e2;
+			nodeMin = fmin(nodeMin, fmin(v0, fmin(v1, v2)));
+			nodeMax = fmax(nodeMax, fmax(v0, fmax(v1, v2)));
+		}
+	}
+	else
+	{
+		__global const BvhNode* left = &nodes[node->leftFirst];
+		__global const BvhNode* right = &nodes[node->leftFirst + 1];
 
-	Vertex v;
-	v.position = matmul(&transform, &sv.position);
-	v.textureCoord = sv.textureCoord;
-	v.normal = matmul(&transform, &sv.normal);
-	v.tangent = matmul(&transform, &sv.tangent);
-	v.bitangent = matmul(&transform, &sv.bitangent);
+		nodeMin = fmin(left->min, right->min);
+		nodeMax = fmax(left->max, right->max);
+	}
 
-	_vertOut[id] = v;
+	node->min = nodeMin;
+	node->max = nodeMax;
 }
@@ -1,5 +1,6 @@
 #include "TubeGenerator.h"
 
+#include <algorithm>
 #include <ostream>
 
 template <typename vecType>
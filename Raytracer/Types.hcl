@@ -21,21 +21,65 @@ float4 matmul(const mat4* _mat, const float4* _vec)
 	return res;
 }
 
-typedef struct Ray
+// Kernels working on rays run over a queue with the indices of the rays that are still alive.
+// Returns the ray of this work item, or -1 past the end of the queue.
+int getQueuedRay(__global const int* _rayQueue, __global const int* _queueCount)
 {
-	float4 position;
-	float4 direction;
-	float4 diffuseReflectivity;
-	float4 surfaceNormal;
-	float4 reflectDir;
-	float distance;
-	float shininess;
-	float strength;
-	float totalStrength;
-	int inShadow;
-	int collideGroup;
-	int collideObject;
-} Ray;
+	int qid = get_global_id(0);
+	if (qid >= *_queueCount)
+		return -1;
+
+	return _rayQueue[qid];
+}
+
+// The state of the rays is stored as a structure of arrays in a single buffer, so every kernel only
+// streams the fields it uses. The layout must match RAY_STATE_SIZE in RayQueue.h.
+typedef struct Rays
+{
+	__global float4* position;
+	__global float4* direction;
+	__global float4* diffuseReflectivity;
+	__global float4* surfaceNormal;
+	__global float4* reflectDir;
+	__global float* distance;
+	__global float* shininess;
+	__global float* strength;
+	__global float* totalStrength;
+	__global uint* occlusion;	// Bit i is set if light i is occluded from the hit point
+	__global int* collideGroup;
+	__global int* collideObject;
+	__global float* hitU;
+	__global float* hitV;
+	// The ray cone around the ray, for the level of detail of textures. The width is at the position of the ray and
+	// the spread is the angle it grows with per unit of distance.
+	__global float* coneWidth;
+	__global float* coneSpread;
+} Rays;
+
+Rays getRays(__global float4* _rayData, int _capacity)
+{
+	Rays rays;
+	rays.position = _rayData;
+	rays.direction = rays.position + _capacity;
+	rays.diffuseReflectivity = rays.direction + _capacity;
+	rays.surfaceNormal = rays.diffuseReflectivity + _capacity;
+	rays.reflectDir = rays.surfaceNormal + _capacity;
+
+	__global float* scalars = (__global float*)(rays.reflectDir + _capacity);
+	rays.distance = scalars;
+	rays.shininess = scalars + _capacity;
+	rays.strength = scalars + 2 * _capacity;
+	rays.totalStrength = scalars + 3 * _capacity;
+	rays.occlusion = (__global uint*)(scalars + 4 * _capacity);
+	rays.collideGroup = (__global int*)(scalars + 5 * _capacity);
+	rays.collideObject = (__global int*)(scalars + 6 * _capacity);
+	rays.hitU = scalars + 7 * _capacity;
+	rays.hitV = scalars + 8 * _capacity;
+	rays.coneWidth = scalars + 9 * _capacity;
+	rays.coneSpread = scalars + 10 * _capacity;
+
+	return rays;
+}
 
 typedef struct Sphere
 {
@@ -65,10 +109,143 @@ typedef struct SkeletalVertex
 	int padding[3];
 } SkeletalVertex;
 
-typedef struct Triangle
+// 24 bytes instead of the 80 of Vertex, used for the scene vertices when built with -D PACKED_VERTICES. The normal and
+// tangent are octahedral encoded as two snorm16 each. Bit 16 of the tangent, the lowest bit of its second snorm16,
+// holds the sign of the bitangent.
+// The texture coordinate is stored as two halfs.
+typedef struct PackedVertex
+{
+	float position[3];
+	uint normal;
+	uint tangent;
+	uint textureCoord;
+} PackedVertex;
+
+#ifdef PACKED_VERTICES
+typedef PackedVertex SceneVertex;
+#else
+typedef Vertex SceneVertex;
+#endif
+
+float2 octEncode(float4 _direction)
+{
+	float4 n = _direction / fmax(fabs(_direction.x) + fabs(_direction.y) + fabs(_direction.z), 1e-20f);
+	float2 e = n.xy;
+	if (n.z < 0.f)
+	{
+		e = (1.f - fabs(n.yx)) * (float2)(n.x >= 0.f ? 1.f : -1.f, n.y >= 0.f ? 1.f : -1.f);
+	}
+
+	return e;
+}
+
+float4 octDecode(float2 _e)
+{
+	float4 n = (float4)(_e.x, _e.y, 1.f - fabs(_e.x) - fabs(_e.y), 0.f);
+	float t = fmax(-n.z, 0.f);
+	n.x += n.x >= 0.f ? -t : t;
+	n.y += n.y >= 0.f ? -t : t;
+	return normalize(n);
+}
+
+uint packSnorm2(float2 _v)
+{
+	int2 q = convert_int2_rte(clamp(_v, -1.f, 1.f) * 32767.f);
+	return (uint)(q.x & 0xFFFF) | ((uint)(q.y & 0xFFFF) << 16);
+}
+
+float2 unpackSnorm2(uint _v)
+{
+	return (float2)((short)(_v & 0xFFFF), (short)(_v >> 16)) / 32767.f;
+}
+
+void storeSceneVertex(__global SceneVertex* _out, float4 _position, float2 _textureCoord, float4 _normal, float4 _tangent, float4 _bitangent)
+{
+#ifdef PACKED_VERTICES
+	vstore3(_position.xyz, 0, _out->position);
+	vstore_half2(_textureCoord, 0, (__global half*)&_out->textureCoord);
+	_out->normal = packSnorm2(octEncode(_normal));
+
+	// The bitangent is rebuilt from the normal and tangent, only its handedness is kept
+	float4 rebuilt = cross(_normal, _tangent);
+	uint sign = dot(rebuilt, _bitangent) < 0.f ? 1 : 0;
+	_out->tangent = (packSnorm2(octEncode(_tangent)) & ~(1u << 16)) | (sign << 16);
+#else
+	_out->position = _position;
+	_out->textureCoord = (float4)(_textureCoord, 0.f, 0.f);
+	_out->normal = _normal;
+	_out->tangent = _tangent;
+	_out->bitangent = _bitangent;
+#endif
+}
+
+float4 loadScenePosition(__global const SceneVertex* _v)
+{
+#ifdef PACKED_VERTICES
+	return (float4)(vload3(0, _v->position), 1.f);
+#else
+	return _v->position;
+#endif
+}
+
+float2 loadSceneTextureCoord(__global const SceneVertex* _v)
+{
+#ifdef PACKED_VERTICES
+	return vload_half2(0, (__global const half*)&_v->textureCoord);
+#else
+	return _v->textureCoord.xy;
+#endif
+}
+
+void loadSceneFrame(__global const SceneVertex* _v, float4* _normal, float4* _tangent, float4* _bitangent)
+{
+#ifdef PACKED_VERTICES
+	*_normal = octDecode(unpackSnorm2(_v->normal));
+	*_tangent = octDecode(unpackSnorm2(_v->tangent & ~(1u << 16)));
+	*_bitangent = cross(*_normal, *_tangent) * ((_v->tangent & (1u << 16)) ? -1.f : 1.f);
+#else
+	*_normal = _v->normal;
+	*_tangent = _v->tangent;
+	*_bitangent = _v->bitangent;
+#endif
+}
+
+// The part of a triangle needed to find intersections, kept in its own buffer so traversal does not pull
+// the shading attributes through the cache. The edges are precomputed for Moller-Trumbore.
+typedef struct IntersectTriangle
+{
+	float4 v0;
+	float4 e1;
+	float4 e2;
+} IntersectTriangle;
+
+typedef struct BvhNode
+{
+	float4 min;
+	float4 max;
+	int leftFirst;
+	int count;
+} BvhNode;
+
+typedef struct Instance
+{
+	mat4 invWorld;
+	int nodeOffset;
+	int triangleOffset;
+	int groupID;
+	int vertexOffset;
+} Instance;
+
+// Transforms the shading attributes of an instance to world space, the rows of world and of the inverse transpose of world.
+// The maps are indices of the textures in the atlas.
+typedef struct InstanceShading
 {
-	Vertex v[3];
-} Triangle;
+	mat4 transform;
+	mat4 normalTransform;
+	int diffuseMap;
+	int normalMap;
+	int padding[2];
+} InstanceShading;
 
 typedef struct Light
 {
@@ -2,6 +2,8 @@
 
 #include <glm/glm.hpp>
 
+#include <cstdint>
+
 struct Vertex
 {
 	glm::vec4 position;
@@ -10,3 +12,12 @@ struct Vertex
 	glm::vec4 tangent;
 	glm::vec4 binormal;
 };
+
+//this struct must match the layout of PackedVertex in Types.hcl, the vertices are only packed by the kernels
+struct PackedVertex
+{
+	float position[3];
+	uint32_t normal;
+	uint32_t tangent;	//bit 16, the lowest bit of the second snorm16, is the sign of the bitangent
+	uint32_t textureCoord;
+};
@@ -11,22 +11,33 @@
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/random.hpp>
 
+#include <algorithm>
 #include <chrono>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <sstream>
+#include <stdexcept>
 #include <thread>
 #include <vector>
 
 #include "AnimatedObjModel.h"
 #include "CLHelper.h"
+#include "CLRenderer.h"
+#include "CpuRenderer.h"
+#include "EnqueueBenchmark.h"
+#include "FrameComparison.h"
 #include "Model.h"
 #include "ModelPaths.h"
 #include "ObjModel.h"
+#include "ObjParseBenchmark.h"
+#include "RayLayoutBenchmark.h"
 #include "Settings.h"
+#include "Sphere.h"
 #include "TestSettings.h"
 #include "TextureManager.h"
+#include "ThreadPool.h"
 #include "Time.h"
 #include "TubeGenerator.h"
 
@@ -51,32 +62,6 @@ void startTests()
 	logFile.close();
 }
 
-struct Ray
-{
-	glm::vec4 position;
-	glm::vec4 direction;
-	glm::vec4 diffuseReflectivity;
-	glm::vec4 surfaceNormal;
-	glm::vec4 reflectDir;
-	float distance;
-	float shininess;
-	float strength;
-	float totalStrength;
-	int inShadow;
-	int collideGroup;
-	int collideObject;
-	float padding[1];
-};
-
-struct Sphere
-{
-	glm::vec4 position;
-	glm::vec4 diffuseReflectivity;
-	float radius;
-	float reflectFraction;
-	float padding[2];
-};
-
 glm::vec2 dir;
 double prevXPos, prevYPos;
 glm::vec2 rotation;
@@ -117,6 +102,7 @@ const std::pair<glm::vec3, float> modelRotations[NUM_MODELS] = {
 	std::make_pair(glm::normalize(glm::vec3(0.f, 1.f, 0.f)), 15.f),
 };
 
+#ifndef HEADLESS_ONLY
 void keyCallback(GLFWwindow* _window, int _key, int _scanCode, int _action, int _mod)
 {
 	if (runningTests)
@@ -262,6 +248,7 @@ void resizeWindowCallback(GLFWwindow* _window, int _width, int _height)
 {
 	Settings::updateWindowSize(_width, _height);
 }
+#endif
 
 void openLogFile()
 {
@@ -279,18 +266,18 @@ void openLogFile()
 
 void printLogFileHeader()
 {
-	if (Settings::settings.empty())
+	if (Settings::getSettingCount() == 0)
 		return;
 
-	logFile << Settings::settings[0].first;
-	for (unsigned int i = 1; i < Settings::settings.size(); i++)
+	logFile << Settings::getSettingName(0);
+	for (unsigned int i = 1; i < Settings::getSettingCount(); i++)
 	{
-		logFile << ',' << Settings::settings[i].first;
+		logFile << ',' << Settings::getSettingName(i);
 	}
 
-	for (unsigned int i = 0; i < Time::timers.size(); i++)
+	for (unsigned int i = 0; i < Time::getTimerCount(); i++)
 	{
-		logFile << ',' << Time::timers[i].first;
+		logFile << ',' << Time::getTimerName(i);
 	}
 
 	logFile << std::endl;
@@ -298,13 +285,13 @@ void printLogFileHeader()
 
 void printSettingsToLogFile()
 {
-	if (Settings::settings.empty())
+	if (Settings::getSettingCount() == 0)
 		return;
 
-	logFile << Settings::settings[0].second;
-	for (unsigned int i = 1; i < Settings::settings.size(); i++)
+	logFile << Settings::getSettingValue(0);
+	for (unsigned int i = 1; i < Settings::getSettingCount(); i++)
 	{
-		logFile << ',' << Settings::settings[i].second;
+		logFile << ',' << Settings::getSettingValue(i);
 	}
 }
 
@@ -316,7 +303,8 @@ void printTimersAndReset()
 	
 	double d_deltaTime = std::chrono::duration<double>(deltaTime).count();
 
-	if (Time::timers.empty())
+	unsigned int timerCount = Time::getTimerCount();
+	if (timerCount == 0)
 		return;
 
 	if (!logFile.is_open())
@@ -327,17 +315,15 @@ void printTimersAndReset()
 
 	printSettingsToLogFile();
 
-	for (unsigned int i = 0; i < Time::timers.size(); i++)
+	for (unsigned int i = 0; i < timerCount; i++)
 	{
-		auto& val = Time::timers[i];
+		uint64_t time = Time::takeTime(i);
 
 		if (!runningTests)
 		{
-			Time::printTimerToConsole(Time::timers[i], d_deltaTime);
+			Time::printTimerToConsole(i, time, d_deltaTime);
 		}
-		logFile << ',' << toSeconds(val.second);
-		
-		val.second = 0;
+		logFile << ',' << toSeconds(time);
 	}
 
 	logFile << std::endl;
@@ -345,15 +331,14 @@ void printTimersAndReset()
 	logFile.flush();
 }
 
-unsigned int leastMultiple(unsigned int _val, unsigned int _mul)
-{
-	return ((_val + _mul - 1) / _mul) * _mul;
-}
-
 int frames = 0;
 
-void runTests(float _deltaTime)
+// _warmingUp holds back the start of a test until the renderer is ready for its settings, see Renderer::isWarmingUp
+void runTests(float _deltaTime, bool _warmingUp)
 {
+	if (beforeTest && _warmingUp)
+		return;
+
 	timeLeftInTest -= _deltaTime;
 	if (timeLeftInTest <= 0.f)
 	{
@@ -385,8 +370,79 @@ void runTests(float _deltaTime)
 	}
 }
 
+bool hasArgument(int _argc, char** _argv, const std::string& _argument)
+{
+	for (int i = 1; i < _argc; i++)
+	{
+		if (_argument == _argv[i])
+			return true;
+	}
+
+	return false;
+}
+
+// Returns the value following _argument, or _default if the argument is not given
+std::string getArgumentValue(int _argc, char** _argv, const std::string& _argument, const std::string& _default)
+{
+	for (int i = 1; i + 1 < _argc; i++)
+	{
+		if (_argument == _argv[i])
+			return _argv[i + 1];
+	}
+
+	return _default;
+}
+
+// Returns the integer following _argument, or _default if the argument is not given. Throws if the value is not a
+// whole number of at least _min.
+int getIntArgument(int _argc, char** _argv, const std::string& _argument, int _default, int _min)
+{
+	std::string value = getArgumentValue(_argc, _argv, _argument, "");
+	if (value.empty())
+		return _default;
+
+	size_t end = 0;
+	int result = 0;
+	try
+	{
+		result = std::stoi(value, &end);
+	}
+	catch (const std::exception&)
+	{
+		end = 0;
+	}
+
+	if (end == 0 || end != value.size() || result < _min)
+	{
+		throw std::runtime_error(_argument + " expects a whole number of at least " + std::to_string(_min) + ", got: " + value);
+	}
+
+	return result;
+}
+
+// Writes RGBA8 pixels with the bottom row first, as read back from the frame image, to a binary PPM file
+void writeFrame(const std::string& _filename, int _width, int _height, const std::vector<unsigned char>& _pixels)
+{
+	std::ofstream out(_filename, std::ios::out | std::ios::binary);
+	if (!out)
+	{
+		throw std::runtime_error("Failed to open output file: " + _filename);
+	}
+
+	out << "P6\n" << _width << " " << _height << "\n255\n";
+	for (int y = _height - 1; y >= 0; y--)
+	{
+		for (int x = 0; x < _width; x++)
+		{
+			out.write((const char*)&_pixels[(y * _width + x) * 4], 3);
+		}
+	}
+}
+
 int main(int argc, char** argv)
 {
+	const auto programStart = std::chrono::high_resolution_clock::now();
+
 	const static int width = 1024;
 	const static int height = 768;
 	Settings::updateWindowSize(width, height);
@@ -404,51 +460,114 @@ int main(int argc, char** argv)
 
 	Settings::updateSetting("NumBounces", (float)Settings::numBounces);
 	Settings::updateSetting("NumLights", (float)Settings::numLights);
+
+	// Without a window the frames are rendered to an image that is read back to the host,
+	// and the last one is written to the output file if there is one
+	// Renders one headless frame with both the OpenCL and the CPU renderer and compares them
+	const bool compareCpu = hasArgument(argc, argv, "--compare-cpu");
+#ifdef HEADLESS_ONLY
+	const bool headless = true;
+#else
+	const bool headless = compareCpu || hasArgument(argc, argv, "--headless");
+#endif
+	const std::string outputPath = getArgumentValue(argc, argv, "--output", "");
+
+	// Needs neither a window nor OpenCL, so it runs before either is created
+	if (hasArgument(argc, argv, "--benchmark-obj-parse"))
+	{
+		std::vector<std::string> paths;
+		for (const ModelResourcePaths& model : modelPaths)
+		{
+			paths.push_back(model.model);
+		}
+		paths.push_back("resources/tube.aobj");
+
+		runObjParseBenchmark(paths, 20);
+		return EXIT_SUCCESS;
+	}
+
+	// The CPU renderer does not use OpenCL at all
+	const bool useCpu = hasArgument(argc, argv, "--cpu");
+
+	Settings::packedVertices = hasArgument(argc, argv, "--packed-vertices");
+	Settings::specializeKernels = !hasArgument(argc, argv, "--generic-kernels");
 	
 	try
 	{
-		GLWindow window(WINDOW_TITLE, Settings::windowWidth, Settings::windowHeight);
-		window.setKeyCallback(&keyCallback);
-		window.setMouseCallback(&cursorPosCallback);
-		window.setFramebufferSizeCallback(&resizeWindowCallback);
+		const int headlessFrames = compareCpu ? 1 : getIntArgument(argc, argv, "--frames", 100, 1);
+		// 0 uses every hardware thread
+		const unsigned int cpuThreads = getIntArgument(argc, argv, "--threads", 0, 0);
+
+#ifdef HEADLESS_ONLY
+		GLWindow* const window = nullptr;
+#else
+		std::unique_ptr<GLWindow> windowOwner;
+		if (!headless)
+		{
+			windowOwner.reset(new GLWindow(WINDOW_TITLE, Settings::windowWidth, Settings::windowHeight));
+			windowOwner->setKeyCallback(&keyCallback);
+			windowOwner->setMouseCallback(&cursorPosCallback);
+			windowOwner->setFramebufferSizeCallback(&resizeWindowCallback);
+		}
+		GLWindow* const window = windowOwner.get();
+#endif
 
+		// Left empty for the CPU renderer, which makes the loaders keep everything on the host
 		cl::Context context;
 		std::vector<cl::Device> devices;
 		cl::CommandQueue queue;
-		initCL(context, devices, queue);
+		// The CPU renderer needs the host copies of the geometry and the textures, the comparison needs both
+		const bool keepHostData = useCpu || compareCpu;
 
-		window.createFramebuffer(Settings::windowWidth, Settings::windowHeight);
-		
-		cl::Program colorProgram = createProgramFromFile(context, devices, "writeImage.cl");
-		cl::Kernel accumulateColorKernel(colorProgram, "accumulateImage");
-		cl::Kernel dumpImageKernel(colorProgram, "dumpImage");
-
-		cl::Program rayProgram = createProgramFromFile(context, devices, "rayTracing.cl");
-		cl::Kernel primaryRaysKernel(rayProgram, "primaryRays");
-		cl::Kernel findClosestSpheresKernel(rayProgram, "findClosestSpheres");
-		cl::Kernel findClosestTrianglesKernel(rayProgram, "findClosestTriangles");
-		cl::Kernel detectShadowWithSpheres(rayProgram, "detectShadowWithSpheres");
-		cl::Kernel detectShadowWithTriangles(rayProgram, "detectShadowWithTriangles");
-		cl::Kernel updateRaysToLightKernel(rayProgram, "updateRaysToLight");
-		cl::Kernel moveRaysToIntersectionKernel(rayProgram, "moveRaysToIntersection");
-
-		cl::Program transformProgram = createProgramFromFile(context, devices, "Transform.cl");
-		cl::Kernel transformVerticesKernel(transformProgram, "transformVertices");
-		cl::Kernel transformSkeletalVerticesKernel(transformProgram, "transformSkeletalVertices");
-
-		int numRays;
-		cl::Buffer primaryRaysBuffer;
-		cl::Buffer accumulationBuffer;
-		cl::BufferRenderGL renderbuffer;
-		std::vector<cl::Memory> glObjects;
+		if (useCpu)
+		{
+			if (compareCpu)
+			{
+				throw std::runtime_error("--compare-cpu compares the OpenCL renderer against the CPU renderer and can not be combined with --cpu");
+			}
+			if (hasArgument(argc, argv, "--benchmark-ray-layout"))
+			{
+				throw std::runtime_error("--benchmark-ray-layout needs OpenCL and can not be combined with --cpu");
+			}
+			if (hasArgument(argc, argv, "--benchmark-enqueue"))
+			{
+				throw std::runtime_error("--benchmark-enqueue needs OpenCL and can not be combined with --cpu");
+			}
+		}
+		else if (headless)
+		{
+			initHeadlessCL(context, devices, queue);
+		}
+		else
+		{
+			initCL(context, devices, queue);
+		}
+
+		if (hasArgument(argc, argv, "--benchmark-ray-layout"))
+		{
+			runRayLayoutBenchmark(context, devices, queue, width * height, 100, Settings::linearLocalSize);
+			return EXIT_SUCCESS;
+		}
+
+		// About as many kernels as a frame with four bounces and one animated model
+		if (hasArgument(argc, argv, "--benchmark-enqueue"))
+		{
+			runEnqueueBenchmark(context, devices, queue, 50, 1000, Settings::linearLocalSize);
+			return EXIT_SUCCESS;
+		}
+
+#ifndef HEADLESS_ONLY
+		if (window)
+		{
+			// One framebuffer for each frame the OpenCL renderer has in flight
+			window->createFramebuffer(Settings::windowWidth, Settings::windowHeight, useCpu ? 1 : CLRenderer::FRAMES_IN_FLIGHT);
+		}
+#endif
 
 		Camera camera(45.f, (float)Settings::windowWidth / (float)Settings::windowHeight);
 		camera.setViewDirection(glm::vec3(0.f, 0.f, -1.f));
 		camera.setPosition(glm::vec3(0.f, 1.f, -2.f));
 
-		primaryRaysKernel.setArg(1, glm::transpose(camera.getInvViewProjectionMatrix()));
-		primaryRaysKernel.setArg(2, glm::vec4(camera.getPosition(), 1.f));
-
 		std::vector<Sphere> spheres(NUM_SPHERES);
 		for (Sphere& s : spheres)
 		{
@@ -458,12 +577,6 @@ int main(int argc, char** argv)
 			s.reflectFraction = glm::linearRand(0.5f, 0.7f);
 		}
 
-		cl::Buffer spheresBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(Sphere) * NUM_SPHERES, spheres.data());
-
-		findClosestSpheresKernel.setArg(2, spheresBuffer);
-		findClosestSpheresKernel.setArg(3, NUM_SPHERES);
-		findClosestSpheresKernel.setArg(4, 0);
-
 		std::vector<MovingLight> movLights;
 		for (unsigned int i = 0; i < Settings::MAX_LIGHTS; i++)
 		{
@@ -471,15 +584,6 @@ int main(int argc, char** argv)
 				glm::vec4(i, 0.f, 9.f, 1.f), glm::vec4(i, 0.f, -9.f, 1.f), 1.f / (i + 1)));
 		}
 
-		cl::Buffer lightBuffer(context, CL_MEM_READ_ONLY, sizeof(Light) * movLights.size());
-
-		detectShadowWithSpheres.setArg(2, spheresBuffer);
-		detectShadowWithSpheres.setArg(3, NUM_SPHERES);
-		detectShadowWithSpheres.setArg(4, 0);
-
-		updateRaysToLightKernel.setArg(2, lightBuffer);
-		updateRaysToLightKernel.setArg(3, 0);
-
 		typedef std::chrono::duration<double> dSec;
 
 		auto currentTime = std::chrono::high_resolution_clock::now();
@@ -491,27 +595,116 @@ int main(int argc, char** argv)
 
 		Model models[NUM_MODELS];
 
-		ModelInstance modelInstances[NUM_MODELS];
-		for (unsigned int i = 0; i < NUM_MODELS - 1; i++)
+		// Models are parsed and textures decoded on every hardware thread, only the buffers and images
+		// are created afterwards on this thread since it owns the context
+		auto loadStart = std::chrono::high_resolution_clock::now();
+
+		std::vector<std::string> texturePaths;
+		for (const ModelResourcePaths& paths : modelPaths)
 		{
-			ObjModel obj;
+			const std::string* textures[] = { &paths.diffuseTexture, &paths.normalTexture };
+			for (const std::string* texture : textures)
+			{
+				if (std::find(texturePaths.begin(), texturePaths.end(), *texture) == texturePaths.end())
+				{
+					texturePaths.push_back(*texture);
+				}
+			}
+		}
 
-			if (!obj.Initialize(context, modelPaths[i].model.c_str()))
+		ObjModel objModels[NUM_MODELS - 1];
+		bool usedFallback[NUM_MODELS - 1] = {};
+		std::chrono::high_resolution_clock::duration modelLoadTimes[NUM_MODELS - 1];
+		std::vector<TextureManager::DecodedImage> decodedImages(texturePaths.size());
+		std::vector<std::string> loadErrors(NUM_MODELS - 1 + texturePaths.size());
+		unsigned int loadThreads;
+		{
+			ThreadPool loadPool;
+			loadThreads = loadPool.getNumThreads();
+			loadPool.run(loadErrors.size(), [&] (unsigned int _task)
 			{
-				if (!obj.Initialize(context, fallbackModelPath.c_str()))
+				try
 				{
-					throw std::exception(("Failed to load model: " + modelPaths[i].model).c_str());
+					if (_task < NUM_MODELS - 1)
+					{
+						auto modelStart = std::chrono::high_resolution_clock::now();
+						// The fallback is loaded once the pool is done, so two tasks never write its cache at once
+						usedFallback[_task] = !objModels[_task].Load(modelPaths[_task].model.c_str());
+						modelLoadTimes[_task] = std::chrono::high_resolution_clock::now() - modelStart;
+					}
+					else
+					{
+						unsigned int texture = _task - (NUM_MODELS - 1);
+						decodedImages[texture] = textureManager.decodeImage(texturePaths[texture]);
+					}
 				}
-				else
+				catch (std::exception& e)
 				{
-					std::cout << "Warning: Failed to load model: " << modelPaths[i].model << ", using fallback model." << std::endl;
+					loadErrors[_task] = e.what();
 				}
+			});
+		}
+
+		for (const std::string& error : loadErrors)
+		{
+			if (!error.empty())
+			{
+				throw std::runtime_error(error);
+			}
+		}
+
+		for (unsigned int i = 0; i < NUM_MODELS - 1; i++)
+		{
+			if (usedFallback[i])
+			{
+				auto modelStart = std::chrono::high_resolution_clock::now();
+				if (!objModels[i].Load(fallbackModelPath.c_str()))
+				{
+					throw std::runtime_error("Failed to load model: " + modelPaths[i].model);
+				}
+				modelLoadTimes[i] += std::chrono::high_resolution_clock::now() - modelStart;
+			}
+		}
+
+		for (const TextureManager::DecodedImage& image : decodedImages)
+		{
+			if (keepHostData)
+			{
+				textureManager.addHostTexture(image);
+			}
+			if (!useCpu)
+			{
+				textureManager.addTexture(image);
+			}
+		}
+		decodedImages.clear();
+
+		ModelInstance modelInstances[NUM_MODELS];
+		for (unsigned int i = 0; i < NUM_MODELS - 1; i++)
+		{
+			ObjModel& obj = objModels[i];
+			if (usedFallback[i])
+			{
+				std::cout << "Warning: Failed to load model: " << modelPaths[i].model << ", using fallback model." << std::endl;
+			}
+
+			obj.InitializeBuffers(context, keepHostData);
+			Time::incTime("Model load " + std::to_string(i + 1), modelLoadTimes[i]);
+			Settings::modelTriangleCount[i] = obj.GetIndexCount() / 3;
+			models[i].data.reset(new ModelData(obj.getBuffer(), obj.GetVertexCount(), obj.getIndexBuffer(), obj.GetIndexCount() / 3));
+			models[i].data->setBvh(obj.getBvh(), obj.getBvhBuffer());
+			Time::incTime("BVH build " + std::to_string(i + 1), obj.getBvh().getBuildTime());
+			if (keepHostData)
+			{
+				models[i].data->setVertices(obj.getVertices(), obj.getIndices());
+				models[i].hostDiffuseMap = textureManager.loadHostTexture(modelPaths[i].diffuseTexture);
+				models[i].hostNormalMap = textureManager.loadHostTexture(modelPaths[i].normalTexture);
+			}
+			if (!useCpu)
+			{
+				models[i].diffuseMap = textureManager.loadTexture(modelPaths[i].diffuseTexture);
+				models[i].normalMap = textureManager.loadTexture(modelPaths[i].normalTexture);
 			}
-			Settings::modelTriangleCount[i] = obj.GetVertexCount() / 3;
-			models[i].data.reset(new ModelData(obj.getBuffer(), obj.GetVertexCount()));
-			models[i].transformedVertices = cl::Buffer(context, CL_MEM_READ_ONLY, obj.GetVertexCount() * sizeof(Vertex));
-			models[i].diffuseMap = textureManager.loadTexture(modelPaths[i].diffuseTexture);
-			models[i].normalMap = textureManager.loadTexture(modelPaths[i].normalTexture);
 
 			modelInstances[i].model = &models[i];
 			modelInstances[i].world.setTranslation(modelPositions[i]);
@@ -522,44 +715,93 @@ int main(int argc, char** argv)
 		ModelData::ptr modelData = aniModelLoader.loadFromFile("resources/tube.aobj");
 
 		models[NUM_MODELS - 1].data = modelData;
-		models[NUM_MODELS - 1].transformedVertices = cl::Buffer(context, CL_MEM_READ_ONLY, modelData->getVertexCount() * sizeof(Vertex));
-		models[NUM_MODELS - 1].diffuseMap = textureManager.loadTexture(modelPaths[NUM_MODELS - 1].diffuseTexture);
-		models[NUM_MODELS - 1].normalMap = textureManager.loadTexture(modelPaths[NUM_MODELS - 1].normalTexture);
+		if (keepHostData)
+		{
+			models[NUM_MODELS - 1].hostDiffuseMap = textureManager.loadHostTexture(modelPaths[NUM_MODELS - 1].diffuseTexture);
+			models[NUM_MODELS - 1].hostNormalMap = textureManager.loadHostTexture(modelPaths[NUM_MODELS - 1].normalTexture);
+		}
+		if (!useCpu)
+		{
+			models[NUM_MODELS - 1].diffuseMap = textureManager.loadTexture(modelPaths[NUM_MODELS - 1].diffuseTexture);
+			models[NUM_MODELS - 1].normalMap = textureManager.loadTexture(modelPaths[NUM_MODELS - 1].normalTexture);
+		}
 
 		modelInstances[NUM_MODELS - 1].model = models + NUM_MODELS - 1;
 		modelInstances[NUM_MODELS - 1].world.setTranslation(modelPositions[NUM_MODELS - 1]);
 		modelInstances[NUM_MODELS - 1].world.setScale(glm::vec3(modelScales[NUM_MODELS - 1]));
 		modelInstances[NUM_MODELS - 1].skeleton = Skeleton(context, modelData->getBindPose());
 
+		if (!useCpu)
+		{
+			textureManager.buildAtlas();
+		}
+
 		Settings::updateModelCount();
 
-		cl::NDRange global2D;
-		cl::NDRange linearGlobalSize;
+		auto loadTime = std::chrono::high_resolution_clock::now() - loadStart;
+		Time::incTime("Asset loading", loadTime);
+		std::cout << "Loaded assets in " << std::fixed << std::setprecision(1) << dSec(loadTime).count() * 1000.0
+			<< " ms on " << loadThreads << " threads" << std::endl;
+
+		std::unique_ptr<Renderer> renderer;
+		if (useCpu)
+		{
+			renderer.reset(new CpuRenderer(window, models, NUM_MODELS, cpuThreads));
+		}
+		else
+		{
+			renderer.reset(new CLRenderer(context, devices, queue, window, models, NUM_MODELS, textureManager.getAtlas(),
+				textureManager.getAtlasRects(), spheres, Settings::MAX_LIGHTS));
+		}
+
+		// Renders the same frames as renderer, to compare with at the end
+		std::unique_ptr<Renderer> referenceRenderer;
+		if (compareCpu)
+		{
+			referenceRenderer.reset(new CpuRenderer(nullptr, models, NUM_MODELS, cpuThreads));
+		}
 		
 		Settings::updateSetting("Local2DSize", std::to_string(Settings::local2D[0]) + "x" + std::to_string(Settings::local2D[1]));
 		Settings::updateSetting("LocalLinearSize", std::to_string(Settings::linearLocalSize[0]));
-		
-		accumulateColorKernel.setArg(3, lightBuffer);
 
-		while (!window.shouldClose())
+		int renderedFrames = 0;
+		auto renderStart = std::chrono::high_resolution_clock::now();
+
+		// Filled again every frame without reallocating
+		std::vector<Light> pointLights(movLights.size());
+
+		const Settings::Handle numFramesSetting = Settings::getSetting("NumFrames");
+		const Time::Handle durationTimer = Time::getTimer("Duration");
+
+#ifdef HEADLESS_ONLY
+		while (renderedFrames < headlessFrames)
+#else
+		while (headless ? renderedFrames < headlessFrames : !window->shouldClose())
+#endif
 		{
+			renderedFrames++;
 			frames++;
-			Settings::updateSetting("NumFrames", (float)frames);
+			Settings::updateSetting(numFramesSetting, (float)frames);
 
 			prevTime = currentTime;
 			currentTime = std::chrono::high_resolution_clock::now();
 
-			Time::incTime("Duration", currentTime - prevTime);
+			Time::incTime(durationTimer, currentTime - prevTime);
 			double deltaTime = dSec(currentTime - prevTime).count();
 
 			if (runningTests)
 			{
-				runTests((float)deltaTime);
+				runTests((float)deltaTime, renderer->isWarmingUp());
 			}
 			else if (currentTime - prevPrint > MEASURE_TIME)
 			{
 				prevPrint += MEASURE_TIME;
-				window.setTitle(WINDOW_TITLE + " | FPS: " + std::to_string((int)(frames / MEASURE_TIME_D)));
+#ifndef HEADLESS_ONLY
+				if (window)
+				{
+					window->setTitle(WINDOW_TITLE + " | FPS: " + std::to_string((int)(frames / MEASURE_TIME_D)));
+				}
+#endif
 				std::cout << "FPS: " << std::fixed << std::setprecision(1) << frames / MEASURE_TIME_D << ", " << std::setprecision(2) << 1000.0 * MEASURE_TIME_D / frames << " ms/F" << std::endl;
 				printTimersAndReset();
 				std::cout << std::endl;
@@ -569,7 +811,12 @@ int main(int argc, char** argv)
 
 			if (Settings::shouldChangeWindowSize)
 			{
-				window.setWindowSize(Settings::windowWidth, Settings::windowHeight);
+#ifndef HEADLESS_ONLY
+				if (window)
+				{
+					window->setWindowSize(Settings::windowWidth, Settings::windowHeight);
+				}
+#endif
 				Settings::shouldChangeWindowSize = false;
 			}
 
@@ -577,56 +824,24 @@ int main(int argc, char** argv)
 			{
 				Settings::sizeChanged = false;
 
-				window.updateFramebuffer(Settings::windowWidth, Settings::windowHeight);
-
 				Settings::updateSetting("WindowWidth", (float)Settings::windowWidth);
 				Settings::updateSetting("WindowHeight", (float)Settings::windowHeight);
 
-				renderbuffer = cl::BufferRenderGL(context, CL_MEM_READ_WRITE, window.getRenderbuffer());
-
-				glObjects.clear();
-				glObjects.push_back(renderbuffer);
-		
-				numRays = Settings::windowWidth * Settings::windowHeight * Settings::superSampling * Settings::superSampling;
-				primaryRaysBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, numRays * sizeof(Ray));
-				accumulationBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, numRays * sizeof(cl_float4));
-
-				primaryRaysKernel.setArg(0, primaryRaysBuffer);
-				primaryRaysKernel.setArg(3, Settings::windowWidth * Settings::superSampling);
-				primaryRaysKernel.setArg(4, Settings::windowHeight * Settings::superSampling);
-				primaryRaysKernel.setArg(5, accumulationBuffer);
-				
-				findClosestSpheresKernel.setArg(0, primaryRaysBuffer);
-				findClosestSpheresKernel.setArg(1, numRays);
-
-				detectShadowWithSpheres.setArg(0, primaryRaysBuffer);
-				detectShadowWithSpheres.setArg(1, numRays);
-
-				updateRaysToLightKernel.setArg(0, primaryRaysBuffer);
-				updateRaysToLightKernel.setArg(1, numRays);
-
-				moveRaysToIntersectionKernel.setArg(0, primaryRaysBuffer);
-				moveRaysToIntersectionKernel.setArg(1, numRays);
-
-				findClosestTrianglesKernel.setArg(0, primaryRaysBuffer);
-				findClosestTrianglesKernel.setArg(1, numRays);
-
-				detectShadowWithTriangles.setArg(0, primaryRaysBuffer);
-				detectShadowWithTriangles.setArg(1, numRays);
-
-				dumpImageKernel.setArg(0, accumulationBuffer);
-				dumpImageKernel.setArg(1, primaryRaysBuffer);
-				dumpImageKernel.setArg(2, renderbuffer);
-		
-				accumulateColorKernel.setArg(0, accumulationBuffer);
-				accumulateColorKernel.setArg(1, primaryRaysBuffer);
-				accumulateColorKernel.setArg(2, numRays);
+				renderer->finishFrames();
+#ifndef HEADLESS_ONLY
+				if (window)
+				{
+					window->updateFramebuffer(Settings::windowWidth, Settings::windowHeight);
+				}
+#endif
+				renderer->resize(Settings::windowWidth, Settings::windowHeight);
+				if (referenceRenderer)
+				{
+					referenceRenderer->resize(Settings::windowWidth, Settings::windowHeight);
+				}
 				
 				camera.setScreenRatio((float)Settings::windowWidth / (float)Settings::windowHeight);
 			}
-			
-			global2D = cl::NDRange(leastMultiple(Settings::windowWidth, Settings::local2D[0]), leastMultiple(Settings::windowHeight, Settings::local2D[1]));
-			linearGlobalSize = cl::NDRange(leastMultiple(numRays, Settings::linearLocalSize[0]));
 
 			if (dir != glm::vec2(0.f))
 			{
@@ -645,13 +860,10 @@ int main(int argc, char** argv)
 				bone.getLocalTransform().setOrientation(glm::quat(glm::rotate((sinf(animationTime) + 1.f) * 180.f / (aniBones.size() - 1), glm::vec3(0.f, 0.f, 1.f))));
 			}
 			
-			findClosestTrianglesKernel.setArg(4, Settings::cubeReflect);
-
-			std::vector<Light> pointLights;
-			for (MovingLight& l : movLights)
+			for (size_t i = 0; i < movLights.size(); i++)
 			{
-				l.onFrame((float)deltaTime);
-				pointLights.push_back(l.light);
+				movLights[i].onFrame((float)deltaTime);
+				pointLights[i] = movLights[i].light;
 			}
 
 			for (unsigned int i = 0; i < Settings::numLights; i++)
@@ -660,32 +872,6 @@ int main(int argc, char** argv)
 				spheres[i].radius = 0.1f;
 			}
 
-			std::vector<cl::Event> events;
-
-			cl::Event writeLightsEvent, writeSpheresEvent;
-			queue.enqueueWriteBuffer(lightBuffer, false, 0, sizeof(Light) * pointLights.size(), pointLights.data(), &events, &writeLightsEvent);
-			queue.enqueueWriteBuffer(spheresBuffer, false, 0, sizeof(Sphere) * Settings::numLights, spheres.data(), &events, &writeSpheresEvent);
-
-			window.clearFramebuffer(1.f, 0.f, 0.f);
-			glFinish();
-
-			auto startCL = std::chrono::high_resolution_clock::now();
-
-			primaryRaysKernel.setArg(1, glm::transpose(camera.getInvViewProjectionMatrix()));
-			primaryRaysKernel.setArg(2, glm::vec4(camera.getPosition(), 1.f));
-
-			std::vector<cl::Event> intersectSpheresEvents;
-			std::vector<cl::Event> triangleEvents;
-			std::vector<cl::Event> updateRaysToLights;
-			std::vector<cl::Event> sphereShadowEvents;
-			std::vector<cl::Event> triangleShadowEvents;
-			std::vector<cl::Event> accumulateColorEvents;
-			std::vector<cl::Event> moveRaysEvents;
-			std::vector<cl::Event> transformModelEvents;
-
-			cl::NDRange superSampledGlobal2D(global2D[0] * Settings::superSampling, global2D[1] * Settings::superSampling);
-			cl::Event primEvent = runKernel(queue, primaryRaysKernel, superSampledGlobal2D, Settings::local2D, events);
-
 			for (unsigned int k = 0; k < NUM_MODELS; k++)
 			{
 				ModelInstance& model = modelInstances[k];
@@ -696,112 +882,85 @@ int main(int argc, char** argv)
 						glm::quat(glm::rotate(modelRotations[k].second * (float)deltaTime, modelRotations[k].first)) *
 						model.world.getOrientation());
 
-					const glm::mat4& world = model.world.getTransform();
-
 					if (model.model->data->isAnimated())
 					{
-						model.skeleton.setWorld(world);
-
-						transformSkeletalVerticesKernel.setArg(0, model.model->data->getVertexBuffer());
-						transformSkeletalVerticesKernel.setArg(1, model.model->transformedVertices);
-						transformSkeletalVerticesKernel.setArg(2, model.skeleton.getTransformBuffer(queue));
-						int vertexCount = model.model->data->getVertexCount();
-						transformSkeletalVerticesKernel.setArg(3, vertexCount);
-						transformModelEvents.push_back(runKernel(queue, transformSkeletalVerticesKernel, cl::NDRange(leastMultiple(vertexCount, Settings::linearLocalSize[0])), Settings::linearLocalSize, events));
-					}
-					else
-					{
-						glm::mat4 invTranspose = glm::inverse(world);
-
-						transformVerticesKernel.setArg(0, model.model->data->getVertexBuffer());
-						transformVerticesKernel.setArg(1, model.model->transformedVertices);
-						transformVerticesKernel.setArg(2, glm::transpose(world));
-						transformVerticesKernel.setArg(3, invTranspose);
-						int vertexCount = model.model->data->getVertexCount();
-						transformVerticesKernel.setArg(4, vertexCount);
-						transformModelEvents.push_back(runKernel(queue, transformVerticesKernel, cl::NDRange(leastMultiple(vertexCount, Settings::linearLocalSize[0])), Settings::linearLocalSize, events));
+						// The skeleton transforms already include world, so the vertices end up in world space
+						model.skeleton.setWorld(model.world.getTransform());
 					}
 				}
 			}
 
-			for (unsigned int j = 0; j < Settings::numBounces; j++)
+			FrameState frame;
+			frame.invViewProjection = camera.getInvViewProjectionMatrix();
+			frame.cameraPosition = camera.getPosition();
+			frame.instances = modelInstances;
+			frame.spheres = &spheres;
+			frame.lights = &pointLights;
+			renderer->render(frame);
+			if (referenceRenderer)
 			{
-				intersectSpheresEvents.push_back(runKernel(queue, findClosestSpheresKernel, linearGlobalSize, Settings::linearLocalSize, events));
+				referenceRenderer->render(frame);
+			}
 
-				for (unsigned int k = 0; k < NUM_MODELS; k++)
-				{
-					ModelInstance& model = modelInstances[k];
+			// The first frame is waited for, so it is shown right away and the time to it is accurate
+			if (renderedFrames == 1)
+			{
+				renderer->finishFrames();
+			}
 
-					if (Settings::showModels[k])
-					{
-						findClosestTrianglesKernel.setArg(2, model.model->transformedVertices);
-						findClosestTrianglesKernel.setArg(3, model.model->data->getVertexCount() / 3);
-						findClosestTrianglesKernel.setArg(5, model.model->diffuseMap);
-						findClosestTrianglesKernel.setArg(6, model.model->normalMap);
-						findClosestTrianglesKernel.setArg(7, k + 1);
-						triangleEvents.push_back(runKernel(queue, findClosestTrianglesKernel, linearGlobalSize, Settings::linearLocalSize, events));
-					}
-				}
-				moveRaysEvents.push_back(runKernel(queue, moveRaysToIntersectionKernel, linearGlobalSize, Settings::linearLocalSize, events));
+			auto drawStart = std::chrono::high_resolution_clock::now();
+#ifndef HEADLESS_ONLY
+			if (window)
+			{
+				window->drawFramebuffer();
+			}
+#endif
+			auto drawEnd = std::chrono::high_resolution_clock::now();
 
-				for (unsigned int i = 0; i < Settings::numLights; i++)
-				{
-					updateRaysToLightKernel.setArg(3, i);
-					updateRaysToLights.push_back(runKernel(queue, updateRaysToLightKernel, linearGlobalSize, Settings::linearLocalSize, events));
-					sphereShadowEvents.push_back(runKernel(queue, detectShadowWithSpheres, linearGlobalSize, Settings::linearLocalSize, events));
-					for (unsigned int k = 0; k < NUM_MODELS; k++)
-					{
-						ModelInstance& model = modelInstances[k];
-
-						if (Settings::showModels[k])
-						{
-							detectShadowWithTriangles.setArg(2, model.model->transformedVertices);
-							detectShadowWithTriangles.setArg(3, model.model->data->getVertexCount() / 3);
-							detectShadowWithTriangles.setArg(4, k + 1);
-							triangleShadowEvents.push_back(runKernel(queue, detectShadowWithTriangles, linearGlobalSize, Settings::linearLocalSize, events));
-						}
-					}
+			if (window)
+			{
+				static const Time::Handle blitTimer = Time::getTimer("OpenGL blit and swap");
+				Time::incTime(blitTimer, drawEnd - drawStart);
+			}
 
-					accumulateColorKernel.setArg(4, i);
-					accumulateColorEvents.push_back(runKernel(queue, accumulateColorKernel, linearGlobalSize, Settings::linearLocalSize, events));
-				}
+			if (renderedFrames == 1)
+			{
+				std::cout << "Time to first frame: " << std::fixed << std::setprecision(1)
+					<< dSec(drawEnd - programStart).count() * 1000.0 << " ms" << std::endl;
 			}
+		}
 
-			cl::Event aqEvent;
-			queue.enqueueAcquireGLObjects(&glObjects, &events, &aqEvent);
-			events.push_back(aqEvent);
-			
-			dumpImageKernel.setArg(3, Settings::superSampling);
-			cl::Event dumpEvent = runKernel(queue, dumpImageKernel, global2D, Settings::local2D, events);
+		renderer->finishFrames();
 
-			cl::Event relEvent;
-			queue.enqueueReleaseGLObjects(&glObjects, &events, &relEvent);
+		if (headless)
+		{
+			double renderTime = dSec(std::chrono::high_resolution_clock::now() - renderStart).count();
+			std::cout << "Rendered " << renderedFrames << " frames in " << std::fixed << std::setprecision(2) << renderTime << " s, "
+				<< 1000.0 * renderTime / renderedFrames << " ms/F" << std::endl;
+			printTimersAndReset();
 
-			auto endCL = std::chrono::high_resolution_clock::now();
+			// Only a frame that was rendered is written
+			if (!outputPath.empty() && renderedFrames > 0)
+			{
+				writeFrame(outputPath, Settings::windowWidth, Settings::windowHeight, renderer->getFramePixels());
+			}
 
-			queue.finish();
+			if (referenceRenderer)
+			{
+				FrameTolerance tolerance = getDefaultFrameTolerance();
+				FrameDifference difference = compareFrames(renderer->getFramePixels(), referenceRenderer->getFramePixels(), tolerance);
+				bool passed = isWithinTolerance(difference, tolerance);
 
-			auto drawStart = std::chrono::high_resolution_clock::now();
-			window.drawFramebuffer();
-			auto drawEnd = std::chrono::high_resolution_clock::now();
+				std::cout << "OpenCL against CPU: max difference " << difference.maxDifference << ", mean difference "
+					<< std::setprecision(3) << difference.meanDifference << ", " << difference.outlierPixels << " of "
+					<< difference.numPixels << " pixels differ by more than " << tolerance.outlierDifference << " levels: "
+					<< (passed ? "within tolerance" : "OUTSIDE TOLERANCE") << std::endl;
 
-			Time::incTime("Aquire objects", aqEvent);
-			Time::incTime("Release objects", relEvent);
-			Time::incTime("Write lights", writeLightsEvent);
-			Time::incTime("Write spheres", writeLightsEvent);
-			Time::incTime("Primary rays", primEvent);
-			Time::incTime("Intersection Spheres", intersectSpheresEvents);
-			Time::incTime("Intersection Triangles", triangleEvents);
-			Time::incTime("Move rays", moveRaysEvents);
-			Time::incTime("Rays to light", updateRaysToLights);
-			Time::incTime("Shadow spheres", sphereShadowEvents);
-			Time::incTime("Shadow triangles", triangleShadowEvents);
-			Time::incTime("Accumulate colors", accumulateColorEvents);
-			Time::incTime("Dump image", dumpEvent);
-			
-			Time::incTime("Total OpenCL", drawStart - startCL);
-			Time::incTime("OpenCL enqueue work", endCL - startCL);
-			Time::incTime("OpenGL blit and swap", drawEnd - drawStart);
+				if (!passed)
+				{
+					return EXIT_FAILURE;
+				}
+			}
 		}
 	}
 	catch (const cl::Error& err)
@@ -810,7 +969,10 @@ int main(int argc, char** argv)
 #ifdef _DEBUG
 		throw;
 #else
-		system("pause");
+		if (!headless)
+		{
+			system("pause");
+		}
 		return EXIT_FAILURE;
 #endif
 	}
@@ -820,7 +982,10 @@ int main(int argc, char** argv)
 #ifdef _DEBUG
 		throw;
 #else
-		system("pause");
+		if (!headless)
+		{
+			system("pause");
+		}
 		return EXIT_FAILURE;
 #endif
 	}
@@ -1,11 +1,22 @@
 #include "Types.hcl"
 
+// Group of the spheres, instances use their index + 1
+#define SPHERE_GROUP 0
+
+// Must be at least Bvh::MAX_DEPTH
+#define BVH_STACK_SIZE 32
+
+// Specialized builds define this as a constant, see KernelVariants, otherwise the kernel argument is used
+#ifndef NUM_LIGHTS
+#define NUM_LIGHTS _numLights
+#endif
+
 __constant Light l = {
 	{0.f, 0.f, 50.f, 1.f},
 	{0.7f, 0.7f, 0.7f, 0.f}
 };
 
-__kernel void primaryRays(__global Ray* _res, const mat4 _invMat, const float4 _camPos, const int _width, const int _height, __global float4* _accumulationBuffer)
+__kernel void primaryRays(__global float4* _rayData, int _rayCapacity, const mat4 _invMat, const float4 _camPos, const int _width, const int _height, __global float4* _accumulationBuffer, __global int* _rayQueue)
 {
 	int2 pos = {get_global_id(0), get_global_id(1)};
 	int id = pos.x + _width * pos.y;
@@ -19,20 +30,33 @@ __kernel void primaryRays(__global Ray* _res, const mat4 _invMat, const float4 _
 	float4 worldPos = matmul(&_invMat, &fpos);
 	worldPos *= (1.f / worldPos.w);
 	float4 direction = normalize(worldPos - _camPos);
-	_res[id].position = _camPos;
-	_res[id].direction = direction;
-	_res[id].diffuseReflectivity = (float4)(0.f, 0.f, 0.f, 1.f);
-	_res[id].surfaceNormal = (float4)(0.f, 0.f, 0.f, 0.f);
-	_res[id].reflectDir = direction;
-	_res[id].distance = INFINITY;
-	_res[id].shininess = 0.f;
-	_res[id].strength = 0.f;
-	_res[id].totalStrength = 1.f;
-	_res[id].inShadow = false;
-	_res[id].collideGroup = -1;
-	_res[id].collideObject = -1;
+
+	// The cone starts at the camera and spreads over one pixel
+	float4 nextPos = fpos + (float4)(2.f / (float)_width, 0.f, 0.f, 0.f);
+	float4 nextWorldPos = matmul(&_invMat, &nextPos);
+	nextWorldPos *= (1.f / nextWorldPos.w);
+	float spread = length(normalize(nextWorldPos - _camPos) - direction);
+
+	Rays rays = getRays(_rayData, _rayCapacity);
+	rays.position[id] = _camPos;
+	rays.direction[id] = direction;
+	rays.diffuseReflectivity[id] = (float4)(0.f, 0.f, 0.f, 1.f);
+	rays.surfaceNormal[id] = (float4)(0.f, 0.f, 0.f, 0.f);
+	rays.reflectDir[id] = direction;
+	rays.distance[id] = INFINITY;
+	rays.shininess[id] = 0.f;
+	rays.strength[id] = 0.f;
+	rays.totalStrength[id] = 1.f;
+	rays.occlusion[id] = 0;
+	rays.collideGroup[id] = -1;
+	rays.collideObject[id] = -1;
+	rays.hitU[id] = 0.f;
+	rays.hitV[id] = 0.f;
+	rays.coneWidth[id] = 0.f;
+	rays.coneSpread[id] = spread;
 
 	_accumulationBuffer[id] = (float4)(0.f, 0.f, 0.f, 0.f);
+	_rayQueue[id] = id;
 }
 
 // http://www.scratchapixel.com/lessons/3d-basic-lessons/lesson-7-intersecting-simple-shapes/ray-sphere-intersection/
@@ -68,237 +92,684 @@ bool findSphereIntersectDistance(float4 _position, float4 _direction, float _dis
 	return true;
 }
 
-bool sphereIntersect(Ray* _ray, __constant Sphere* _sphere)
+void shadeSphereHit(const Rays* _rays, int _id, float4 _position, float4 _direction, __constant Sphere* _sphere, float t)
+{
+	_rays->diffuseReflectivity[_id] = _sphere->diffuseReflectivity * (1.f - _sphere->reflectFraction);
+	_rays->strength[_id] = _sphere->reflectFraction;
+	_rays->shininess[_id] = _sphere->reflectFraction * 400.f;
+
+	float4 intersectPoint = _position + _direction * t;
+	_rays->surfaceNormal[_id] = normalize(intersectPoint - _sphere->position);
+}
+
+__kernel void moveRaysToIntersection(__global float4* _rayData, int _rayCapacity, __global const int* _rayQueue, __global const int* _queueCount)
+{
+	int id = getQueuedRay(_rayQueue, _queueCount);
+	if (id < 0)
+		return;
+
+	Rays rays = getRays(_rayData, _rayCapacity);
+	float4 direction = rays.direction[id];
+	float4 normal = rays.surfaceNormal[id];
+
+	rays.position[id] += direction * rays.distance[id] + normal * 0.001f;
+	rays.reflectDir[id] = direction - 2 * dot(direction, normal) * normal;
+	// The surfaces are treated as flat, so a reflection keeps the spread of the cone
+	rays.coneWidth[id] += rays.coneSpread[id] * rays.distance[id];
+
+	float currentStrength = rays.totalStrength[id];
+	rays.totalStrength[id] = currentStrength * rays.strength[id];
+	rays.strength[id] = currentStrength;
+}
+
+// Real-Time Rendering, pg. 750
+bool findTriangleIntersectDistance(float4 _position, float4 _direction, float _distance, __global const IntersectTriangle* _triangle, float* t, float* u, float* v)
 {
-	float t = 0.f;
-	if (!findSphereIntersectDistance(_ray->position, _ray->direction, _ray->distance, _sphere, &t))
+	float4 e1 = _triangle->e1;
+	float4 e2 = _triangle->e2;
+
+	float4 q = cross(_direction, e2);
+	float a = dot(e1, q);
+	if(fabs(a) < 0.00001f)
+		return false;
+
+	float f = 1.f / a;
+
+	float4 s = _position - _triangle->v0;
+	*u = f * dot(s, q);
+	if(*u < 0.f)
+		return false;
+
+	float4 r = cross(s, e1);
+	*v = f * dot(_direction, r);
+	if(*v < 0.f || *u + *v > 1.f)
+		return false;
+
+	*t = f * dot(e2, r);
+
+	if (*t > _distance || *t <= 0.f)
 	{
 		return false;
 	}
 	
-	_ray->distance = t;
-	_ray->diffuseReflectivity = _sphere->diffuseReflectivity * (1.f - _sphere->reflectFraction);
-	_ray->strength = _sphere->reflectFraction;
-	_ray->shininess = _sphere->reflectFraction * 400.f;
+	return true;
+}
 
-	float4 intersectPoint = _ray->position + _ray->direction * t;
-	_ray->surfaceNormal = normalize(intersectPoint - _sphere->position);
+float2 getTextureCoord(__global const SceneVertex* _v0, __global const SceneVertex* _v1, __global const SceneVertex* _v2, float u, float v)
+{
+	return (1.f - u - v) * loadSceneTextureCoord(_v0) + u * loadSceneTextureCoord(_v1) + v * loadSceneTextureCoord(_v2);
+}
 
-	return true;
+// _v0, _v1 and _v2 are the corners of the hit triangle. _diffuseSample and _normalSample are the texels of the model textures at the hit.
+void shadeTriangleHit(const Rays* _rays, int _id, __global const SceneVertex* _v0, __global const SceneVertex* _v1, __global const SceneVertex* _v2,
+	float u, float v, const mat4* _transform, const mat4* _normalTransform, float _reflectFraction, float4 _diffuseSample, float4 _normalSample)
+{
+	float4 n0, n1, n2, t0, t1, t2, b0, b1, b2;
+	loadSceneFrame(_v0, &n0, &t0, &b0);
+	loadSceneFrame(_v1, &n1, &t1, &b1);
+	loadSceneFrame(_v2, &n2, &t2, &b2);
+
+	float4 normal = ((1.f - u - v) * n0 + u * n1 + v * n2);
+	float4 tangent = ((1.f - u - v) * t0 + u * t1 + v * t2);
+	float4 bitangent = ((1.f - u - v) * b0 + u * b1 + v * b2);
+
+	// The vertices are stored in object space
+	normal = matmul(_normalTransform, &normal);
+	tangent = matmul(_transform, &tangent);
+	bitangent = matmul(_transform, &bitangent);
+	normal.w = 0.f;
+	tangent.w = 0.f;
+	bitangent.w = 0.f;
+
+	float4 diffuse = (1.f - _reflectFraction) * _diffuseSample;
+	diffuse.w = 1.f;
+	_rays->diffuseReflectivity[_id] = diffuse;
+	_rays->strength[_id] = _reflectFraction;
+	_rays->shininess[_id] = _reflectFraction * 400.f;
+
+	float4 textureNormal = _normalSample;
+	textureNormal -= 0.5f;
+	textureNormal *= 2.f;
+	textureNormal.w = 0.f;
+	_rays->surfaceNormal[_id] = normalize(
+		textureNormal.x * normalize(tangent)
+		+ textureNormal.y * normalize(bitangent)
+		+ textureNormal.z * normalize(normal));
+}
+
+// Avoids divisions by zero for axis aligned rays
+float4 safeInverse(float4 _direction)
+{
+	return 1.f / copysign(fmax(fabs(_direction), 1e-8f), _direction);
+}
+
+// Slab test, t is set to the distance where the ray enters the box
+bool findBoxIntersectDistance(float4 _position, float4 _invDirection, float _distance, __global const BvhNode* _node, float* t)
+{
+	float4 t0 = (_node->min - _position) * _invDirection;
+	float4 t1 = (_node->max - _position) * _invDirection;
+	float4 tNear = fmin(t0, t1);
+	float4 tFar = fmax(t0, t1);
+
+	float enter = fmax(fmax(tNear.x, tNear.y), fmax(tNear.z, 0.f));
+	float exit = fmin(fmin(tFar.x, tFar.y), fmin(tFar.z, _distance));
+
+	*t = enter;
+	return enter <= exit;
+}
+
+// Models are stored and traversed in object space, so the ray is moved there instead of the vertices.
+// The direction is not renormalized, which keeps the ray parameter t the same in both spaces.
+void toObjectSpace(float4 _position, float4 _direction, const mat4* _invWorld, float4* _objPosition, float4* _objDirection)
+{
+	float4 position = (float4)(_position.xyz, 1.f);
+	float4 direction = (float4)(_direction.xyz, 0.f);
+
+	*_objPosition = matmul(_invWorld, &position);
+	*_objDirection = matmul(_invWorld, &direction);
 }
 
-__kernel void findClosestSpheres(__global Ray* _rays, int numRays, __constant Sphere* _spheres, int _numSpheres, int _groupID)
+typedef struct Hit
+{
+	float distance;
+	float u;
+	float v;
+	int group;
+	int object;
+} Hit;
+
+// Finds the closest triangle of an instance that is closer than _hit->distance
+void findClosestInstanceHit(float4 _position, float4 _direction, __global const Instance* _instance,
+	__global const BvhNode* _blasNodes, __global const IntersectTriangle* _triangles, int _prevGroup, int _prevObject, Hit* _hit)
 {
-	int id = get_global_id(0);
-	if (id >= numRays)
+	mat4 invWorld = _instance->invWorld;
+	float4 objPosition;
+	float4 objDirection;
+	toObjectSpace(_position, _direction, &invWorld, &objPosition, &objDirection);
+	float4 invDirection = safeInverse(objDirection);
+
+	__global const BvhNode* nodes = _blasNodes + _instance->nodeOffset;
+	__global const IntersectTriangle* triangles = _triangles + _instance->triangleOffset;
+	int groupID = _instance->groupID;
+
+	float t;
+	if (!findBoxIntersectDistance(objPosition, invDirection, _hit->distance, &nodes[0], &t))
 		return;
 
-	Ray r = _rays[id];
+	int stack[BVH_STACK_SIZE];
+	int stackSize = 0;
+	int nodeIdx = 0;
 
-	for (unsigned int i = 0; i < _numSpheres; i++)
+	while (true)
 	{
-		if (r.collideGroup == _groupID && r.collideObject == i)
-			continue;
+		__global const BvhNode* node = &nodes[nodeIdx];
 
-		if (sphereIntersect(&r, &_spheres[i]))
+		if (node->count > 0)
+		{
+			for (int i = node->leftFirst; i < node->leftFirst + node->count; i++)
+			{
+				if (_prevGroup == groupID && _prevObject == i)
+					continue;
+
+				float u;
+				float v;
+				if (findTriangleIntersectDistance(objPosition, objDirection, _hit->distance, &triangles[i], &t, &u, &v))
+				{
+					_hit->distance = t;
+					_hit->u = u;
+					_hit->v = v;
+					_hit->group = groupID;
+					_hit->object = i;
+				}
+			}
+		}
+		else
 		{
-			r.collideGroup = _groupID;
-			r.collideObject = i;
+			int nearChild = node->leftFirst;
+			int farChild = nearChild + 1;
+
+			float tNear;
+			float tFar;
+			bool hitNear = findBoxIntersectDistance(objPosition, invDirection, _hit->distance, &nodes[nearChild], &tNear);
+			bool hitFar = findBoxIntersectDistance(objPosition, invDirection, _hit->distance, &nodes[farChild], &tFar);
+
+			if (hitNear && hitFar)
+			{
+				if (tFar < tNear)
+				{
+					int temp = nearChild;
+					nearChild = farChild;
+					farChild = temp;
+				}
+
+				stack[stackSize++] = farChild;
+				nodeIdx = nearChild;
+				continue;
+			}
+			else if (hitNear)
+			{
+				nodeIdx = nearChild;
+				continue;
+			}
+			else if (hitFar)
+			{
+				nodeIdx = farChild;
+				continue;
+			}
 		}
 
-	}
+		if (stackSize == 0)
+			break;
 
-	_rays[id] = r;
+		nodeIdx = stack[--stackSize];
+	}
 }
 
-__kernel void detectShadowWithSpheres(__global Ray* _rays, int _numRays, __constant Sphere* _spheres, int _numSpheres, int _groupID)
+// Returns true as soon as any triangle of the instance blocks the ray
+bool isInstanceOccluding(float4 _position, float4 _direction, float _distance, __global const Instance* _instance,
+	__global const BvhNode* _blasNodes, __global const IntersectTriangle* _triangles, int _prevGroup, int _prevObject)
 {
-	int id = get_global_id(0);
-	if (id >= _numRays)
-		return;
+	mat4 invWorld = _instance->invWorld;
+	float4 objPosition;
+	float4 objDirection;
+	toObjectSpace(_position, _direction, &invWorld, &objPosition, &objDirection);
+	float4 invDirection = safeInverse(objDirection);
+
+	__global const BvhNode* nodes = _blasNodes + _instance->nodeOffset;
+	__global const IntersectTriangle* triangles = _triangles + _instance->triangleOffset;
+	int groupID = _instance->groupID;
+
+	float t;
+	if (!findBoxIntersectDistance(objPosition, invDirection, _distance, &nodes[0], &t))
+		return false;
 
-	float4 position = _rays[id].position;
-	float4 direction = _rays[id].direction;
-	float distance = _rays[id].distance;
-	int inShadow = _rays[id].inShadow;
-	int collideGroup = _rays[id].collideGroup;
-	int collideObject = _rays[id].collideObject;
+	int stack[BVH_STACK_SIZE];
+	int stackSize = 0;
+	int nodeIdx = 0;
 
-	float dummy;
-	for (unsigned int i = 0; inShadow == false && i < _numSpheres; i++)
+	float u;
+	float v;
+	while (true)
 	{
-		if (collideGroup == _groupID && collideObject == i)
-			continue;
+		__global const BvhNode* node = &nodes[nodeIdx];
 
-		inShadow = findSphereIntersectDistance(position, direction, distance, &_spheres[i], &dummy);
-		if (distance - dummy < 0.11f)
-			inShadow = false;
+		if (node->count > 0)
+		{
+			for (int i = node->leftFirst; i < node->leftFirst + node->count; i++)
+			{
+				if (_prevGroup == groupID && _prevObject == i)
+					continue;
+
+				if (findTriangleIntersectDistance(objPosition, objDirection, _distance, &triangles[i], &t, &u, &v))
+					return true;
+			}
+		}
+		else
+		{
+			int left = node->leftFirst;
+
+			bool hitLeft = findBoxIntersectDistance(objPosition, invDirection, _distance, &nodes[left], &t);
+			bool hitRight = findBoxIntersectDistance(objPosition, invDirection, _distance, &nodes[left + 1], &t);
+
+			if (hitLeft && hitRight)
+			{
+				stack[stackSize++] = left + 1;
+				nodeIdx = left;
+				continue;
+			}
+			else if (hitLeft)
+			{
+				nodeIdx = left;
+				continue;
+			}
+			else if (hitRight)
+			{
+				nodeIdx = left + 1;
+				continue;
+			}
+		}
+
+		if (stackSize == 0)
+			break;
+
+		nodeIdx = stack[--stackSize];
 	}
 
-	_rays[id].inShadow = inShadow;
+	return false;
 }
 
-__kernel void moveRaysToIntersection(__global Ray* _rays, int _numRays)
+// Traverses the top-level hierarchy over all instances and spheres. Only records where the ray hit,
+// the materials are resolved once per bounce by shadeHits.
+__kernel void findClosestHits(__global float4* _rayData, int _rayCapacity, __global const int* _rayQueue, __global const int* _queueCount,
+	__constant Sphere* _spheres, int _numSpheres, __global const BvhNode* _tlasNodes, __global const int* _tlasItems,
+	__global const Instance* _instances, int _numInstances, __global const BvhNode* _blasNodes, __global const IntersectTriangle* _triangles)
 {
-	int id = get_global_id(0);
-	if (id >= _numRays)
+	int id = getQueuedRay(_rayQueue, _queueCount);
+	if (id < 0)
 		return;
 
-	if (_rays[id].distance == INFINITY)
+	Rays rays = getRays(_rayData, _rayCapacity);
+	float4 position = rays.position[id];
+	float4 direction = rays.direction[id];
+	int collideGroup = rays.collideGroup[id];
+	int collideObject = rays.collideObject[id];
+
+	Hit hit;
+	hit.distance = rays.distance[id];
+	hit.u = 0.f;
+	hit.v = 0.f;
+	hit.group = -1;
+	hit.object = -1;
+
+	float4 invDirection = safeInverse(direction);
+
+	float t;
+	if (!findBoxIntersectDistance(position, invDirection, hit.distance, &_tlasNodes[0], &t))
+		return;
+
+	int stack[BVH_STACK_SIZE];
+	int stackSize = 0;
+	int nodeIdx = 0;
+
+	while (true)
 	{
+		__global const BvhNode* node = &_tlasNodes[nodeIdx];
+
+		if (node->count > 0)
+		{
+			for (int i = node->leftFirst; i < node->leftFirst + node->count; i++)
+			{
+				int item = _tlasItems[i];
+				if (item < _numInstances)
+				{
+					findClosestInstanceHit(position, direction, &_instances[item], _blasNodes, _triangles, collideGroup, collideObject, &hit);
+				}
+				else
+				{
+					int sphere = item - _numInstances;
+					if (collideGroup == SPHERE_GROUP && collideObject == sphere)
+						continue;
+
+					if (findSphereIntersectDistance(position, direction, hit.distance, &_spheres[sphere], &t))
+					{
+						hit.distance = t;
+						hit.group = SPHERE_GROUP;
+						hit.object = sphere;
+					}
+				}
+			}
+		}
+		else
+		{
+			int nearChild = node->leftFirst;
+			int farChild = nearChild + 1;
+
+			float tNear;
+			float tFar;
+			bool hitNear = findBoxIntersectDistance(position, invDirection, hit.distance, &_tlasNodes[nearChild], &tNear);
+			bool hitFar = findBoxIntersectDistance(position, invDirection, hit.distance, &_tlasNodes[farChild], &tFar);
+
+			if (hitNear && hitFar)
+			{
+				if (tFar < tNear)
+				{
+					int temp = nearChild;
+					nearChild = farChild;
+					farChild = temp;
+				}
+
+				stack[stackSize++] = farChild;
+				nodeIdx = nearChild;
+				continue;
+			}
+			else if (hitNear)
+			{
+				nodeIdx = nearChild;
+				continue;
+			}
+			else if (hitFar)
+			{
+				nodeIdx = farChild;
+				continue;
+			}
+		}
+
+		if (stackSize == 0)
+			break;
+
+		nodeIdx = stack[--stackSize];
+	}
+
+	if (hit.group == -1)
 		return;
+
+	rays.distance[id] = hit.distance;
+	rays.hitU[id] = hit.u;
+	rays.hitV[id] = hit.v;
+	rays.collideGroup[id] = hit.group;
+	rays.collideObject[id] = hit.object;
+}
+
+float4 sampleMipLevel(image2d_t _atlas, int4 _rect, float2 _texCoord, int _level)
+{
+	const sampler_t levelSampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_LINEAR;
+
+	int2 baseSize = _rect.zw;
+	float2 offset = convert_float2(_rect.xy);
+	if (_level > 0)
+	{
+		offset.x += baseSize.x;
+		for (int i = 1; i < _level; ++i)
+		{
+			offset.y += baseSize.y >> i;
+		}
 	}
 
-	Ray r = _rays[id];
+	// Kept half a texel inside the level, so the filter never reaches into the next one
+	float2 levelSize = convert_float2(baseSize >> _level);
+	float2 coord = clamp(clamp(_texCoord, 0.f, 1.f) * levelSize, 0.5f, levelSize - 0.5f);
+	return read_imagef(_atlas, levelSampler, offset + coord);
+}
+
+// Trilinear filtering of a mip chain laid out as in MipChain.h. _rect holds the position of the chain in the atlas and
+// the size of its base level. _lodBase is the level of detail for a texture of a single texel.
+float4 sampleMipChain(image2d_t _atlas, int4 _rect, float2 _texCoord, float _lodBase)
+{
+	int2 baseSize = _rect.zw;
+	int levels = 32 - clz(min(baseSize.x, baseSize.y));
 
-	r.position += r.direction * r.distance + r.surfaceNormal * 0.001f;
-	r.reflectDir = r.direction - 2 * dot(r.direction, r.surfaceNormal) * r.surfaceNormal;
+	float lod = clamp(_lodBase + 0.5f * log2((float)baseSize.x * (float)baseSize.y), 0.f, (float)(levels - 1));
+	int level = (int)lod;
+	float fraction = lod - level;
 
-	float currentStrength = r.totalStrength;
-	r.totalStrength *= r.strength;
-	r.strength = currentStrength;
+	float4 texel = sampleMipLevel(_atlas, _rect, _texCoord, level);
+	if (fraction > 0.f)
+	{
+		texel = mix(texel, sampleMipLevel(_atlas, _rect, _texCoord, level + 1), fraction);
+	}
+	return texel;
+}
 
-	_rays[id] = r;
+// Ray cone level of detail (Akenine-Moller et al., Texture Level of Detail Strategies for Real-Time Ray Tracing), without
+// the size of the texture. _e1 and _e2 are the world space edges of the triangle and _t0 to _t2 its texture coordinates.
+float getTextureLodBase(float4 _e1, float4 _e2, float2 _t0, float2 _t1, float2 _t2, float4 _direction, float _coneWidth)
+{
+	float4 normal = cross(_e1, _e2);
+	float worldArea = fmax(length(normal), 1e-20f);
+	float2 uv1 = _t1 - _t0;
+	float2 uv2 = _t2 - _t0;
+	float texelArea = fmax(fabs(uv1.x * uv2.y - uv2.x * uv1.y), 1e-20f);
+
+	float cosine = fmax(fabs(dot(normal, _direction)) / worldArea, 1e-4f);
+	return 0.5f * log2(texelArea / worldArea) + log2(fmax(_coneWidth, 1e-20f)) - log2(cosine);
 }
 
-__kernel void updateRaysToLight(__global Ray* _rays, int _numRays, __constant Light* _lights, int _lightIdx)
+// Resolves the materials of the closest hits of this bounce, so every ray reads its textures once
+__kernel void shadeHits(__global float4* _rayData, int _rayCapacity, __global const int* _rayQueue, __global const int* _queueCount,
+	__constant Sphere* _spheres, __global const Instance* _instances, __global const InstanceShading* _shading,
+	__global const SceneVertex* _vertices, __global const int* _indices, float _reflectFraction,
+	image2d_t _textureAtlas, __global const int4* _atlasRects)
 {
-	int id = get_global_id(0);
-	if (id >= _numRays)
+	int id = getQueuedRay(_rayQueue, _queueCount);
+	if (id < 0)
 		return;
 
-	float4 position = _rays[id].position;
+	Rays rays = getRays(_rayData, _rayCapacity);
+	if (rays.distance[id] == INFINITY)
+		return;
 
-	float4 relativeLightPos = _lights[_lightIdx].position - position;
-	float newDistance = length(relativeLightPos);
-	float4 direction = relativeLightPos / newDistance;
+	int group = rays.collideGroup[id];
+	int object = rays.collideObject[id];
+	if (group == SPHERE_GROUP)
+	{
+		shadeSphereHit(&rays, id, rays.position[id], rays.direction[id], &_spheres[object], rays.distance[id]);
+		return;
+	}
 
-	_rays[id].distance = newDistance;
-	_rays[id].direction = direction;
-	_rays[id].inShadow = false;
+	int instance = group - 1;
+	float u = rays.hitU[id];
+	float v = rays.hitV[id];
+	__global const int* indices = &_indices[(_instances[instance].triangleOffset + object) * 3];
+	__global const SceneVertex* vertices = _vertices + _instances[instance].vertexOffset;
+	__global const SceneVertex* v0 = &vertices[indices[0]];
+	__global const SceneVertex* v1 = &vertices[indices[1]];
+	__global const SceneVertex* v2 = &vertices[indices[2]];
+	float2 texCoord = getTextureCoord(v0, v1, v2, u, v);
+
+	mat4 transform = _shading[instance].transform;
+	mat4 normalTransform = _shading[instance].normalTransform;
+
+	float4 p0 = loadScenePosition(v0);
+	float4 e1 = loadScenePosition(v1) - p0;
+	float4 e2 = loadScenePosition(v2) - p0;
+	e1 = matmul(&transform, &e1);
+	e2 = matmul(&transform, &e2);
+	float coneWidth = rays.coneWidth[id] + rays.coneSpread[id] * rays.distance[id];
+	float lodBase = getTextureLodBase(e1, e2, loadSceneTextureCoord(v0), loadSceneTextureCoord(v1), loadSceneTextureCoord(v2),
+		rays.direction[id], coneWidth);
+
+	float4 diffuseSample = sampleMipChain(_textureAtlas, _atlasRects[_shading[instance].diffuseMap], texCoord, lodBase);
+	float4 normalSample = sampleMipChain(_textureAtlas, _atlasRects[_shading[instance].normalMap], texCoord, lodBase);
+
+	shadeTriangleHit(&rays, id, v0, v1, v2, u, v, &transform, &normalTransform, _reflectFraction, diffuseSample, normalSample);
 }
 
-// Real-Time Rendering, pg. 750
-bool findTriangleIntersectDistance(float4 _position, float4 _direction, float _distance, __global Triangle* _triangle, float* t, float* u, float* v)
+// Any hit traversal of the top-level hierarchy, true if something lies between the point and the light
+bool isOccluded(float4 _position, float4 _direction, float _distance, int _collideGroup, int _collideObject,
+	__constant Sphere* _spheres, __global const BvhNode* _tlasNodes, __global const int* _tlasItems,
+	__global const Instance* _instances, int _numInstances, __global const BvhNode* _blasNodes, __global const IntersectTriangle* _triangles)
 {
-	float4 e1 = _triangle->v[1].position - _triangle->v[0].position;
-	float4 e2 = _triangle->v[2].position - _triangle->v[0].position;
-	
-	float4 q = cross(_direction, e2);
-	float a = dot(e1, q);
-	if(fabs(a) < 0.00001f)
+	float4 invDirection = safeInverse(_direction);
+
+	float t;
+	if (!findBoxIntersectDistance(_position, invDirection, _distance, &_tlasNodes[0], &t))
 		return false;
 
-	float f = 1.f / a;
+	int stack[BVH_STACK_SIZE];
+	int stackSize = 0;
+	int nodeIdx = 0;
 
-	float4 s = _position - _triangle->v[0].position;
-	*u = f * dot(s, q);
-	if(*u < 0.f)
-		return false;
+	bool occluded = false;
+	while (occluded == false)
+	{
+		__global const BvhNode* node = &_tlasNodes[nodeIdx];
 
-	float4 r = cross(s, e1);
-	*v = f * dot(_direction, r);
-	if(*v < 0.f || *u + *v > 1.f)
-		return false;
+		if (node->count > 0)
+		{
+			for (int i = node->leftFirst; occluded == false && i < node->leftFirst + node->count; i++)
+			{
+				int item = _tlasItems[i];
+				if (item < _numInstances)
+				{
+					occluded = isInstanceOccluding(_position, _direction, _distance, &_instances[item], _blasNodes, _triangles, _collideGroup, _collideObject);
+				}
+				else
+				{
+					int sphere = item - _numInstances;
+					if (_collideGroup == SPHERE_GROUP && _collideObject == sphere)
+						continue;
+
+					// The spheres closest to the light are the lights themselves, which should not cast shadows
+					occluded = findSphereIntersectDistance(_position, _direction, _distance, &_spheres[sphere], &t) && _distance - t >= 0.11f;
+				}
+			}
+		}
+		else
+		{
+			int left = node->leftFirst;
+
+			bool hitLeft = findBoxIntersectDistance(_position, invDirection, _distance, &_tlasNodes[left], &t);
+			bool hitRight = findBoxIntersectDistance(_position, invDirection, _distance, &_tlasNodes[left + 1], &t);
+
+			if (hitLeft && hitRight)
+			{
+				stack[stackSize++] = left + 1;
+				nodeIdx = left;
+				continue;
+			}
+			else if (hitLeft)
+			{
+				nodeIdx = left;
+				continue;
+			}
+			else if (hitRight)
+			{
+				nodeIdx = left + 1;
+				continue;
+			}
+		}
 
-	*t = f * dot(e2, r);
+		if (stackSize == 0)
+			break;
 
-	if (*t > _distance || *t <= 0.f)
-	{
-		return false;
+		nodeIdx = stack[--stackSize];
 	}
-	
-	return true;
+
+	return occluded;
 }
 
-bool triangleIntersect(Ray* _ray, __global Triangle* _triangle, float _reflectFraction, image2d_t _diffuseTex, image2d_t _normalTex)
+// Blinn-Phong contribution of a light that reaches the point
+float4 calculateLight(float4 _position, float4 _normal, float4 _reflectDir, float4 _reflectivity, float _shininess, __constant Light* _light)
 {
-	float t = 0.f;
-	float u = 0.f;
-	float v = 0.f;
-	if (!findTriangleIntersectDistance(_ray->position, _ray->direction, _ray->distance, _triangle, &t, &u, &v))
-	{
-		return false;
-	}
-	
-	float2 texCoord = ((1.f - u - v) * _triangle->v[0].textureCoord.xy + u * _triangle->v[1].textureCoord.xy + v * _triangle->v[2].textureCoord.xy);
-	float4 normal = ((1.f - u - v) * _triangle->v[0].normal + u * _triangle->v[1].normal + v * _triangle->v[2].normal);
-	float4 tangent = ((1.f - u - v) * _triangle->v[0].tangent + u * _triangle->v[1].tangent + v * _triangle->v[2].tangent);
-	float4 bitangent = ((1.f - u - v) * _triangle->v[0].bitangent + u * _triangle->v[1].bitangent + v * _triangle->v[2].bitangent);
+	float4 relativePos = _light->position - _position;
+	float4 lightDir = normalize(relativePos);
+	float distanceSq = dot(relativePos, relativePos);
 
-	const sampler_t diffSampler = CLK_NORMALIZED_COORDS_TRUE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_LINEAR;
+	float NdotL = dot(_normal, lightDir);
+	float intensity = clamp(NdotL, 0.f, 1.f);
 
-	_ray->distance = t;
-	_ray->diffuseReflectivity = (1.f - _reflectFraction) * read_imagef(_diffuseTex, diffSampler, texCoord);
-	_ray->diffuseReflectivity.w = 1.f;
-	_ray->strength = _reflectFraction;
-	_ray->shininess = _reflectFraction * 400.f;
+	float4 diffuseLight = intensity * _light->intensity / distanceSq;
 
-	float4 textureNormal = read_imagef(_normalTex, diffSampler, texCoord);
-	textureNormal -= 0.5f;
-	textureNormal *= 2.f;
-	textureNormal.w = 0.f;
-	_ray->surfaceNormal = normalize(
-		textureNormal.x * normalize(tangent)
-		+ textureNormal.y * normalize(bitangent)
-		+ textureNormal.z * normalize(normal));
+	float4 halfway = normalize(lightDir - (_reflectDir - 2 * dot(_reflectDir, _normal) * _normal));
 
-	return true;
+	float NdotH = dot(_normal, halfway);
+	intensity = pow(clamp(NdotH, 0.f, 1.f), _shininess);
+
+	float4 specularLight = intensity * _light->intensity / distanceSq;
+
+	return _reflectivity * (diffuseLight + specularLight);
 }
 
-__kernel void findClosestTriangles(__global Ray* _rays, int numRays, __global Triangle* _triangles, int _numTriangles, float _reflectFraction, image2d_t _diffuseTex, image2d_t _normalTex, int _groupID)
+// Casts the shadow rays to every light from the hit points and records which lights are occluded as a bitmask,
+// so the lighting can be resolved for all lights at once by shadeLights
+__kernel void findOccludedLights(__global float4* _rayData, int _rayCapacity, __global const int* _rayQueue, __global const int* _queueCount,
+	__constant Sphere* _spheres, int _numSpheres, __global const BvhNode* _tlasNodes, __global const int* _tlasItems,
+	__global const Instance* _instances, int _numInstances, __global const BvhNode* _blasNodes, __global const IntersectTriangle* _triangles,
+	__constant Light* _lights, int _numLights)
 {
-	int id = get_global_id(0);
-	if (id >= numRays)
+	int id = getQueuedRay(_rayQueue, _queueCount);
+	if (id < 0)
 		return;
 
-	Ray r = _rays[id];
+	Rays rays = getRays(_rayData, _rayCapacity);
+	float4 position = rays.position[id];
+	int collideGroup = rays.collideGroup[id];
+	int collideObject = rays.collideObject[id];
 
-	for (unsigned int i = 0; i < _numTriangles; i++)
+	uint occlusion = 0;
+	for (int i = 0; i < NUM_LIGHTS; i++)
 	{
-		if (r.collideGroup == _groupID && r.collideObject == i)
-			continue;
+		float4 relativeLightPos = _lights[i].position - position;
+		float distance = length(relativeLightPos);
+		float4 direction = relativeLightPos / distance;
 
-		if(triangleIntersect(&r, &_triangles[i], _reflectFraction, _diffuseTex, _normalTex))
+		if (isOccluded(position, direction, distance, collideGroup, collideObject,
+			_spheres, _tlasNodes, _tlasItems, _instances, _numInstances, _blasNodes, _triangles))
 		{
-			r.collideGroup = _groupID;
-			r.collideObject = i;
+			occlusion |= 1u << i;
 		}
-		
 	}
 
-	_rays[id] = r;
+	rays.occlusion[id] = occlusion;
 }
 
-__kernel void detectShadowWithTriangles(__global Ray* _rays, int numRays, __global Triangle* _triangles, int _numTriangles, int _groupID)
+// Accumulates the lighting of every light that reaches the hit points and sets up the rays for the next bounce
+__kernel void shadeLights(__global float4* _rayData, int _rayCapacity, __global const int* _rayQueue, __global const int* _queueCount,
+	__constant Light* _lights, int _numLights, __global float4* _accumulationBuffer)
 {
-	int id = get_global_id(0);
-	if (id >= numRays)
+	int id = getQueuedRay(_rayQueue, _queueCount);
+	if (id < 0)
 		return;
 
-	int inShadow = _rays[id].inShadow;
+	Rays rays = getRays(_rayData, _rayCapacity);
+	float4 position = rays.position[id];
+	float4 normal = rays.surfaceNormal[id];
+	float4 reflectDir = rays.reflectDir[id];
+	float4 reflectivity = rays.diffuseReflectivity[id];
+	float shininess = rays.shininess[id];
+	uint occlusion = rays.occlusion[id];
 
-	if (inShadow)
+	float4 color = (float4)(0.f, 0.f, 0.f, 0.f);
+	for (int i = 0; i < NUM_LIGHTS; i++)
 	{
-		return;
+		if ((occlusion & (1u << i)) == 0)
+		{
+			color += calculateLight(position, normal, reflectDir, reflectivity, shininess, &_lights[i]);
+		}
 	}
 
-	float4 position = _rays[id].position;
-	float4 direction = _rays[id].direction;
-	float distance = _rays[id].distance;
-	int collideGroup = _rays[id].collideGroup;
-	int collideObject = _rays[id].collideObject;
-
-	float dummy;
-	float dummier;
-	float dummiest;
-	for (unsigned int i = 0; inShadow == false && i < _numTriangles; i++)
-	{
-		if (collideGroup == _groupID && collideObject == i)
-			continue;
-
-		inShadow = findTriangleIntersectDistance(position, direction, distance, &_triangles[i], &dummy, &dummier, &dummiest);
-	}
+	_accumulationBuffer[id] += rays.strength[id] * (float4)(color.xyz, 0.f);
 
-	_rays[id].inShadow = inShadow;
+	rays.direction[id] = reflectDir;
+	rays.distance[id] = INFINITY;
 }